@@ -15,6 +15,7 @@ G4ENCODER g4;
 #define HEIGHT 128
 static uint8_t ucPixels[WIDTH];
 static uint8_t ucTemp[2048]; // output buffer to hold compressed data
+static uint8_t ucTemp2[2048]; // second output buffer for comparisons
 //
 // Return the current time in milliseconds
 //
@@ -37,6 +38,103 @@ void TIFFLOG(int line, char *string, const char *result)
     printf("Line: %d: msg: %s%s\n", line, string, result);
 } /* TIFFLOG() */
 
+//
+// Memory "file" for the streamed TIFF test
+//
+static uint8_t ucFile[8192];
+static int iFilePos, iFileLen;
+int MemWrite(uint8_t *pBuf, int iLen)
+{
+    if (iFilePos + iLen > (int)sizeof(ucFile))
+        return 0;
+    memcpy(&ucFile[iFilePos], pBuf, iLen);
+    iFilePos += iLen;
+    if (iFilePos > iFileLen) iFileLen = iFilePos;
+    return iLen;
+} /* MemWrite() */
+
+int MemSeek(int iPosition)
+{
+    iFilePos = iPosition;
+    return iPosition;
+} /* MemSeek() */
+
+static int iSeeksLeft; // FailSeek() works this many times
+int FailSeek(int iPosition)
+{
+    if (iSeeksLeft == 0)
+        return -1; // e.g. the file was closed
+    iSeeksLeft--;
+    return MemSeek(iPosition);
+} /* FailSeek() */
+
+//
+// Write callback with a context pointer; each encoder writes to its own buffer
+//
+typedef struct sink_tag
+{
+    uint8_t *pBuf;
+    int iLen, iSize;
+} SINK;
+
+int SinkWrite(void *pUser, uint8_t *pBuf, int iLen)
+{
+    SINK *pSink = (SINK *)pUser;
+    if (pSink->iLen + iLen > pSink->iSize)
+        return 0;
+    memcpy(&pSink->pBuf[pSink->iLen], pBuf, iLen);
+    pSink->iLen += iLen;
+    return iLen;
+} /* SinkWrite() */
+
+//
+// Sink which keeps the buffers it's given until the test releases them
+// (like a DMA transfer which finishes later)
+//
+static uint8_t *pPending[2];
+static int iPending, iPendingOff[2], iPendingLen[2];
+int PendingWrite(void *pUser, uint8_t *pBuf, int iLen)
+{
+    SINK *pSink = (SINK *)pUser;
+    if (iPending == 2)
+        return 0; // more than 2 buffers in flight
+    iPendingOff[iPending] = pSink->iLen; // where the copy is, to check the buffer wasn't touched
+    iPendingLen[iPending] = iLen;
+    SinkWrite(pUser, pBuf, iLen); // the data is copied, but the buffer stays busy
+    pPending[iPending++] = pBuf;
+    return G4ENC_WRITE_PENDING;
+} /* PendingWrite() */
+
+//
+// Sink which checks the size of each chunk it gets
+//
+static int iChunkSize, iChunks, iBadChunks;
+int ChunkWrite(void *pUser, uint8_t *pBuf, int iLen)
+{
+    iChunks++;
+    if (iLen != iChunkSize)
+        iBadChunks++;
+    return SinkWrite(pUser, pBuf, iLen);
+} /* ChunkWrite() */
+
+//
+// Read a value from a little-endian TIFF tag of the IFD at iIFD
+//
+static uint32_t GetTIFFTag(uint8_t *pFile, int iIFD, int iTag, int *pCount)
+{
+    int i, iTags = pFile[iIFD] | (pFile[iIFD+1] << 8);
+    uint8_t *p;
+    for (i=0; i<iTags; i++) {
+        p = &pFile[iIFD + 2 + i*12];
+        if ((p[0] | (p[1] << 8)) == iTag) {
+            *pCount = p[4] | (p[5] << 8) | (p[6] << 16) | (p[7] << 24);
+            return p[8] | (p[9] << 8) | (p[10] << 16) | ((uint32_t)p[11] << 24);
+        }
+    }
+    *pCount = 0;
+    return 0;
+} /* GetTIFFTag() */
+
 int main(int argc, const char * argv[]) {
     //int i, iTime1, iTime2;
     int iSize, y, rc, iPitch;
@@ -162,5 +260,962 @@ int main(int argc, const char * argv[]) {
         printf("g4.init() returned %d\n", rc);
     }
 
+    // Test 5 - multi-strip output; serial and threaded encoding must match
+    szTestName = (char *)"G4 encode, multi-strip serial vs threaded";
+    TIFFLOG(__LINE__, szTestName, szStart);
+    {
+        uint32_t u32Serial[4], u32Threaded[4];
+        int iSize2 = 0;
+        iPitch = (73 + 7) >> 3;
+        iPitch = (iPitch + 3) & 0xfffc; // DWORD aligned for Windows BMP files
+        rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, ucTemp, sizeof(ucTemp));
+        if (rc == G4ENC_SUCCESS) rc = g4.setStrips(64, u32Serial);
+        s = (uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch; // bottom up bitmap
+        for (y=0; y<200 && rc == G4ENC_SUCCESS; y++) {
+            rc = g4.addLine(s);
+            s -= iPitch;
+        }
+        iSize = g4.getOutSize();
+        y = (rc == G4ENC_IMAGE_COMPLETE && g4.getStripCount() == 4);
+        rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, ucTemp2, sizeof(ucTemp2));
+        if (rc == G4ENC_SUCCESS) rc = g4.setStrips(64, u32Threaded);
+        if (rc == G4ENC_SUCCESS) rc = g4.encodeStrips((uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch, -iPitch, 3);
+        iSize2 = g4.getOutSize();
+        if (y && rc == G4ENC_IMAGE_COMPLETE && iSize == iSize2 && memcmp(ucTemp, ucTemp2, iSize) == 0 && memcmp(u32Serial, u32Threaded, sizeof(u32Serial)) == 0) {
+            // the first strip must be identical to a standalone image of the same rows
+            rc = g4.init(73, 64, G4ENC_MSB_FIRST, NULL, ucTemp2, sizeof(ucTemp2));
+            s = (uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch;
+            for (y=0; y<64 && rc == G4ENC_SUCCESS; y++) {
+                rc = g4.addLine(s);
+                s -= iPitch;
+            }
+            y = (rc == G4ENC_IMAGE_COMPLETE && g4.getOutSize() == (int)u32Serial[0] && memcmp(ucTemp, ucTemp2, u32Serial[0]) == 0);
+        } else {
+            y = 0;
+        }
+        if (y) {
+            TIFFLOG(__LINE__, szTestName, " - PASSED");
+        } else {
+            TIFFLOG(__LINE__, szTestName, " - FAILED");
+            printf("Strip output doesn't match\n");
+        }
+    }
+
+    // Test 6 - images wider than G4ENC_MAX_WIDTH with a caller supplied workspace
+    szTestName = (char *)"G4 encode, wide image in workspace";
+    TIFFLOG(__LINE__, szTestName, szStart);
+    {
+        uint8_t *pWorkspace, *pLine;
+        int iWorkspaceSize = G4ENCODER::getWorkspaceSize(4960);
+        pWorkspace = (uint8_t *)malloc(iWorkspaceSize);
+        pLine = (uint8_t *)malloc(4960/8);
+        memset(pLine, 0xff, 4960/8);
+        for (y=0; y<4960/8; y+=8) { // black vertical stripes
+            pLine[y] = 0xf0;
+        }
+        pLine[4960/8 - 1] = 0x00; // black right edge
+        y = (g4.init(4960, 16, G4ENC_MSB_FIRST, NULL, ucTemp, sizeof(ucTemp)) == G4ENC_INVALID_PARAMETER);
+        rc = g4.init(4960, 16, G4ENC_MSB_FIRST, NULL, ucTemp, sizeof(ucTemp), pWorkspace, iWorkspaceSize);
+        for (iSize=0; iSize<16 && rc == G4ENC_SUCCESS; iSize++) {
+            rc = g4.addLine(pLine);
+        }
+        y = y && (rc == G4ENC_IMAGE_COMPLETE);
+        // a narrow image must encode the same way in either memory
+        iPitch = (73 + 7) >> 3;
+        iPitch = (iPitch + 3) & 0xfffc;
+        rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, ucTemp, sizeof(ucTemp));
+        s = (uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch;
+        for (iSize=0; iSize<200 && rc == G4ENC_SUCCESS; iSize++) {
+            rc = g4.addLine(s);
+            s -= iPitch;
+        }
+        iSize = g4.getOutSize();
+        rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, ucTemp2, sizeof(ucTemp2), pWorkspace, G4ENCODER::getWorkspaceSize(73));
+        s = (uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch;
+        while (rc == G4ENC_SUCCESS) {
+            rc = g4.addLine(s);
+            s -= iPitch;
+        }
+        y = y && (rc == G4ENC_IMAGE_COMPLETE && g4.getOutSize() == iSize && memcmp(ucTemp, ucTemp2, iSize) == 0);
+        // the widest image's workspace size must still fit in an int
+        y = y && (G4ENCODER::getWorkspaceSize(G4ENC_FLIP_MAX_WIDTH) > G4ENCODER::getWorkspaceSize(G4ENC_FLIP_MAX_WIDTH - 1) && G4ENCODER::getWorkspaceSize(G4ENC_FLIP_MAX_WIDTH + 1) == 0);
+        free(pLine);
+        free(pWorkspace);
+        if (y) {
+            TIFFLOG(__LINE__, szTestName, " - PASSED");
+        } else {
+            TIFFLOG(__LINE__, szTestName, " - FAILED");
+            printf("Workspace encoding failed or doesn't match\n");
+        }
+    }
+
+    // Test 7 - batch encoding with a (negative) pitch matches line by line encoding
+    szTestName = (char *)"G4 encode, addLines/encodeImage vs addLine";
+    TIFFLOG(__LINE__, szTestName, szStart);
+    iPitch = (73 + 7) >> 3;
+    iPitch = (iPitch + 3) & 0xfffc;
+    rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, ucTemp, sizeof(ucTemp));
+    s = (uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch;
+    for (y=0; y<200 && rc == G4ENC_SUCCESS; y++) {
+        rc = g4.addLine(s);
+        s -= iPitch;
+    }
+    iSize = g4.getOutSize();
+    rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, ucTemp2, sizeof(ucTemp2));
+    if (rc == G4ENC_SUCCESS)
+        rc = g4.encodeImage((uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch, -iPitch);
+    y = (rc == G4ENC_IMAGE_COMPLETE && g4.getOutSize() == iSize && memcmp(ucTemp, ucTemp2, iSize) == 0);
+    memset(ucTemp2, 0, sizeof(ucTemp2));
+    rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, ucTemp2, sizeof(ucTemp2));
+    s = (uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch;
+    while (rc == G4ENC_SUCCESS) { // odd sized groups of lines
+        rc = g4.addLines(s, -iPitch, 7);
+        s -= 7 * iPitch;
+    }
+    if (y && rc == G4ENC_IMAGE_COMPLETE && g4.getOutSize() == iSize && memcmp(ucTemp, ucTemp2, iSize) == 0) {
+        TIFFLOG(__LINE__, szTestName, " - PASSED");
+    } else {
+        TIFFLOG(__LINE__, szTestName, " - FAILED");
+        printf("Batch output doesn't match\n");
+    }
+
+    // Test 8 - encode with verification on, then decode and compare the pixels
+    szTestName = (char *)"G4 encode + verify, decode round trip";
+    TIFFLOG(__LINE__, szTestName, szStart);
+    {
+        G4DECODER g4dec;
+        int x, iBad = 0;
+        rc = g4dec.init(73, 200, G4ENC_MSB_FIRST, NULL, 0);
+        if (rc == G4ENC_SUCCESS) rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, ucTemp, sizeof(ucTemp));
+        if (rc == G4ENC_SUCCESS) rc = g4.setVerify(&g4dec, 1);
+        if (rc == G4ENC_SUCCESS)
+            rc = g4.encodeImage((uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch, -iPitch);
+        iSize = g4.getOutSize();
+        if (rc == G4ENC_IMAGE_COMPLETE && g4dec.getRunEnds() != NULL) {
+            rc = g4dec.init(73, 200, G4ENC_MSB_FIRST, ucTemp, iSize);
+            s = (uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch;
+            for (y=0; y<200 && rc == G4ENC_SUCCESS; y++) {
+                rc = g4dec.decodeLine(ucPixels);
+                for (x=0; x<73; x++) {
+                    if ((ucPixels[x>>3] ^ s[x>>3]) & (0x80 >> (x & 7)))
+                        iBad++;
+                }
+                s -= iPitch;
+            }
+        }
+        if (rc == G4ENC_IMAGE_COMPLETE && y == 200 && iBad == 0 && g4dec.decodeLine(ucPixels) == G4ENC_IMAGE_COMPLETE) {
+            TIFFLOG(__LINE__, szTestName, " - PASSED");
+        } else {
+            TIFFLOG(__LINE__, szTestName, " - FAILED");
+            printf("Decoded image doesn't match (rc=%d, %d bad pixels)\n", rc, iBad);
+        }
+    }
+
+    // Test 9 - blank and repeated lines (with garbage in the pad bits) take the fast path
+    // the line by line and whole image output must match and decode correctly
+    szTestName = (char *)"G4 encode blank + repeated lines";
+    TIFFLOG(__LINE__, szTestName, szStart);
+    {
+        static uint8_t ucImage[60 * 26];
+        G4DECODER g4dec;
+        int x, iSize2, iBad = 0;
+        for (y=0; y<60; y++) {
+            s = &ucImage[y * 26];
+            memset(s, 0xff, 26);
+            if ((y >= 10 && y < 30) || (y >= 40 && (y & 2)))
+                memset(&s[3], 0x0f, 12); // vertical bars
+            else if (y >= 40)
+                s[20] = 0x81;
+            s[25] = (uint8_t)(0xf8 | y); // 203 pixels wide, the last 5 bits are padding
+        }
+        rc = g4dec.init(203, 60, G4ENC_MSB_FIRST, NULL, 0);
+        if (rc == G4ENC_SUCCESS) rc = g4.init(203, 60, G4ENC_MSB_FIRST, NULL, ucTemp, sizeof(ucTemp));
+        if (rc == G4ENC_SUCCESS) rc = g4.setVerify(&g4dec, 1);
+        for (y=0; y<60 && rc == G4ENC_SUCCESS; y++)
+            rc = g4.addLine(&ucImage[y * 26]);
+        iSize = g4.getOutSize();
+        if (rc == G4ENC_IMAGE_COMPLETE) rc = g4.init(203, 60, G4ENC_MSB_FIRST, NULL, ucTemp2, sizeof(ucTemp2));
+        if (rc == G4ENC_SUCCESS) rc = g4.encodeImage(ucImage, 26);
+        iSize2 = g4.getOutSize();
+        if (rc == G4ENC_IMAGE_COMPLETE && iSize == iSize2 && memcmp(ucTemp, ucTemp2, iSize) == 0) {
+            rc = g4dec.init(203, 60, G4ENC_MSB_FIRST, ucTemp, iSize);
+            for (y=0; y<60 && rc == G4ENC_SUCCESS; y++) {
+                rc = g4dec.decodeLine(ucPixels);
+                s = &ucImage[y * 26];
+                for (x=0; x<203; x++) {
+                    if ((ucPixels[x>>3] ^ s[x>>3]) & (0x80 >> (x & 7)))
+                        iBad++;
+                }
+            }
+        }
+        if (rc == G4ENC_IMAGE_COMPLETE && y == 60 && iBad == 0) {
+            TIFFLOG(__LINE__, szTestName, " - PASSED");
+        } else {
+            TIFFLOG(__LINE__, szTestName, " - FAILED");
+            printf("Blank/repeated line output mismatch (rc=%d, sizes %d/%d, %d bad pixels)\n", rc, iSize, iSize2, iBad);
+        }
+    }
+
+    // Test 10 - encode directly into the output buffer; a buffer 1 byte bigger than the
+    // data must succeed and match, an exact size one must overflow without writing past its end
+    szTestName = (char *)"G4 encode direct output + overflow";
+    TIFFLOG(__LINE__, szTestName, szStart);
+    {
+        static uint8_t ucOut[3][16384];
+        int i, iSizes[3], iRCs[3], bOverrun = 0;
+        uint32_t u32;
+        for (i=0; i<3; i++) {
+            memset(ucOut[i], 0xcc, sizeof(ucOut[i]));
+            iSize = (i == 0) ? (int)sizeof(ucOut[0]) : iSizes[0] + 2 - i; // size+1, then exact size
+            rc = g4.init(WIDTH, 64, G4ENC_MSB_FIRST, NULL, ucOut[i], iSize);
+            u32 = 12345;
+            for (y=0; y<64 && rc == G4ENC_SUCCESS; y++) {
+                for (int x=0; x<WIDTH/8; x++) { // noise compresses poorly
+                    u32 = u32 * 1103515245 + 12345;
+                    ucPixels[x] = (uint8_t)(u32 >> 16);
+                }
+                rc = g4.addLine(ucPixels);
+            }
+            iRCs[i] = rc;
+            iSizes[i] = g4.getOutSize();
+            for (y=iSize; y<(int)sizeof(ucOut[i]); y++) {
+                if (ucOut[i][y] != 0xcc)
+                    bOverrun = 1;
+            }
+        }
+        if (iRCs[0] == G4ENC_IMAGE_COMPLETE && iSizes[0] > OUTPUT_BUF_SIZE * 2 && iRCs[1] == G4ENC_IMAGE_COMPLETE && iSizes[1] == iSizes[0] && memcmp(ucOut[0], ucOut[1], iSizes[0]) == 0 && iRCs[2] == G4ENC_DATA_OVERFLOW && !bOverrun) {
+            TIFFLOG(__LINE__, szTestName, " - PASSED");
+        } else {
+            TIFFLOG(__LINE__, szTestName, " - FAILED");
+            printf("rc=%d/%d/%d, size=%d/%d/%d, overrun=%d\n", iRCs[0], iRCs[1], iRCs[2], iSizes[0], iSizes[1], iSizes[2], bOverrun);
+        }
+    }
+
+    // Test 11 - LSB first output (with verify on) must be the MSB first output with the bits of each byte reversed
+    szTestName = (char *)"G4 encode LSB first";
+    TIFFLOG(__LINE__, szTestName, szStart);
+    {
+        G4DECODER g4dec;
+        int i, iSize2, iBad = 0;
+        rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, ucTemp, sizeof(ucTemp));
+        if (rc == G4ENC_SUCCESS)
+            rc = g4.encodeImage((uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch, -iPitch);
+        iSize = g4.getOutSize();
+        if (rc == G4ENC_IMAGE_COMPLETE) rc = g4dec.init(73, 200, G4ENC_LSB_FIRST, NULL, 0);
+        if (rc == G4ENC_SUCCESS) rc = g4.init(73, 200, G4ENC_LSB_FIRST, NULL, ucTemp2, sizeof(ucTemp2));
+        if (rc == G4ENC_SUCCESS) rc = g4.setVerify(&g4dec, 1);
+        if (rc == G4ENC_SUCCESS)
+            rc = g4.encodeImage((uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch, -iPitch);
+        iSize2 = g4.getOutSize();
+        for (i=0; i<iSize && i<iSize2; i++) {
+            uint8_t uc = ucTemp[i], ucRev = 0;
+            for (int j=0; j<8; j++) {
+                ucRev = (uint8_t)((ucRev << 1) | (uc & 1));
+                uc >>= 1;
+            }
+            if (ucRev != ucTemp2[i])
+                iBad++;
+        }
+        if (rc == G4ENC_IMAGE_COMPLETE && iSize == iSize2 && iBad == 0) {
+            TIFFLOG(__LINE__, szTestName, " - PASSED");
+        } else {
+            TIFFLOG(__LINE__, szTestName, " - FAILED");
+            printf("rc=%d, size=%d/%d, %d bytes differ\n", rc, iSize, iSize2, iBad);
+        }
+    }
+
+    // Test 12 - count only mode gives the exact output size, the estimate is within its error bound
+    // and G4ENC_maxOutSize() is big enough for a checkerboard (which expands)
+    szTestName = (char *)"G4 size count, estimate and worst case";
+    TIFFLOG(__LINE__, szTestName, szStart);
+    {
+        static uint8_t ucOut[4096];
+        int iCount, iEstimate, iError, iMax;
+        rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, ucTemp, sizeof(ucTemp));
+        if (rc == G4ENC_SUCCESS)
+            rc = g4.encodeImage((uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch, -iPitch);
+        iSize = g4.getOutSize();
+        if (rc == G4ENC_IMAGE_COMPLETE) rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, NULL, 0);
+        iEstimate = g4.estimateSize((uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch, -iPitch, 8, &iError);
+        if (rc == G4ENC_SUCCESS)
+            rc = g4.encodeImage((uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch, -iPitch);
+        iCount = g4.getOutSize();
+        if (rc == G4ENC_IMAGE_COMPLETE) { // checkerboard; every pixel is a color change
+            iMax = G4ENCODER::maxOutSize(WIDTH, 16);
+            rc = (iMax <= (int)sizeof(ucOut)) ? g4.init(WIDTH, 16, G4ENC_MSB_FIRST, NULL, ucOut, iMax) : G4ENC_DATA_OVERFLOW;
+            for (y=0; y<16 && rc == G4ENC_SUCCESS; y++) {
+                memset(ucPixels, (y & 1) ? 0x55 : 0xaa, WIDTH/8);
+                rc = g4.addLine(ucPixels);
+            }
+        }
+        if (rc == G4ENC_IMAGE_COMPLETE && iCount == iSize && iEstimate >= iSize - iError && iEstimate <= iSize + iError && g4.getOutSize() > WIDTH * 2) {
+            TIFFLOG(__LINE__, szTestName, " - PASSED");
+        } else {
+            TIFFLOG(__LINE__, szTestName, " - FAILED");
+            printf("rc=%d, size=%d, count=%d, estimate=%d +/- %d, checkerboard=%d\n", rc, iSize, iCount, iEstimate, iError, g4.getOutSize());
+        }
+    }
+
+    // Test 13 - a streamed TIFF file matches the header + data built in memory (1 strip)
+    // and the back-patched strip arrays describe the same strips as a buffered encode (4 strips)
+    szTestName = (char *)"G4 streamed TIFF file";
+    TIFFLOG(__LINE__, szTestName, szStart);
+    {
+        static uint8_t ucHeader[512];
+        uint32_t u32Sizes[4], u32Sizes2[4], u32Offsets, u32Counts, u32Off;
+        int i, iCount, iCount2, iHeader, iBad = 0;
+        rc = g4.init(73, 200, G4ENC_LSB_FIRST, NULL, ucTemp, sizeof(ucTemp));
+        if (rc == G4ENC_SUCCESS)
+            rc = g4.encodeImage((uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch, -iPitch);
+        iSize = g4.getOutSize();
+        iHeader = g4.getTIFFHeaderSize();
+        if (rc == G4ENC_IMAGE_COMPLETE) rc = g4.getTIFFHeader(ucHeader);
+        iFilePos = iFileLen = 0;
+        memset(ucFile, 0, sizeof(ucFile));
+        if (rc == G4ENC_SUCCESS) rc = g4.init(73, 200, G4ENC_LSB_FIRST, MemWrite, NULL, 0);
+        if (rc == G4ENC_SUCCESS) rc = g4.startTIFF(MemSeek);
+        for (y=0; y<200 && rc == G4ENC_SUCCESS; y++)
+            rc = g4.addLine((uint8_t *)&bart_73x200_bmp[0x92] + (199-y) * iPitch);
+        if (rc != G4ENC_IMAGE_COMPLETE || iFileLen != iHeader + iSize || iFilePos != iFileLen || memcmp(ucFile, ucHeader, iHeader) != 0 || memcmp(&ucFile[iHeader], ucTemp, iSize) != 0)
+            iBad++;
+        // multiple strips
+        if (rc == G4ENC_IMAGE_COMPLETE) rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, ucTemp, sizeof(ucTemp));
+        if (rc == G4ENC_SUCCESS) rc = g4.setStrips(50, u32Sizes);
+        if (rc == G4ENC_SUCCESS)
+            rc = g4.encodeImage((uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch, -iPitch);
+        iSize = g4.getOutSize();
+        iFilePos = iFileLen = 0;
+        memset(ucFile, 0, sizeof(ucFile));
+        if (rc == G4ENC_IMAGE_COMPLETE) rc = g4.init(73, 200, G4ENC_MSB_FIRST, MemWrite, NULL, 0);
+        if (rc == G4ENC_SUCCESS) rc = g4.setStrips(50, u32Sizes2);
+        if (rc == G4ENC_SUCCESS) rc = g4.startTIFF(MemSeek);
+        if (rc == G4ENC_SUCCESS)
+            rc = g4.encodeImage((uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch, -iPitch);
+        u32Offsets = GetTIFFTag(ucFile, 8, 273, &iCount);
+        u32Counts = GetTIFFTag(ucFile, 8, 279, &iCount2);
+        if (rc != G4ENC_IMAGE_COMPLETE || iCount != 4 || iCount2 != 4 || (u32Offsets & 1) || u32Counts != u32Offsets + 16 || iFileLen != (int)u32Counts + 16 || iFilePos != iFileLen) {
+            iBad++;
+        } else {
+            u32Off = 0;
+            for (i=0; i<4; i++) {
+                uint8_t *p = &ucFile[u32Offsets + i*4], *p2 = &ucFile[u32Counts + i*4];
+                uint32_t u32Strip = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+                uint32_t u32Len = p2[0] | (p2[1] << 8) | (p2[2] << 16) | ((uint32_t)p2[3] << 24);
+                if (u32Len != u32Sizes[i] || u32Sizes2[i] != u32Sizes[i] || memcmp(&ucFile[u32Strip], &ucTemp[u32Off], u32Len) != 0)
+                    iBad++;
+                u32Off += u32Len;
+            }
+        }
+        // a failed seek must not report a complete image
+        iFilePos = iFileLen = 0;
+        iSeeksLeft = 0;
+        i = g4.init(73, 200, G4ENC_MSB_FIRST, MemWrite, NULL, 0);
+        if (i == G4ENC_SUCCESS) i = g4.startTIFF(FailSeek);
+        if (i == G4ENC_SUCCESS) i = g4.encodeImage((uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch, -iPitch);
+        if (i != G4ENC_WRITE_ERROR)
+            iBad++;
+        if (iBad == 0) {
+            TIFFLOG(__LINE__, szTestName, " - PASSED");
+        } else {
+            TIFFLOG(__LINE__, szTestName, " - FAILED");
+            printf("rc=%d, size=%d, file length=%d, %d mismatches\n", rc, iSize, iFileLen, iBad);
+        }
+    }
+
+    // Test 14 - three pages of different sizes streamed into one TIFF file; walk the IFD chain
+    // and check each page's size and G4 data (page 2 uses 2 strips)
+    szTestName = (char *)"G4 multi-page TIFF file";
+    TIFFLOG(__LINE__, szTestName, szStart);
+    {
+        static uint8_t ucPage[3][2048];
+        const int iWidths[3] = {73, WIDTH, 73}, iHeights[3] = {200, 16, 200};
+        uint32_t u32Sizes[2], u32Value;
+        int i, iPageSize[3], iIFD, iPages = 0, iCount, iBad = 0;
+        uint8_t *p;
+        for (i=0; i<3; i++) { // reference data for each page
+            rc = g4.init(iWidths[i], iHeights[i], G4ENC_MSB_FIRST, NULL, ucPage[i], sizeof(ucPage[i]));
+            for (y=0; y<iHeights[i] && rc == G4ENC_SUCCESS; y++) {
+                if (i == 1) {
+                    memset(ucPixels, (y & 1) ? 0x55 : 0x0f, WIDTH/8);
+                    rc = g4.addLine(ucPixels);
+                } else {
+                    rc = g4.addLine((uint8_t *)&bart_73x200_bmp[0x92] + ((i) ? y : 199-y) * iPitch);
+                }
+            }
+            iPageSize[i] = g4.getOutSize();
+            if (rc != G4ENC_IMAGE_COMPLETE) iBad++;
+        }
+        iFilePos = iFileLen = 0;
+        memset(ucFile, 0, sizeof(ucFile));
+        rc = g4.init(iWidths[0], iHeights[0], G4ENC_MSB_FIRST, MemWrite, NULL, 0);
+        if (rc == G4ENC_SUCCESS && g4.addTIFFPage(73, 200) != G4ENC_NOT_INITIALIZED) iBad++; // not streaming yet
+        for (i=0; i<3 && rc == G4ENC_SUCCESS; i++) {
+            rc = (i == 0) ? g4.startTIFF(MemSeek) : g4.addTIFFPage(iWidths[i], iHeights[i]);
+            if (rc == G4ENC_SUCCESS && i == 0 && g4.addTIFFPage(73, 200) != G4ENC_INVALID_PARAMETER) iBad++; // page isn't finished
+            if (rc == G4ENC_SUCCESS && i == 1) rc = g4.setStrips(8, u32Sizes);
+            for (y=0; y<iHeights[i] && rc == G4ENC_SUCCESS; y++) {
+                if (i == 1) {
+                    memset(ucPixels, (y & 1) ? 0x55 : 0x0f, WIDTH/8);
+                    rc = g4.addLine(ucPixels);
+                } else {
+                    rc = g4.addLine((uint8_t *)&bart_73x200_bmp[0x92] + ((i) ? y : 199-y) * iPitch);
+                }
+            }
+            if (rc == G4ENC_IMAGE_COMPLETE) rc = G4ENC_SUCCESS;
+        }
+        iIFD = 8;
+        while (iIFD != 0 && iPages < 4 && iIFD < iFileLen && rc == G4ENC_SUCCESS) {
+            if ((iIFD & 1) || (int)GetTIFFTag(ucFile, iIFD, 256, &iCount) != iWidths[iPages] || (int)GetTIFFTag(ucFile, iIFD, 257, &iCount) != iHeights[iPages])
+                iBad++;
+            u32Value = GetTIFFTag(ucFile, iIFD, 273, &iCount);
+            if (iCount == 1) {
+                if ((int)GetTIFFTag(ucFile, iIFD, 279, &iCount) != iPageSize[iPages] || memcmp(&ucFile[u32Value], ucPage[iPages], iPageSize[iPages]) != 0)
+                    iBad++;
+            } else { // 2 strips, check they're stored back to back with the sizes the encoder reported
+                uint8_t *pOff = &ucFile[u32Value];
+                p = &ucFile[GetTIFFTag(ucFile, iIFD, 279, &iCount)];
+                if (iCount != 2 || (uint32_t)(p[0] | (p[1] << 8)) != u32Sizes[0] || (uint32_t)(p[4] | (p[5] << 8)) != u32Sizes[1] || (pOff[4] | (pOff[5] << 8)) != (pOff[0] | (pOff[1] << 8)) + (int)u32Sizes[0])
+                    iBad++;
+            }
+            p = &ucFile[iIFD + 2 + 12 * (ucFile[iIFD] | (ucFile[iIFD+1] << 8))];
+            iIFD = p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
+            iPages++;
+        }
+        // the link to the next page can't be written (the first page's header rewrite uses 2 seeks)
+        iFilePos = iFileLen = 0;
+        iSeeksLeft = 2;
+        i = g4.init(73, 200, G4ENC_MSB_FIRST, MemWrite, NULL, 0);
+        if (i == G4ENC_SUCCESS) i = g4.startTIFF(FailSeek);
+        if (i == G4ENC_SUCCESS) i = g4.encodeImage((uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch, -iPitch);
+        if (i != G4ENC_IMAGE_COMPLETE || g4.addTIFFPage(73, 200) != G4ENC_WRITE_ERROR)
+            iBad++;
+        if (rc == G4ENC_SUCCESS && iPages == 3 && iBad == 0 && iFilePos == iFileLen) {
+            TIFFLOG(__LINE__, szTestName, " - PASSED");
+        } else {
+            TIFFLOG(__LINE__, szTestName, " - FAILED");
+            printf("rc=%d, %d pages, file length=%d, %d mismatches\n", rc, iPages, iFileLen, iBad);
+        }
+    }
+
+    // Test 15 - gray and color lines thresholded straight to run-ends must match the
+    // same image given as 1-bpp pixels (with and without the per-line threshold)
+    szTestName = (char *)"G4 encode gray/RGB input";
+    TIFFLOG(__LINE__, szTestName, szStart);
+    {
+        static uint8_t ucGray[73], ucRGBA[73 * 4];
+        int i, x, iSize2, iSize3, iBad = 0;
+        rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, ucTemp, sizeof(ucTemp));
+        if (rc == G4ENC_SUCCESS)
+            rc = g4.encodeImage((uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch, -iPitch);
+        iSize = g4.getOutSize();
+        for (i=0; i<2 && rc == G4ENC_IMAGE_COMPLETE; i++) {
+            rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, ucTemp2, sizeof(ucTemp2));
+            for (y=0; y<200 && rc == G4ENC_SUCCESS; y++) {
+                s = (uint8_t *)&bart_73x200_bmp[0x92] + (199 - y) * iPitch;
+                for (x=0; x<73; x++) { // white = 200-255, black = 0-99 (a fixed 128 or the auto level split them)
+                    ucGray[x] = (s[x>>3] & (0x80 >> (x & 7))) ? (uint8_t)(200 + (x & 55)) : (uint8_t)(x + y) % 100;
+                    ucRGBA[x*4] = ucRGBA[x*4+1] = ucRGBA[x*4+2] = ucGray[x];
+                    ucRGBA[x*4+3] = (uint8_t)x; // alpha is ignored
+                }
+                rc = (i == 0) ? g4.addLineGray8(ucGray, 128) : g4.addLineRGB(ucRGBA, G4ENC_PIXEL_RGBA32, G4ENC_THRESHOLD_AUTO);
+            }
+            iSize2 = g4.getOutSize();
+            if (rc != G4ENC_IMAGE_COMPLETE || iSize2 != iSize || memcmp(ucTemp, ucTemp2, iSize) != 0)
+                iBad++;
+        }
+        iSize3 = 0;
+        if (rc == G4ENC_IMAGE_COMPLETE) { // invalid format and threshold
+            rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, ucTemp2, sizeof(ucTemp2));
+            if (g4.addLineRGB(ucRGBA, G4ENC_PIXEL_GRAY8, 128) != G4ENC_INVALID_PARAMETER || g4.addLineGray8(ucGray, 256) != G4ENC_INVALID_PARAMETER)
+                iBad++;
+            iSize3 = g4.getOutSize();
+        }
+        if (rc == G4ENC_SUCCESS && iBad == 0 && iSize3 == 0) {
+            TIFFLOG(__LINE__, szTestName, " - PASSED");
+        } else {
+            TIFFLOG(__LINE__, szTestName, " - FAILED");
+            printf("rc=%d, size=%d, %d mismatches\n", rc, iSize, iBad);
+        }
+    }
+
+    // Test 16 - OneBitDisplay pages: the page conversion must match the line conversion
+    // and encoding the pages directly must match encoding the converted lines (73 pixels wide)
+    szTestName = (char *)"G4 encode OneBitDisplay pages";
+    TIFFLOG(__LINE__, szTestName, szStart);
+    {
+        static uint8_t ucOBD[73 * 25], ucPage[10 * 8];
+        int i, x, iSize2, iBad = 0;
+        for (y=0; y<200; y++) { // bart in OneBitDisplay layout (set bits are black)
+            s = (uint8_t *)&bart_73x200_bmp[0x92] + (199 - y) * iPitch;
+            for (x=0; x<73; x++) {
+                if (!(s[x>>3] & (0x80 >> (x & 7))))
+                    ucOBD[(y >> 3) * 73 + x] |= (1 << (y & 7));
+            }
+        }
+        rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, ucTemp, sizeof(ucTemp));
+        for (y=0; y<200 && rc == G4ENC_SUCCESS; y++) {
+            g4.getOBDLine(73, ucOBD, y, ucPixels);
+            if ((y & 7) == 0)
+                g4.getOBDPage(73, ucOBD, y >> 3, ucPage, 0);
+            for (x=0; x<73; x++) {
+                if ((ucPixels[x>>3] ^ ucPage[(y & 7) * 10 + (x>>3)]) & (0x80 >> (x & 7)))
+                    iBad++;
+            }
+            rc = g4.addLine(ucPixels);
+        }
+        iSize = g4.getOutSize();
+        if (rc == G4ENC_IMAGE_COMPLETE) rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, ucTemp2, sizeof(ucTemp2));
+        if (rc == G4ENC_SUCCESS) { // a page can't start in the middle
+            g4.addLine(ucPixels);
+            if (g4.addOBDPage(ucOBD) != G4ENC_INVALID_PARAMETER)
+                iBad++;
+            rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, ucTemp2, sizeof(ucTemp2));
+        }
+        for (i=0; i<25 && rc == G4ENC_SUCCESS; i++)
+            rc = g4.addOBDPage(&ucOBD[i * 73]);
+        iSize2 = g4.getOutSize();
+        if (rc == G4ENC_IMAGE_COMPLETE && (iSize != iSize2 || memcmp(ucTemp, ucTemp2, iSize) != 0))
+            iBad++;
+        // the only color changes of each 32 pixel group are in its upper 16 pixels
+        // (16-bit int CPUs used to lose them); built as 1-bpp lines independently
+        if (rc == G4ENC_IMAGE_COMPLETE) rc = g4.init(64, 8, G4ENC_MSB_FIRST, NULL, ucTemp, sizeof(ucTemp));
+        for (y=0; y<8 && rc == G4ENC_SUCCESS; y++) {
+            memset(ucPixels, 0xff, 8);
+            for (x=0; x<64; x++) {
+                if ((x >= 20 + y && x < 28 + y) || x >= 48 + y) {
+                    ucPixels[x >> 3] &= ~(0x80 >> (x & 7));
+                    ucOBD[x] |= (1 << y);
+                } else {
+                    ucOBD[x] &= ~(1 << y);
+                }
+            }
+            rc = g4.addLine(ucPixels);
+        }
+        iSize = g4.getOutSize();
+        if (rc == G4ENC_IMAGE_COMPLETE) rc = g4.init(64, 8, G4ENC_MSB_FIRST, NULL, ucTemp2, sizeof(ucTemp2));
+        if (rc == G4ENC_SUCCESS) rc = g4.addOBDPage(ucOBD);
+        iSize2 = g4.getOutSize();
+        if (rc == G4ENC_IMAGE_COMPLETE && iBad == 0 && iSize == iSize2 && memcmp(ucTemp, ucTemp2, iSize) == 0) {
+            TIFFLOG(__LINE__, szTestName, " - PASSED");
+        } else {
+            TIFFLOG(__LINE__, szTestName, " - FAILED");
+            printf("rc=%d, size=%d/%d, %d pixels differ\n", rc, iSize, iSize2, iBad);
+        }
+    }
+
+    // Test 17 - Rotated and mirrored framebuffer: each of the 8 orientations must
+    // produce the same output as encoding a copy which was turned pixel by pixel
+    szTestName = (char *)"G4 encode rotated framebuffer";
+    TIFFLOG(__LINE__, szTestName, szStart);
+    {
+        static uint8_t ucRot[10 * 200];
+        int i, x, sx, sy, iW, iH, iRotPitch, iSize2, iBad = 0;
+        s = (uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch; // top line (bottom-up bitmap)
+        for (i=0; i<8 && iBad == 0; i++) {
+            iW = (i & 1) ? 200 : 73; // 90 and 270 turn it sideways
+            iH = (i & 1) ? 73 : 200;
+            iRotPitch = (iW + 7) >> 3;
+            memset(ucRot, 0, sizeof(ucRot));
+            for (y=0; y<iH; y++) {
+                for (x=0; x<iW; x++) {
+                    switch (i & 3) {
+                        case G4ENC_ROTATE_0:   sx = x; sy = y; break;
+                        case G4ENC_ROTATE_90:  sx = y; sy = iW - 1 - x; break;
+                        case G4ENC_ROTATE_180: sx = iW - 1 - x; sy = iH - 1 - y; break;
+                        default:               sx = iH - 1 - y; sy = x; break;
+                    }
+                    if (s[(sx >> 3) - sy * iPitch] & (0x80 >> (sx & 7))) {
+                        sx = (i & G4ENC_MIRROR) ? iW - 1 - x : x;
+                        ucRot[y * iRotPitch + (sx >> 3)] |= (0x80 >> (sx & 7));
+                    }
+                }
+            }
+            g4.init(iW, iH, G4ENC_MSB_FIRST, NULL, ucTemp, sizeof(ucTemp));
+            rc = g4.encodeImage(ucRot, iRotPitch);
+            iSize = g4.getOutSize();
+            g4.init(iW, iH, G4ENC_MSB_FIRST, NULL, ucTemp2, sizeof(ucTemp2));
+            if (rc != G4ENC_IMAGE_COMPLETE || g4.encodeRotated(s, -iPitch, i) != G4ENC_IMAGE_COMPLETE)
+                iBad++;
+            iSize2 = g4.getOutSize();
+            if (iSize != iSize2 || memcmp(ucTemp, ucTemp2, iSize) != 0)
+                iBad++;
+        }
+        if (iBad == 0) {
+            TIFFLOG(__LINE__, szTestName, " - PASSED");
+        } else {
+            TIFFLOG(__LINE__, szTestName, " - FAILED");
+            printf("orientation %d differs, size=%d/%d\n", i - 1, iSize, iSize2);
+        }
+    }
+
+    // Test 18 - T.4 1D and 2D (K=2) with byte aligned EOLs: each line must start
+    // with an EOL which ends on a byte boundary, 2D coding must tag every other line
+    // as 1D and the TIFF header must say Compression=3 with matching T4Options
+    szTestName = (char *)"G4 encode T.4 MH/MR";
+    TIFFLOG(__LINE__, szTestName, szStart);
+    {
+        static uint8_t ucHeader[256];
+        G4DECODER g4dec;
+        int i, iK, iCount, iEOLs, iBad = 0;
+        s = (uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch; // top line (bottom-up bitmap)
+        for (iK=1; iK<=2; iK++) {
+            rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, NULL, 0); // count only
+            if (rc == G4ENC_SUCCESS) rc = g4.setT4(iK, G4ENC_T4_EOL_ALIGN);
+            if (rc == G4ENC_SUCCESS) rc = g4.encodeImage(s, -iPitch);
+            iSize = g4.getOutSize();
+            rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, ucFile, sizeof(ucFile));
+            if (rc == G4ENC_SUCCESS) rc = g4.setT4(iK, G4ENC_T4_EOL_ALIGN);
+            g4dec.init(73, 200, G4ENC_MSB_FIRST, NULL, 0);
+            if (g4.setVerify(&g4dec, 1) != G4ENC_INVALID_PARAMETER) // only T.6 can be verified
+                iBad++;
+            if (rc == G4ENC_SUCCESS) rc = g4.encodeImage(s, -iPitch);
+            if (rc != G4ENC_IMAGE_COMPLETE || g4.getOutSize() != iSize || g4.setT4(0, 0) != G4ENC_INVALID_PARAMETER)
+                iBad++;
+            iEOLs = 0;
+            for (i=1; i<iSize-1; i++) { // count the EOLs which end on a byte boundary
+                if ((((ucFile[i-1] << 8) | ucFile[i]) & 0xfff) == 1) {
+                    if (iK == 2 && iEOLs < 200 && ((ucFile[i+1] >> 7) != ((iEOLs & 1) == 0))) // tag bit: 1D every other line
+                        iBad++;
+                    iEOLs++;
+                }
+            }
+            if (ucFile[0] != 0 || ucFile[1] != 1 || iEOLs < 200 || iEOLs > 206) // + up to 6 for the RTC
+                iBad++;
+            g4.getTIFFHeader(ucHeader);
+            if (GetTIFFTag(ucHeader, 8, 259, &iCount) != 3 || GetTIFFTag(ucHeader, 8, 292, &iCount) != (uint32_t)(G4ENC_T4_EOL_ALIGN | (iK - 1)) || g4.getTIFFHeaderSize() != 183 + 12) // + T4Options
+                iBad++;
+        }
+        if (iBad == 0) {
+            TIFFLOG(__LINE__, szTestName, " - PASSED");
+        } else {
+            TIFFLOG(__LINE__, szTestName, " - FAILED");
+            printf("%d checks failed\n", iBad);
+        }
+    }
+
+    // Test 19 - Run-end input: feeding the run-ends of each decoded line of the
+    // known image back in must reproduce the known output exactly, and lists
+    // which go backwards or past the width must be rejected
+    szTestName = (char *)"G4 encode run-end lines";
+    TIFFLOG(__LINE__, szTestName, szStart);
+    {
+        G4DECODER g4dec;
+        G4ENC_FLIP *pFlips;
+        const G4ENC_FLIP sBackwards[3] = {10, 30, 20}, sTooWide[2] = {10, 74};
+        int i, iBad = 0;
+        rc = g4dec.init(73, 200, G4ENC_MSB_FIRST, (uint8_t *)bart_tif, sizeof(bart_tif));
+        if (rc == G4ENC_SUCCESS) rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, ucTemp, sizeof(ucTemp));
+        if (g4.addRunLine(sBackwards, 3) != G4ENC_INVALID_PARAMETER || g4.addRunLine(sTooWide, 2) != G4ENC_INVALID_PARAMETER)
+            iBad++;
+        for (y=0; y<200 && rc == G4ENC_SUCCESS; y++) {
+            if (g4dec.decodeLine(ucPixels) > G4ENC_SUCCESS && y < 199)
+                iBad++;
+            pFlips = g4dec.getRunEnds(); // passed back unchanged
+            for (i=0; pFlips[i] < 73; i++) {}
+            rc = g4.addRunLine(pFlips, i + 1); // including the width which ends the list
+        }
+        iSize = g4.getOutSize();
+        if (rc == G4ENC_IMAGE_COMPLETE && iBad == 0 && iSize == sizeof(bart_tif) && memcmp(ucTemp, bart_tif, iSize) == 0) {
+            TIFFLOG(__LINE__, szTestName, " - PASSED");
+        } else {
+            TIFFLOG(__LINE__, szTestName, " - FAILED");
+            printf("rc=%d, size=%d, %d checks failed\n", rc, iSize, iBad);
+        }
+    }
+
+    // Test 20 - Frame sequence: a delta frame of a small change must be much
+    // smaller than the key frame and decode to the pixels which changed
+    szTestName = (char *)"G4 encode delta frames";
+    TIFFLOG(__LINE__, szTestName, szStart);
+    {
+        G4DECODER g4dec;
+        static uint8_t ucFrame[2][10 * 200], ucPrev[10 * 200];
+        int x, iSize2, iSize3 = 0, iBad = 0;
+        s = (uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch;
+        for (y=0; y<200; y++) { // frame 2 = frame 1 with a rectangle inverted
+            memcpy(&ucFrame[0][y * 10], s, 10);
+            memcpy(&ucFrame[1][y * 10], s, 10);
+            if (y >= 50 && y < 70) {
+                for (x=2; x<5; x++)
+                    ucFrame[1][y * 10 + x] ^= 0xff;
+            }
+            s -= iPitch;
+        }
+        rc = g4.init(73, 70000, G4ENC_MSB_FIRST, NULL, ucTemp, sizeof(ucTemp)); // too tall for the frame header
+        if (rc == G4ENC_SUCCESS && g4.startFrames(ucPrev) != G4ENC_INVALID_PARAMETER)
+            rc = G4ENC_DECODE_ERROR;
+        if (rc == G4ENC_SUCCESS) rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, ucTemp, sizeof(ucTemp));
+        if (rc == G4ENC_SUCCESS) rc = g4.startFrames(ucPrev);
+        if (rc == G4ENC_SUCCESS) rc = g4.encodeFrame(ucFrame[0], 10, G4ENC_FRAME_DELTA); // the first frame is a key frame
+        iSize = g4.getOutSize();
+        memcpy(ucTemp2, ucTemp, sizeof(ucTemp)); // each frame starts at the beginning of the output
+        if (rc == G4ENC_IMAGE_COMPLETE) rc = g4.encodeFrame(ucFrame[1], 10, G4ENC_FRAME_DELTA);
+        iSize2 = g4.getOutSize();
+        if (rc == G4ENC_IMAGE_COMPLETE) { // the difference is black where the pixels changed
+            if (ucTemp2[0] != G4ENC_FRAME_KEY || ucTemp[0] != G4ENC_FRAME_DELTA || ucTemp[1] != 1 || ucTemp[2] != 73 || ucTemp[3] != 0 || ucTemp[4] != 200 || ucTemp[5] != 0)
+                iBad++;
+            rc = g4dec.init(73, 200, G4ENC_MSB_FIRST, &ucTemp[G4ENC_FRAME_HEADER_SIZE], iSize2 - G4ENC_FRAME_HEADER_SIZE);
+            for (y=0; y<200 && rc == G4ENC_SUCCESS; y++) {
+                rc = g4dec.decodeLine(ucPixels);
+                for (x=0; x<73; x++) {
+                    if ((~ucPixels[x>>3] ^ ucFrame[0][y * 10 + (x>>3)] ^ ucFrame[1][y * 10 + (x>>3)]) & (0x80 >> (x & 7)))
+                        iBad++;
+                }
+            }
+            if (memcmp(ucPrev, ucFrame[1], sizeof(ucPrev)) != 0)
+                iBad++;
+            rc = g4.encodeFrame(ucFrame[1], 10, G4ENC_FRAME_DELTA); // no change
+            iSize3 = g4.getOutSize();
+        }
+        if (rc == G4ENC_IMAGE_COMPLETE && iBad == 0 && iSize2 * 4 < iSize && iSize3 < G4ENC_FRAME_HEADER_SIZE + 200/8 + 8) {
+            TIFFLOG(__LINE__, szTestName, " - PASSED");
+        } else {
+            TIFFLOG(__LINE__, szTestName, " - FAILED");
+            printf("rc=%d, key=%d, delta=%d, no change=%d, %d checks failed\n", rc, iSize, iSize2, iSize3, iBad);
+        }
+    }
+
+    // Test 21 - Snapshot and resume: stopping after each group of lines, saving
+    // the state and continuing in a new encoder must give the same output as
+    // encoding the image in one go; the snapshots must stay small
+    szTestName = (char *)"G4 encode snapshot and resume";
+    TIFFLOG(__LINE__, szTestName, szStart);
+    {
+        static uint8_t ucState[G4ENC_MAX_STATE_SIZE(73)];
+        int iState = 0, iMaxState = 0;
+        s = (uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch;
+        rc = G4ENC_SUCCESS;
+        for (y=0; y<200 && rc == G4ENC_SUCCESS; y+=25) {
+            G4ENCODER g4resume; // a new encoder for each group, like after a power loss
+            rc = g4resume.init(73, 200, G4ENC_MSB_FIRST, NULL, ucTemp, sizeof(ucTemp));
+            if (rc == G4ENC_SUCCESS && y != 0) rc = g4resume.restoreState(ucState, iState);
+            if (rc == G4ENC_SUCCESS) rc = g4resume.addLines(s - y * iPitch, -iPitch, 25);
+            iSize = g4resume.getOutSize();
+            iState = g4resume.saveState(ucState, sizeof(ucState));
+            if (iState == 0)
+                rc = G4ENC_INVALID_PARAMETER;
+            if (iState > iMaxState)
+                iMaxState = iState;
+        }
+        if (rc == G4ENC_IMAGE_COMPLETE && y == 200 && iMaxState < 64 && iSize == sizeof(bart_tif) && memcmp(ucTemp, bart_tif, iSize) == 0) {
+            TIFFLOG(__LINE__, szTestName, " - PASSED");
+        } else {
+            TIFFLOG(__LINE__, szTestName, " - FAILED");
+            printf("rc=%d, y=%d, size=%d, largest snapshot=%d\n", rc, y, iSize, iMaxState);
+        }
+    }
+
+    // Test 22 - Encoder pool: encoders taken from the pool write through their
+    // own context callback and are reset (not re-initialized) between images;
+    // every image must match the known output
+    szTestName = (char *)"G4 encode with an encoder pool";
+    TIFFLOG(__LINE__, szTestName, szStart);
+    {
+        static G4ENCODER g4pool[2];
+        G4ENCODERPOOL pool;
+        SINK sink[2];
+        int i, iEnc[2], iBad = 0;
+        rc = pool.init(2);
+        for (i=0; i<2 && rc == G4ENC_SUCCESS; i++) {
+            iEnc[i] = pool.acquire(1);
+            if (iEnc[i] < 0)
+                iBad++;
+            else
+                rc = g4pool[iEnc[i]].init(73, 200, G4ENC_MSB_FIRST, NULL, NULL, 0);
+        }
+        if (pool.acquire(0) != -1) // all in use
+            iBad++;
+        for (y=0; y<4 && rc == G4ENC_SUCCESS && iBad == 0; y++) { // 2 images per encoder
+            i = y & 1;
+            sink[i].pBuf = (i) ? ucTemp2 : ucTemp;
+            sink[i].iLen = 0;
+            sink[i].iSize = sizeof(ucTemp);
+            rc = g4pool[iEnc[i]].reset(73, 200, NULL, 0);
+            if (rc == G4ENC_SUCCESS) rc = g4pool[iEnc[i]].setWriteCallback(SinkWrite, &sink[i]);
+            if (rc == G4ENC_SUCCESS) rc = g4pool[iEnc[i]].encodeImage((uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch, -iPitch);
+            if (rc == G4ENC_IMAGE_COMPLETE && sink[i].iLen == (int)sizeof(bart_tif) && memcmp(sink[i].pBuf, bart_tif, sink[i].iLen) == 0)
+                rc = G4ENC_SUCCESS;
+            else
+                iBad++;
+        }
+        if (rc == G4ENC_SUCCESS && (pool.release(iEnc[0]) != G4ENC_SUCCESS || pool.release(iEnc[0]) == G4ENC_SUCCESS))
+            iBad++; // a double release must be caught
+        if (rc == G4ENC_SUCCESS && pool.acquire(0) != iEnc[0])
+            iBad++;
+        // a sink which runs out of room must stop the encoder
+        sink[0].iLen = 0;
+        sink[0].iSize = 16;
+        if (rc == G4ENC_SUCCESS) rc = g4pool[iEnc[0]].reset(73, 200, NULL, 0);
+        if (rc == G4ENC_SUCCESS && g4pool[iEnc[0]].encodeImage((uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch, -iPitch) != G4ENC_WRITE_ERROR)
+            iBad++;
+        pool.close();
+        if (rc == G4ENC_SUCCESS && iBad == 0) {
+            TIFFLOG(__LINE__, szTestName, " - PASSED");
+        } else {
+            TIFFLOG(__LINE__, szTestName, " - FAILED");
+            printf("rc=%d, %d checks failed\n", rc, iBad);
+        }
+    }
+
+    // Test 23 - Double buffered output: the sink holds on to each buffer until
+    // it's released, so the encoder must stop with G4ENC_BUSY when both are in
+    // use and continue from the same line afterwards; a callback which doesn't
+    // take the data must stop it with G4ENC_WRITE_ERROR; with strips, the end
+    // of a strip must not be written to a buffer the sink still has and a reset
+    // to a width which doesn't fit the buffers must fail
+    szTestName = (char *)"G4 encode with ping-pong buffers";
+    TIFFLOG(__LINE__, szTestName, szStart);
+    {
+        static uint8_t ucPing[2][G4ENC_MAX_LINE_SIZE(73) + 16];
+        SINK sink = {ucTemp2, 0, (int)sizeof(ucTemp2)};
+        static uint8_t ucStrips[2][8192];
+        int i, iBusy = 0, iTouched = 0, iStripSize = 0;
+        iPending = 0;
+        s = (uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch;
+        rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, NULL, 0);
+        if (rc == G4ENC_SUCCESS) rc = g4.setWriteCallback(PendingWrite, &sink);
+        if (rc == G4ENC_SUCCESS) rc = g4.setPingPong(ucPing[0], ucPing[1], sizeof(ucPing[0]));
+        while (rc == G4ENC_SUCCESS || rc == G4ENC_BUSY) {
+            if (rc == G4ENC_BUSY) { // the "transfers" finish
+                iBusy++;
+                for (i=0; i<iPending; i++)
+                    g4.releaseBuffer(pPending[i]);
+                iPending = 0;
+            }
+            y = g4.getLine();
+            rc = g4.addLines(s - y * iPitch, -iPitch, 200 - y);
+        }
+        if (rc == G4ENC_IMAGE_COMPLETE && (iBusy == 0 || sink.iLen != (int)sizeof(bart_tif) || memcmp(ucTemp2, bart_tif, sink.iLen) != 0))
+            rc = G4ENC_DECODE_ERROR;
+        if (rc == G4ENC_IMAGE_COMPLETE) { // 4 line strips, each flushed on its last line
+            rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, ucStrips[0], sizeof(ucStrips[0]));
+            if (rc == G4ENC_SUCCESS) rc = g4.setStrips(4, NULL);
+            if (rc == G4ENC_SUCCESS) rc = g4.encodeImage(s, -iPitch);
+            iStripSize = g4.getOutSize();
+            SINK sink2 = {ucStrips[1], 0, (int)sizeof(ucStrips[1])};
+            iPending = iBusy = 0;
+            if (rc == G4ENC_IMAGE_COMPLETE) rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, NULL, 0);
+            if (rc == G4ENC_SUCCESS) rc = g4.setWriteCallback(PendingWrite, &sink2);
+            if (rc == G4ENC_SUCCESS) rc = g4.setPingPong(ucPing[0], ucPing[1], sizeof(ucPing[0]));
+            if (rc == G4ENC_SUCCESS) rc = g4.setStrips(4, NULL);
+            if (rc == G4ENC_SUCCESS) rc = g4.setFlush(G4ENC_FLUSH_LINES, 4, NULL);
+            while (rc == G4ENC_SUCCESS || rc == G4ENC_BUSY) {
+                if (rc == G4ENC_BUSY) { // the buffers must be as they were handed over
+                    iBusy++;
+                    for (i=0; i<iPending; i++) {
+                        if (memcmp(pPending[i], &sink2.pBuf[iPendingOff[i]], iPendingLen[i]) != 0)
+                            iTouched++;
+                        g4.releaseBuffer(pPending[i]);
+                    }
+                    iPending = 0;
+                }
+                y = g4.getLine();
+                rc = g4.addLines(s - y * iPitch, -iPitch, 200 - y);
+            }
+            if (rc == G4ENC_IMAGE_COMPLETE && (iBusy == 0 || iTouched != 0 || sink2.iLen != iStripSize || memcmp(ucStrips[0], ucStrips[1], iStripSize) != 0))
+                rc = G4ENC_DECODE_ERROR;
+        }
+        if (rc == G4ENC_IMAGE_COMPLETE) { // a reset keeps the buffers (and frees them) as long as a line fits
+            if (g4.reset(256, 200, NULL, 0) != G4ENC_INVALID_PARAMETER)
+                rc = G4ENC_DECODE_ERROR;
+            else
+                rc = g4.reset(73, 200, NULL, 0);
+            sink.iLen = 0;
+            if (rc == G4ENC_SUCCESS) rc = g4.setWriteCallback(SinkWrite, &sink);
+            if (rc == G4ENC_SUCCESS) rc = g4.encodeImage(s, -iPitch);
+            if (rc == G4ENC_IMAGE_COMPLETE && (sink.iLen != (int)sizeof(bart_tif) || memcmp(ucTemp2, bart_tif, sink.iLen) != 0))
+                rc = G4ENC_DECODE_ERROR;
+        }
+        if (rc == G4ENC_IMAGE_COMPLETE) { // now a sink which fails
+            iPending = 2;
+            rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, NULL, 0);
+            if (rc == G4ENC_SUCCESS) rc = g4.setWriteCallback(PendingWrite, &sink);
+            if (rc == G4ENC_SUCCESS) rc = g4.setPingPong(ucPing[0], ucPing[1], sizeof(ucPing[0]));
+            if (rc == G4ENC_SUCCESS && g4.encodeImage(s, -iPitch) == G4ENC_WRITE_ERROR)
+                rc = G4ENC_IMAGE_COMPLETE;
+        }
+        if (rc == G4ENC_IMAGE_COMPLETE) {
+            TIFFLOG(__LINE__, szTestName, " - PASSED");
+        } else {
+            TIFFLOG(__LINE__, szTestName, " - FAILED");
+            printf("rc=%d, size=%d, %d times busy, %d buffers changed while busy\n", rc, sink.iLen, iBusy, iTouched);
+        }
+    }
+
+    // Test 24 - Flush policies: with a flush after every line the first bytes
+    // must leave within the first few lines, with blocks every write must be exactly
+    // one block (the last one padded) and the output must not change
+    szTestName = (char *)"G4 encode flush policies";
+    TIFFLOG(__LINE__, szTestName, szStart);
+    {
+        static uint8_t ucBlock[64];
+        SINK sink = {ucTemp2, 0, (int)sizeof(ucTemp2)};
+        int iFirst = -1; // first line after which data was written
+        s = (uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch;
+        rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, NULL, 0);
+        if (rc == G4ENC_SUCCESS) rc = g4.setWriteCallback(SinkWrite, &sink);
+        if (rc == G4ENC_SUCCESS) rc = g4.setFlush(G4ENC_FLUSH_LINES, 1, NULL);
+        for (y=0; y<200 && rc == G4ENC_SUCCESS; y++) {
+            rc = g4.addLine(s - y * iPitch);
+            if (iFirst < 0 && sink.iLen != 0)
+                iFirst = y;
+        }
+        if (rc == G4ENC_IMAGE_COMPLETE && (iFirst < 0 || iFirst > 8 || sink.iLen != (int)sizeof(bart_tif) || memcmp(ucTemp2, bart_tif, sink.iLen) != 0))
+            rc = G4ENC_DECODE_ERROR;
+        if (rc == G4ENC_IMAGE_COMPLETE) {
+            sink.iLen = 0;
+            iChunkSize = sizeof(ucBlock);
+            iChunks = iBadChunks = 0;
+            rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, NULL, 0);
+            if (rc == G4ENC_SUCCESS) rc = g4.setWriteCallback(ChunkWrite, &sink);
+            if (rc == G4ENC_SUCCESS) rc = g4.setFlush(G4ENC_FLUSH_BLOCKS | G4ENC_FLUSH_PAD, sizeof(ucBlock), ucBlock);
+            if (rc == G4ENC_SUCCESS) rc = g4.encodeImage(s, -iPitch);
+            if (rc == G4ENC_IMAGE_COMPLETE && (iBadChunks != 0 || iChunks != ((int)sizeof(bart_tif) + 63) / 64 || g4.getOutSize() != (int)sizeof(bart_tif) || memcmp(ucTemp2, bart_tif, sizeof(bart_tif)) != 0))
+                rc = G4ENC_DECODE_ERROR;
+        }
+        if (rc == G4ENC_IMAGE_COMPLETE) {
+            TIFFLOG(__LINE__, szTestName, " - PASSED");
+        } else {
+            TIFFLOG(__LINE__, szTestName, " - FAILED");
+            printf("rc=%d, first write after line %d, %d chunks (%d bad)\n", rc, iFirst, iChunks, iBadChunks);
+        }
+    }
+
+#ifdef G4ENC_STATS // only in the stats build (g4enctest_stats)
+    // Test 25
+    // Bitstream statistics: the output must not change, the bits counted for
+    // each mode plus the EOFB and pad bits must add up to the output size and
+    // the bits of the lines must add up to the bits of the modes
+    szTestName = (char *)"G4 encode bitstream statistics";
+    TIFFLOG(__LINE__, szTestName, szStart);
+    {
+        static uint32_t ulLineBits[200];
+        G4ENCSTATS stats;
+        uint32_t ulModeBits = 0, ulLineSum = 0, ulRuns = 0;
+        stats.pLineBits = ulLineBits;
+        s = (uint8_t *)&bart_73x200_bmp[0x92] + 199 * iPitch;
+        rc = g4.init(73, 200, G4ENC_MSB_FIRST, NULL, ucTemp2, sizeof(ucTemp2));
+        if (rc == G4ENC_SUCCESS) rc = g4.setStats(&stats);
+        if (rc == G4ENC_SUCCESS) rc = g4.encodeImage(s, -iPitch);
+        if (rc == G4ENC_IMAGE_COMPLETE) {
+            ulModeBits = stats.ulPassBits + stats.ulVertBits + stats.ulHorizBits;
+            for (y=0; y<200; y++)
+                ulLineSum += ulLineBits[y];
+            for (y=0; y<G4ENC_RUN_BUCKETS; y++)
+                ulRuns += stats.ulRuns[0][y] + stats.ulRuns[1][y];
+            if (g4.getOutSize() != (int)sizeof(bart_tif) || memcmp(ucTemp2, bart_tif, sizeof(bart_tif)) != 0 ||
+                stats.ulLines != 200 || ulLineSum != ulModeBits || ulRuns != stats.ulHoriz * 2 ||
+                ulModeBits + stats.ulEOLBits + stats.ulFillBits != sizeof(bart_tif) * 8 || stats.ulMaxLineBits != ulLineBits[stats.iMaxLine])
+                rc = G4ENC_DECODE_ERROR;
+        }
+        if (rc == G4ENC_IMAGE_COMPLETE) {
+            TIFFLOG(__LINE__, szTestName, " - PASSED");
+        } else {
+            TIFFLOG(__LINE__, szTestName, " - FAILED");
+            printf("rc=%d, %d lines, %d line bits, %d mode bits\n", rc, (int)stats.ulLines, (int)ulLineSum, (int)ulModeBits);
+        }
+    }
+#endif // G4ENC_STATS
+
     return 0;
 } /* main() */
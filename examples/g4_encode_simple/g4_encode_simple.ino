@@ -20,14 +20,12 @@ int CompressAsG4(void)
 {
   int rc, y;
   int iSize = 0;
-  uint8_t ucPixels[(WIDTH+7)>>3];
   
   rc = g4.init(WIDTH, HEIGHT, G4ENC_MSB_FIRST, NULL, ucTemp, sizeof(ucTemp)); // write to existing buffer
   if (rc == G4ENC_SUCCESS) {
-    for (y=0; y<HEIGHT && rc == G4ENC_SUCCESS; y++) {
-      // convert the memory format of OneBitDisplay into MSB-first horizontal bytes
-      g4.getOBDLine(WIDTH, ucBuffer, y, ucPixels);
-      rc = g4.addLine(ucPixels);
+    for (y=0; y<HEIGHT && rc == G4ENC_SUCCESS; y+=8) {
+      // encode 8 lines at a time straight from the vertical bytes of OneBitDisplay
+      rc = g4.addOBDPage(&ucBuffer[(y >> 3) * WIDTH]);
     } // for y
     if (rc == G4ENC_IMAGE_COMPLETE)
       iSize = g4.getOutSize();
@@ -16,32 +16,45 @@
 #define SD_SCK 39
 #define SD_MOSI 38
 #define SD_MISO 40
+// Turn the saved image to match the way the device is held
+// (e.g. G4ENC_ROTATE_90 for portrait); the framebuffer isn't copied to do it
+#define SCREENSHOT_ORIENTATION G4ENC_ROTATE_0
 
 FASTEPD epd;
 G4ENCODER g4;
 
 void SaveScreenshot()
 {
-  int y, rc, iSize, iOutSize, iBufferSize, iPitch;
+  int rc, iSize, iOutSize, iBufferSize, iPitch, iWidth, iHeight;
   uint8_t *pOut, *pImage, *pHeader;
   File myfile;
 
   pImage = epd.currentBuffer();
   iPitch = epd.width()/8; // source pitch
-  iBufferSize = iPitch * (epd.height()/3); // assumes we'll compress at least 3:1
-  pOut = (uint8_t *)malloc(iBufferSize); // big enough
+  iWidth = (SCREENSHOT_ORIENTATION & 1) ? epd.height() : epd.width(); // size of the turned image
+  iHeight = (SCREENSHOT_ORIENTATION & 1) ? epd.width() : epd.height();
+  // With no output buffer, the encoder only counts the compressed size.
+  // It takes as long as the real encode, but the buffer can then be
+  // allocated exactly (+1 byte for the overflow check + room for the TIFF header)
+  rc = g4.init(iWidth, iHeight, G4ENC_MSB_FIRST, NULL, NULL, 0);
+  if (rc == G4ENC_SUCCESS)
+    rc = g4.encodeRotated(pImage, iPitch, SCREENSHOT_ORIENTATION);
+  if (rc != G4ENC_IMAGE_COMPLETE) {
+    Serial.printf("G4 size count failed with error %d\n", rc);
+    return;
+  }
+  iBufferSize = g4.getOutSize() + 1 + g4.getTIFFHeaderSize();
+  pOut = (uint8_t *)malloc(iBufferSize); // exactly big enough
   if (!pOut) {
     Serial.printf("Error allocating %d bytes, aborting...\n", iBufferSize);
     return;
   }
-  rc = g4.init(epd.width(), epd.height(), G4ENC_MSB_FIRST, NULL, pOut, iBufferSize);
+  rc = g4.init(iWidth, iHeight, G4ENC_MSB_FIRST, NULL, pOut, iBufferSize);
   if (rc == G4ENC_SUCCESS) {
-    for (y=0; y<epd.height() && rc == G4ENC_SUCCESS; y++) {
-      rc = g4.addLine(&pImage[iPitch*y]);
-    } // for y
+    rc = g4.encodeRotated(pImage, iPitch, SCREENSHOT_ORIENTATION); // compress all of the lines in one call
     if (rc == G4ENC_IMAGE_COMPLETE) {
       iSize = g4.getOutSize();
-      Serial.printf("%dx%d compressed to %d bytes of G4 data\n", epd.width(), epd.height(), iSize);
+      Serial.printf("%dx%d compressed to %d bytes of G4 data\n", iWidth, iHeight, iSize);
       // Create a file and store the data as a TIFF
       myfile = SD.open("/screenshot.tif", FILE_WRITE);
       if (!myfile) {
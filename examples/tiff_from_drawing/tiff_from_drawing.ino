@@ -27,15 +27,12 @@ uint8_t *pBuffer, *pOut;
 //
 int CompressAsG4(void)
 {
-  int rc, y, iPitch, iSize = 0;
+  int rc, iPitch, iSize = 0;
 
   iPitch = (WIDTH+7)/8; // bytes per line
   rc = g4.init(WIDTH, HEIGHT, G4ENC_MSB_FIRST, NULL, pOut, MAX_OUTPUT_SIZE); // write to existing buffer
   if (rc == G4ENC_SUCCESS) {
-    for (y=0; y<HEIGHT && rc == G4ENC_SUCCESS; y++) {
-      // The pixel for
-      rc = g4.addLine(&pBuffer[y * iPitch]);
-    } // for y
+    rc = g4.encodeImage(pBuffer, iPitch); // compress all of the lines in one call
     if (rc == G4ENC_IMAGE_COMPLETE)
       iSize = g4.getOutSize();
     else
@@ -0,0 +1,398 @@
+// G4 Encoder benchmark
+// Written by Larry Bank
+//
+// Generates a fixed corpus of synthetic 1-bpp images in memory and measures
+// the encoder speed and compression ratio for each class of image.
+// The same seed is used every run, so the results can be compared
+// between releases. Output is a readable table or CSV/JSON.
+//
+// Copyright 2022 BitBank Software, Inc. All Rights Reserved.
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===========================================================================
+//
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "../src/G4ENCODER.h"
+#include "../src/g4enc.inl"
+
+enum {
+    CLASS_TEXT = 0,
+    CLASS_CAD,
+    CLASS_SOLID,
+    CLASS_CHECKER,
+    CLASS_BARCODE,
+    CLASS_LABEL,
+    CLASS_COUNT
+};
+static const char *szClassNames[CLASS_COUNT] = {"text", "cad", "solid", "checker", "barcode", "label"};
+static const int iWidths[] = {296, 1728, 4960, 10200};
+#define WIDTH_COUNT (int)(sizeof(iWidths) / sizeof(int))
+#define BENCH_HEIGHT 512
+#define MIN_TIME_NS 20000000LL // repeat each measurement for at least 20ms
+#define BEST_OF 3
+
+enum {
+    OUTPUT_TEXT = 0,
+    OUTPUT_CSV,
+    OUTPUT_JSON
+};
+
+typedef struct bench_result_tag
+{
+    int iClass, iWidth, iHeight; // iWidth is 0 for the total of a class
+    int iRaw; // bytes of uncompressed input
+    int iCompressed; // bytes of G4 data
+    double dInit, dExtract, dCode, dFlush, dTotal; // ns per image
+} BENCH_RESULT;
+
+static uint32_t u32Seed;
+static int iFillOrder = G4ENC_MSB_FIRST;
+
+static uint32_t Random(void)
+{
+    u32Seed = u32Seed * 1103515245 + 12345;
+    return u32Seed >> 8;
+} /* Random() */
+
+static long long nanos(void)
+{
+struct timespec res;
+
+    clock_gettime(CLOCK_MONOTONIC, &res);
+    return (1000000000LL * res.tv_sec) + res.tv_nsec;
+} /* nanos() */
+//
+// Drawing helpers; 1 = white, 0 = black, MSB first
+//
+static void SetBlack(uint8_t *pImage, int iPitch, int iWidth, int iHeight, int x, int y)
+{
+    if (x >= 0 && x < iWidth && y >= 0 && y < iHeight)
+        pImage[(y * iPitch) + (x >> 3)] &= ~(0x80 >> (x & 7));
+} /* SetBlack() */
+
+static void FillRect(uint8_t *pImage, int iPitch, int iWidth, int iHeight, int x, int y, int cx, int cy)
+{
+    for (int ty=y; ty<y+cy; ty++) {
+        for (int tx=x; tx<x+cx; tx++) {
+            SetBlack(pImage, iPitch, iWidth, iHeight, tx, ty);
+        }
+    }
+} /* FillRect() */
+
+static void DrawLine(uint8_t *pImage, int iPitch, int iWidth, int iHeight, int x1, int y1, int x2, int y2)
+{
+int dx, dy, sx, sy, err, e2;
+
+    dx = (x2 > x1) ? x2 - x1 : x1 - x2;
+    dy = (y2 > y1) ? y1 - y2 : y2 - y1;
+    sx = (x1 < x2) ? 1 : -1;
+    sy = (y1 < y2) ? 1 : -1;
+    err = dx + dy;
+    while (1) {
+        SetBlack(pImage, iPitch, iWidth, iHeight, x1, y1);
+        if (x1 == x2 && y1 == y2)
+            break;
+        e2 = 2 * err;
+        if (e2 >= dy) { err += dy; x1 += sx; }
+        if (e2 <= dx) { err += dx; y1 += sy; }
+    }
+} /* DrawLine() */
+//
+// Lines of text made of random glyphs (stems, bowls and bars)
+//
+static void DrawText(uint8_t *pImage, int iPitch, int iWidth, int iHeight, int x0, int y0, int cx, int cy, int iSize)
+{
+int x, y, w, i;
+
+    for (y=y0; y+iSize<y0+cy; y += (iSize * 3) / 2) { // text lines
+        x = x0;
+        while (x < x0 + cx) {
+            for (i=0; i<3+(int)(Random() % 6) && x < x0 + cx; i++) { // word
+                w = (iSize / 2) + (Random() % (iSize / 2));
+                switch (Random() % 4) {
+                    case 0: // stem
+                        FillRect(pImage, iPitch, iWidth, iHeight, x + w/3, y, 2, iSize);
+                        break;
+                    case 1: // box shaped
+                        FillRect(pImage, iPitch, iWidth, iHeight, x, y + iSize/3, 2, (iSize*2)/3);
+                        FillRect(pImage, iPitch, iWidth, iHeight, x + w - 3, y + iSize/3, 2, (iSize*2)/3);
+                        FillRect(pImage, iPitch, iWidth, iHeight, x, y + iSize/3, w - 1, 2);
+                        FillRect(pImage, iPitch, iWidth, iHeight, x, y + iSize - 2, w - 1, 2);
+                        break;
+                    case 2: // diagonals
+                        DrawLine(pImage, iPitch, iWidth, iHeight, x, y + iSize - 1, x + w/2, y + iSize/3);
+                        DrawLine(pImage, iPitch, iWidth, iHeight, x + 1, y + iSize - 1, x + w/2 + 1, y + iSize/3);
+                        DrawLine(pImage, iPitch, iWidth, iHeight, x + w/2, y + iSize/3, x + w - 1, y + iSize - 1);
+                        break;
+                    case 3: // stem + bar
+                        FillRect(pImage, iPitch, iWidth, iHeight, x + 1, y + iSize/3, 2, (iSize*2)/3);
+                        FillRect(pImage, iPitch, iWidth, iHeight, x + 1, y + iSize/3, w - 2, 2);
+                        break;
+                }
+                x += w + 1;
+            }
+            x += iSize / 2; // space between words
+        }
+    }
+} /* DrawText() */
+//
+// Vertical bars of 1 to 4 modules
+//
+static void DrawBarcode(uint8_t *pImage, int iPitch, int iWidth, int iHeight, int x0, int y0, int cx, int cy, int iModule)
+{
+int x, w;
+
+    x = x0 + 10 * iModule; // quiet zone
+    while (x < x0 + cx - 10 * iModule) {
+        w = (1 + (Random() & 3)) * iModule;
+        FillRect(pImage, iPitch, iWidth, iHeight, x, y0, w, cy);
+        x += w + (1 + (Random() & 3)) * iModule;
+    }
+} /* DrawBarcode() */
+//
+// Generate one image of the corpus
+//
+static void Generate(uint8_t *pImage, int iClass, int iWidth, int iHeight)
+{
+int i, x, y, iPitch = (iWidth + 7) >> 3;
+static const uint8_t ucBayer[4] = {0x88, 0x22, 0x44, 0x11};
+
+    u32Seed = 0x1234 + (iClass * 65537) + iWidth; // the corpus is the same every run
+    memset(pImage, 0xff, iPitch * iHeight);
+    switch (iClass) {
+        case CLASS_TEXT:
+            DrawText(pImage, iPitch, iWidth, iHeight, iWidth/20, 8, iWidth - iWidth/10, iHeight - 16, 16);
+            break;
+        case CLASS_CAD: // thin lines at all angles + rectangles
+            for (i=0; i<iWidth/16; i++) {
+                x = Random() % iWidth; y = Random() % iHeight;
+                switch (Random() % 4) {
+                    case 0:
+                        DrawLine(pImage, iPitch, iWidth, iHeight, x, y, x + (Random() % iWidth) / 2, y);
+                        break;
+                    case 1:
+                        DrawLine(pImage, iPitch, iWidth, iHeight, x, y, x, y + (Random() % iHeight));
+                        break;
+                    case 2:
+                        DrawLine(pImage, iPitch, iWidth, iHeight, x, y, Random() % iWidth, Random() % iHeight);
+                        break;
+                    case 3: // rectangle outline
+                        DrawLine(pImage, iPitch, iWidth, iHeight, x, y, x + 40, y);
+                        DrawLine(pImage, iPitch, iWidth, iHeight, x + 40, y, x + 40, y + 25);
+                        DrawLine(pImage, iPitch, iWidth, iHeight, x + 40, y + 25, x, y + 25);
+                        DrawLine(pImage, iPitch, iWidth, iHeight, x, y + 25, x, y);
+                        break;
+                }
+            }
+            break;
+        case CLASS_SOLID: // large black blocks
+            for (i=0; i<8; i++) {
+                FillRect(pImage, iPitch, iWidth, iHeight, Random() % iWidth, Random() % iHeight, iWidth/8 + Random() % (iWidth/4), iHeight/8 + Random() % (iHeight/4));
+            }
+            break;
+        case CLASS_CHECKER: // top half 1-pixel checkerboard, bottom half ordered dither
+            for (y=0; y<iHeight; y++) {
+                for (x=0; x<iPitch; x++) {
+                    if (y < iHeight/2)
+                        pImage[(y * iPitch) + x] = (y & 1) ? 0x55 : 0xaa;
+                    else
+                        pImage[(y * iPitch) + x] = ~ucBayer[y & 3];
+                }
+            }
+            break;
+        case CLASS_BARCODE:
+            DrawBarcode(pImage, iPitch, iWidth, iHeight, 0, iHeight/8, iWidth, (iHeight*3)/4, 3);
+            break;
+        case CLASS_LABEL: // mostly blank; an address block and a small barcode
+            DrawText(pImage, iPitch, iWidth, iHeight, iWidth/16, iHeight/16, iWidth/2, iHeight/4, 12);
+            DrawBarcode(pImage, iPitch, iWidth, iHeight, iWidth/16, iHeight/2, iWidth/3, iHeight/6, 2);
+            break;
+    }
+} /* Generate() */
+//
+// Run one benchmark and keep the best time of a few tries
+//
+static void BenchImage(uint8_t *pImage, uint8_t *pOut, int iOutSize, void *pWorkspace, BENCH_RESULT *pResult)
+{
+G4ENCIMAGE g4;
+BUFFERED_BITS bb;
+G4ENC_FLIP *pCur, *pRef, *pTemp;
+int iWidth = pResult->iWidth, iHeight = pResult->iHeight;
+int i, y, iReps, iPitch = (iWidth + 7) >> 3;
+int iWorkspaceSize = G4ENC_getWorkspaceSize(iWidth);
+long long llStart, llTime;
+double dInit, dExtract, dExtractCode, dTotal;
+
+    // find the number of repetitions needed for a measurable time
+    llStart = nanos();
+    G4ENC_initWorkspace(&g4, iWidth, iHeight, iFillOrder, NULL, pOut, iOutSize, pWorkspace, iWorkspaceSize);
+    G4ENC_encodeImage(&g4, pImage, iPitch);
+    llTime = nanos() - llStart;
+    pResult->iCompressed = G4ENC_getOutSize(&g4);
+    iReps = (int)(MIN_TIME_NS / (llTime + 1)) + 1;
+    pCur = (G4ENC_FLIP *)malloc(G4ENC_FLIP_COUNT(iWidth) * sizeof(G4ENC_FLIP));
+    pRef = (G4ENC_FLIP *)malloc(G4ENC_FLIP_COUNT(iWidth) * sizeof(G4ENC_FLIP));
+    dInit = dExtract = dExtractCode = dTotal = 1e30;
+    for (int iTry=0; iTry<BEST_OF; iTry++) {
+        // init
+        llStart = nanos();
+        for (i=0; i<iReps*16; i++)
+            G4ENC_initWorkspace(&g4, iWidth, iHeight, iFillOrder, NULL, pOut, iOutSize, pWorkspace, iWorkspaceSize);
+        llTime = nanos() - llStart;
+        if (llTime / (iReps * 16.0) < dInit) dInit = llTime / (iReps * 16.0);
+        // run-end extraction only
+        llStart = nanos();
+        for (i=0; i<iReps; i++) {
+            for (y=0; y<iHeight; y++)
+                G4ENCEncodeLine(&pImage[y * iPitch], iWidth, pCur);
+        }
+        llTime = nanos() - llStart;
+        if (llTime / (double)iReps < dExtract) dExtract = llTime / (double)iReps;
+        // extraction + 2D coding into a buffer big enough to never be flushed
+        llStart = nanos();
+        for (i=0; i<iReps; i++) {
+            for (y=0; y<4; y++)
+                pRef[y] = iWidth;
+            bb.pBuf = pOut;
+            bb.ulBits = 0;
+            bb.ulBitOff = 0;
+            bb.ulMirror = (iFillOrder == G4ENC_LSB_FIRST);
+            for (y=0; y<iHeight; y++) {
+                G4ENCEncodeLine(&pImage[y * iPitch], iWidth, pCur);
+                G4ENCCodeLine(&bb, pCur, pRef, iWidth);
+                pTemp = pCur; pCur = pRef; pRef = pTemp;
+            }
+        }
+        llTime = nanos() - llStart;
+        if (llTime / (double)iReps < dExtractCode) dExtractCode = llTime / (double)iReps;
+        // the whole encoder (includes staging buffer flushes and the EOFB)
+        llStart = nanos();
+        for (i=0; i<iReps; i++) {
+            G4ENC_initWorkspace(&g4, iWidth, iHeight, iFillOrder, NULL, pOut, iOutSize, pWorkspace, iWorkspaceSize);
+            G4ENC_encodeImage(&g4, pImage, iPitch);
+        }
+        llTime = nanos() - llStart;
+        if (llTime / (double)iReps < dTotal) dTotal = llTime / (double)iReps;
+    }
+    free(pCur);
+    free(pRef);
+    pResult->dInit = dInit;
+    pResult->dExtract = dExtract;
+    pResult->dCode = (dExtractCode > dExtract) ? dExtractCode - dExtract : 0.0;
+    // what's left is init + writing the output + the EOFB
+    pResult->dFlush = (dTotal > dExtractCode + dInit) ? dTotal - dExtractCode - dInit : 0.0;
+    pResult->dTotal = dTotal;
+} /* BenchImage() */
+
+static void PrintResult(BENCH_RESULT *pResult, int iFormat, int bFirst)
+{
+int iRaw = pResult->iRaw;
+double dMBs = (iRaw / 1000000.0) / (pResult->dTotal / 1e9);
+double dLines = pResult->iHeight / (pResult->dTotal / 1e9);
+double dRatio = (pResult->iCompressed) ? (double)iRaw / pResult->iCompressed : 0.0;
+
+    if (iFormat == OUTPUT_CSV) {
+        printf("%s,%d,%d,%d,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.2f,%.0f,%.3f\n", szClassNames[pResult->iClass], pResult->iWidth, pResult->iHeight,
+               iRaw, pResult->iCompressed, pResult->dInit / 1000.0, pResult->dExtract / 1000.0, pResult->dCode / 1000.0, pResult->dFlush / 1000.0,
+               pResult->dTotal / 1000.0, dMBs, dLines, dRatio);
+    } else if (iFormat == OUTPUT_JSON) {
+        printf("%s    {\"class\": \"%s\", \"width\": %d, \"height\": %d, \"raw_bytes\": %d, \"g4_bytes\": %d, "
+               "\"init_us\": %.3f, \"extract_us\": %.3f, \"code_us\": %.3f, \"flush_us\": %.3f, \"total_us\": %.3f, "
+               "\"mb_per_s\": %.2f, \"lines_per_s\": %.0f, \"ratio\": %.3f}", (bFirst) ? "" : ",\n",
+               szClassNames[pResult->iClass], pResult->iWidth, pResult->iHeight, iRaw, pResult->iCompressed,
+               pResult->dInit / 1000.0, pResult->dExtract / 1000.0, pResult->dCode / 1000.0, pResult->dFlush / 1000.0,
+               pResult->dTotal / 1000.0, dMBs, dLines, dRatio);
+    } else {
+        if (pResult->iWidth == 0)
+            printf("%-8s %6s %9d %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %10.0f %8.2f\n\n", szClassNames[pResult->iClass], "all",
+               pResult->iCompressed, pResult->dInit / 1000.0, pResult->dExtract / 1000.0, pResult->dCode / 1000.0, pResult->dFlush / 1000.0,
+               pResult->dTotal / 1000.0, dMBs, dLines, dRatio);
+        else
+        printf("%-8s %6d %9d %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %10.0f %8.2f\n", szClassNames[pResult->iClass], pResult->iWidth,
+               pResult->iCompressed, pResult->dInit / 1000.0, pResult->dExtract / 1000.0, pResult->dCode / 1000.0, pResult->dFlush / 1000.0,
+               pResult->dTotal / 1000.0, dMBs, dLines, dRatio);
+    }
+} /* PrintResult() */
+
+int main(int argc, char *argv[])
+{
+int iFormat = OUTPUT_TEXT;
+int iClass, iWidth, iOutSize, iCount;
+uint8_t *pImage, *pOut;
+void *pWorkspace;
+BENCH_RESULT result, total;
+
+    for (int i=1; i<argc; i++) {
+        if (strcmp(argv[i], "-csv") == 0) {
+            iFormat = OUTPUT_CSV;
+        } else if (strcmp(argv[i], "-json") == 0) {
+            iFormat = OUTPUT_JSON;
+        } else if (strcmp(argv[i], "-lsb") == 0) {
+            iFillOrder = G4ENC_LSB_FIRST;
+        } else {
+            printf("Usage: bench [-csv | -json] [-lsb]\n");
+            printf("Encodes a synthetic corpus of %d image classes at %d widths\n", CLASS_COUNT, WIDTH_COUNT);
+            printf("and reports the time of each phase (in us per image),\n");
+            printf("throughput and compression ratio.\n");
+            printf("-lsb encodes with LSB first bit order (FillOrder=2)\n");
+            return 0;
+        }
+    }
+    iWidth = iWidths[WIDTH_COUNT-1];
+    pImage = (uint8_t *)malloc(((iWidth + 7) >> 3) * BENCH_HEIGHT);
+    iOutSize = G4ENC_MAX_LINE_SIZE(iWidth) * BENCH_HEIGHT;
+    pOut = (uint8_t *)malloc(iOutSize);
+    pWorkspace = malloc(G4ENC_getWorkspaceSize(iWidth));
+    if (pImage == NULL || pOut == NULL || pWorkspace == NULL) {
+        printf("Error allocating memory\n");
+        return -1;
+    }
+    if (iFormat == OUTPUT_CSV) {
+        printf("class,width,height,raw_bytes,g4_bytes,init_us,extract_us,code_us,flush_us,total_us,mb_per_s,lines_per_s,ratio\n");
+    } else if (iFormat == OUTPUT_JSON) {
+        printf("{\n  \"benchmark\": \"G4ENCODER\",\n  \"accumulator_bits\": %d,\n  \"fill_order\": %d,\n  \"results\": [\n", REGISTER_WIDTH, (iFillOrder == G4ENC_LSB_FIRST) ? 2 : 1);
+    } else {
+        printf("G4 Encoder benchmark (%d-bit accumulator, %s first, times in us per image)\n", REGISTER_WIDTH, (iFillOrder == G4ENC_LSB_FIRST) ? "LSB" : "MSB");
+        printf("class     width  g4 bytes      init   extract      code     flush     total      MB/s    lines/s    ratio\n");
+    }
+    iCount = 0;
+    for (iClass=0; iClass<CLASS_COUNT; iClass++) {
+        memset(&total, 0, sizeof(total));
+        total.iClass = iClass;
+        for (int w=0; w<WIDTH_COUNT; w++) {
+            memset(&result, 0, sizeof(result));
+            result.iClass = iClass;
+            result.iWidth = iWidths[w];
+            result.iHeight = (iClass == CLASS_LABEL && iWidths[w] == 296) ? 128 : BENCH_HEIGHT;
+            result.iRaw = ((result.iWidth + 7) >> 3) * result.iHeight;
+            Generate(pImage, iClass, result.iWidth, result.iHeight);
+            BenchImage(pImage, pOut, iOutSize, pWorkspace, &result);
+            PrintResult(&result, iFormat, (iCount++ == 0));
+            // the class total is one image of each width
+            total.iHeight += result.iHeight;
+            total.iRaw += result.iRaw;
+            total.iCompressed += result.iCompressed;
+            total.dInit += result.dInit;
+            total.dExtract += result.dExtract;
+            total.dCode += result.dCode;
+            total.dFlush += result.dFlush;
+            total.dTotal += result.dTotal;
+        }
+        PrintResult(&total, iFormat, 0);
+    }
+    if (iFormat == OUTPUT_JSON)
+        printf("\n  ]\n}\n");
+    free(pImage);
+    free(pOut);
+    free(pWorkspace);
+    return 0;
+} /* main() */
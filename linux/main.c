@@ -20,10 +20,25 @@
 #include <stdint.h>
 #include <string.h>
 #include <time.h>
+#define G4ENC_STATS // for -stats (the library leaves them out by default)
 #include "../src/G4ENCODER.h"
 #include "../src/g4enc.inl"
 
 G4ENCIMAGE g4;
+FILE *oHandle;
+
+//
+// Sink callbacks for streaming the TIFF file (-stream)
+//
+int StreamWrite(uint8_t *pBuf, int iLen)
+{
+    return (int)fwrite(pBuf, 1, iLen, oHandle);
+} /* StreamWrite() */
+
+int StreamSeek(int iPosition)
+{
+    return fseek(oHandle, iPosition, SEEK_SET);
+} /* StreamSeek() */
 
 long micros(void)
 {
@@ -36,6 +51,60 @@ struct timespec res;
     return iTime;
 } /* micros() */
 
+//
+// Show the bitstream statistics gathered while encoding (-stats)
+//
+void PrintStats(G4ENCSTATS *pStats, int iHeight)
+{
+int i, c, iLen;
+uint32_t ulTotal;
+static const char *szVert[7] = {"VL3", "VL2", "VL1", "V0", "VR1", "VR2", "VR3"};
+
+    ulTotal = pStats->ulPassBits + pStats->ulVertBits + pStats->ulHorizBits + pStats->ul1DBits + pStats->ulEOLBits + pStats->ulFillBits;
+    if (ulTotal == 0)
+        ulTotal = 1;
+    printf("Bitstream statistics (%d lines)\n", (int)pStats->ulLines);
+    printf("  %-10s %10s %10s %6s\n", "mode", "codes", "bits", "%bits");
+    printf("  %-10s %10u %10u %5.1f%%\n", "pass", pStats->ulPass, pStats->ulPassBits, pStats->ulPassBits * 100.0 / ulTotal);
+    for (i=0; i<7; i++)
+        printf("  %-10s %10u %10u\n", szVert[i], pStats->ulVert[i], (pStats->ulVert[i] * G4ENC_MH_LEN(vtable[i])));
+    printf("  %-10s %10s %10u %5.1f%%\n", "vertical", "", pStats->ulVertBits, pStats->ulVertBits * 100.0 / ulTotal);
+    printf("  %-10s %10u %10u %5.1f%%\n", "horizontal", pStats->ulHoriz, pStats->ulHorizBits, pStats->ulHorizBits * 100.0 / ulTotal);
+    if (pStats->ul1DBits)
+        printf("  %-10s %10s %10u %5.1f%%\n", "1D (MH)", "", pStats->ul1DBits, pStats->ul1DBits * 100.0 / ulTotal);
+    printf("  %-10s %10s %10u %5.1f%%\n", "EOL/RTC", "", pStats->ulEOLBits, pStats->ulEOLBits * 100.0 / ulTotal);
+    printf("  %-10s %10s %10u %5.1f%%\n", "fill", "", pStats->ulFillBits, pStats->ulFillBits * 100.0 / ulTotal);
+    if (pStats->ulLines) {
+        printf("Bits per line: min %u, max %u (line %d), average %u\n", pStats->ulMinLineBits, pStats->ulMaxLineBits, pStats->iMaxLine,
+               (pStats->ulPassBits + pStats->ulVertBits + pStats->ulHorizBits + pStats->ul1DBits) / pStats->ulLines);
+    }
+    if (pStats->pLineBits) { // the bits of each line in bands of 1/16 of the image
+        iLen = (iHeight + 15) / 16;
+        for (i=0; i<iHeight; i+=iLen) {
+            ulTotal = 0;
+            for (c=i; c<i+iLen && c<iHeight; c++)
+                ulTotal += pStats->pLineBits[c];
+            printf("  lines %5d-%-5d %8u bits\n", i, c-1, ulTotal);
+        }
+    }
+    printf("Coded run lengths    %10s %10s\n", "white", "black");
+    for (i=0; i<G4ENC_RUN_BUCKETS; i++) {
+        if (pStats->ulRuns[0][i] == 0 && pStats->ulRuns[1][i] == 0)
+            continue;
+        if (i < 2)
+            printf("  %6d%-12s %10u %10u\n", i, "", pStats->ulRuns[0][i], pStats->ulRuns[1][i]);
+        else if (i == G4ENC_RUN_BUCKETS-1)
+            printf("  %6d+%-11s %10u %10u\n", 1 << (i-1), "", pStats->ulRuns[0][i], pStats->ulRuns[1][i]);
+        else
+            printf("  %6d-%-11d %10u %10u\n", 1 << (i-1), (1 << i) - 1, pStats->ulRuns[0][i], pStats->ulRuns[1][i]);
+    }
+    printf("Make-up codes        %10s %10s\n", "white", "black");
+    for (i=1; i<41; i++) {
+        if (pStats->ulMakeup[0][i] || pStats->ulMakeup[1][i])
+            printf("  %6d%-12s %10u %10u\n", i * 64, "", pStats->ulMakeup[0][i], pStats->ulMakeup[1][i]);
+    }
+} /* PrintStats() */
+
 //
 // Read a Windows BMP file into memory
 // For this demo, the only supported files are 24 or 32-bits per pixel
@@ -122,38 +191,154 @@ int rc;
 uint8_t *pTemp;
 uint8_t *pBitmap;
 int iSize, iWidth, iHeight, iBpp, iPitch;
+int iRowsPerStrip = 0;
+uint32_t *pStripSizes = NULL;
+void *pWorkspace = NULL;
+void *pDecWorkspace = NULL;
+int iVerify = 0;
+int iEstimate = 0, iError;
+int iStream = 0;
+int iThreshold = 128;
+int iT4K = 0;
+int iStats = 0;
+G4ENCSTATS stats;
+long lEstTime = 0;
+G4DECIMAGE g4dec;
 uint8_t ucPalette[1024];
-FILE *oHandle;
     
     printf("G4 Encoder demo\n");
     printf("G4ENCIMAGE Structure size = %d bytes\n", (int)sizeof(G4ENCIMAGE));
 
-    if (argc != 3) {
-        printf("Usage: g4demo <infile> <outfile>\n");
-        printf("The input file should be a 1-bpp Windows BMP file\n");
+    if (argc < 3 || argc > 10) {
+        printf("Usage: g4demo <infile> <outfile> [rows_per_strip] [-verify[=N]] [-estimate[=N]] [-stream] [-threshold[=N]] [-t4[=K]] [-stats]\n");
+        printf("The input file should be a 1, 24 or 32-bpp Windows BMP file\n");
         printf("The output file will be a TIFF file if the name ends in .tif,\n");
         printf("otherwise it will be just the compressed image data.\n");
+        printf("If rows_per_strip is given, the image is divided into strips\n");
+        printf("which are encoded in parallel on all CPU cores.\n");
+        printf("-verify decodes every Nth encoded line (default 1) and compares\n");
+        printf("it with the input (single strip only).\n");
+        printf("-estimate predicts the output size from every Nth line (default 16)\n");
+        printf("before encoding the image.\n");
+        printf("-stream writes the TIFF file as it's encoded instead of\n");
+        printf("holding the compressed data in memory.\n");
+        printf("Color pixels darker than the threshold (default 128) become black;\n");
+        printf("-threshold without a value picks one for each line.\n");
+        printf("-t4 writes T.4 (Group 3) data with byte aligned EOLs: 1D (MH) or\n");
+        printf("2D (MR) with a 1D line every K lines.\n");
+        printf("-stats shows the codes used for each mode, the bits per line\n");
+        printf("and histograms of the run lengths (single strip only).\n");
         return 0;
     }
+    for (int i=3; i<argc; i++) {
+        if (strncmp(argv[i], "-verify", 7) == 0) {
+            iVerify = (argv[i][7] == '=') ? atoi(&argv[i][8]) : 1;
+        } else if (strncmp(argv[i], "-estimate", 9) == 0) {
+            iEstimate = (argv[i][9] == '=') ? atoi(&argv[i][10]) : 16;
+        } else if (strcmp(argv[i], "-stream") == 0) {
+            iStream = 1;
+        } else if (strncmp(argv[i], "-threshold", 10) == 0) {
+            iThreshold = (argv[i][10] == '=') ? atoi(&argv[i][11]) : G4ENC_THRESHOLD_AUTO;
+        } else if (strncmp(argv[i], "-t4", 3) == 0) {
+            iT4K = (argv[i][3] == '=') ? atoi(&argv[i][4]) : 1;
+        } else if (strcmp(argv[i], "-stats") == 0) {
+            iStats = 1;
+        } else {
+            iRowsPerStrip = atoi(argv[i]);
+        }
+    }
     pBitmap = ReadBMP(argv[1], &iWidth, &iHeight, &iBpp, ucPalette);
-    if (iBpp != 1) {
-        printf("Input image must be 1-bpp\n");
+    if (pBitmap != NULL && iBpp != 1 && iBpp != 24 && iBpp != 32) {
+        printf("Input image must be 1, 24 or 32-bpp\n");
         return 0;
     }
     if (pBitmap != NULL) {
-        iPitch = (iWidth+7)>>3;
-        iSize = iPitch * iHeight; // allocate enough to hold an uncompressed copy
-        pTemp = (uint8_t *)malloc(iSize);
+        iPitch = ((iWidth * iBpp) + 7) >> 3;
+        if (iStream) { // the data goes straight to the file
+            if (memcmp(&argv[2][strlen(argv[2])-4], ".tif", 4) != 0) {
+                printf("-stream needs a .tif output file\n");
+                return 0;
+            }
+            oHandle = fopen(argv[2], "w+b");
+            if (oHandle == NULL) {
+                printf("Error opening output file %s\n", argv[2]);
+                return 0;
+            }
+            pTemp = NULL;
+            iSize = 0;
+        } else {
+            iSize = G4ENC_maxOutSize(iWidth, iHeight); // big enough for any image of this size
+            pTemp = (uint8_t *)malloc(iSize);
+        }
         lTime = micros();
-        rc = G4ENC_init(&g4, iWidth, iHeight, G4ENC_MSB_FIRST, NULL, pTemp, iSize);
-        if (rc == G4ENC_SUCCESS) {
-            for (int i=0; i<iHeight && rc == G4ENC_SUCCESS; i++) {
-                rc = G4ENC_addLine(&g4, &pBitmap[i * iPitch]);
+        if (iWidth > G4ENC_MAX_WIDTH) { // too wide for the built-in buffers
+            pWorkspace = malloc(G4ENC_getWorkspaceSize(iWidth));
+            rc = G4ENC_initWorkspace(&g4, iWidth, iHeight, G4ENC_MSB_FIRST, (iStream) ? StreamWrite : NULL, pTemp, iSize, pWorkspace, G4ENC_getWorkspaceSize(iWidth));
+        } else {
+            rc = G4ENC_init(&g4, iWidth, iHeight, G4ENC_MSB_FIRST, (iStream) ? StreamWrite : NULL, pTemp, iSize);
+        }
+        if (rc == G4ENC_SUCCESS && iRowsPerStrip > 0) {
+            pStripSizes = (uint32_t *)malloc(sizeof(uint32_t) * ((iHeight + iRowsPerStrip - 1) / iRowsPerStrip));
+            rc = G4ENC_setStrips(&g4, iRowsPerStrip, pStripSizes);
+        }
+        if (rc == G4ENC_SUCCESS && iT4K > 0)
+            rc = G4ENC_setT4(&g4, iT4K, G4ENC_T4_EOL_ALIGN);
+        if (rc == G4ENC_SUCCESS && iStats) {
+            stats.pLineBits = (uint32_t *)malloc(sizeof(uint32_t) * iHeight);
+            rc = G4ENC_setStats(&g4, &stats);
+        }
+        if (rc == G4ENC_SUCCESS && iStream)
+            rc = G4ENC_startTIFF(&g4, StreamSeek);
+        if (rc == G4ENC_SUCCESS && iEstimate > 0 && iBpp == 1) { // not included in the encode time
+            lEstTime = micros();
+            iSize = G4ENC_estimateSize(&g4, pBitmap, iPitch, iEstimate, &iError);
+            lEstTime = micros() - lEstTime;
+            printf("Estimated size = %d +/- %d bytes in %d us\n", iSize, iError, (int)lEstTime);
+        }
+        if (rc == G4ENC_SUCCESS && iRowsPerStrip > 0 && iBpp == 1) {
+            rc = G4ENC_encodeStrips(&g4, pBitmap, iPitch, 0); // use all cores
+            printf("Encoded %d strips of %d rows\n", G4ENC_getStripCount(&g4), iRowsPerStrip);
+        } else if (rc == G4ENC_SUCCESS) {
+            if (iVerify > 0) { // check the output as we go
+                if (iWidth > G4ENC_MAX_WIDTH) {
+                    pDecWorkspace = malloc(G4DEC_getWorkspaceSize(iWidth));
+                    rc = G4DEC_initWorkspace(&g4dec, iWidth, iHeight, G4ENC_MSB_FIRST, NULL, 0, pDecWorkspace, G4DEC_getWorkspaceSize(iWidth));
+                } else {
+                    rc = G4DEC_init(&g4dec, iWidth, iHeight, G4ENC_MSB_FIRST, NULL, 0);
+                }
+                if (rc == G4ENC_SUCCESS)
+                    rc = G4ENC_setVerify(&g4, &g4dec, iVerify);
+            }
+            if (rc == G4ENC_SUCCESS && iBpp == 1) {
+                rc = G4ENC_encodeImage(&g4, pBitmap, iPitch);
+            } else if (rc == G4ENC_SUCCESS) { // threshold the color pixels as they're encoded (BGR or the RGBA which ReadBMP() makes)
+                for (int y=0; y<iHeight && rc == G4ENC_SUCCESS; y++)
+                    rc = G4ENC_addLineRGB(&g4, &pBitmap[y * iPitch], (iBpp == 24) ? G4ENC_PIXEL_BGR24 : G4ENC_PIXEL_RGBA32, iThreshold);
             }
         }
-        lTime = micros() - lTime;
-        printf("Encode in %d us\n", (int)lTime);
+        lTime = micros() - lTime - lEstTime;
+        free(pWorkspace);
+        free(pDecWorkspace);
+        if (rc != G4ENC_IMAGE_COMPLETE) {
+            printf("Error %d encoding the image\n", rc);
+            return 0;
+        }
+        if (iVerify > 0) {
+            printf("Verified %d of %d lines\n", g4dec.y, iHeight);
+        }
+        printf("Encode in %d us (%d lines/s)\n", (int)lTime, (lTime > 0) ? (int)((iHeight * 1000000LL) / lTime) : 0);
         printf("Output data size = %d bytes\n", G4ENC_getOutSize(&g4));
+        if (iStats) {
+            if (stats.ulLines)
+                PrintStats(&stats, iHeight);
+            else
+                printf("No statistics (the strips were encoded in parallel)\n");
+            free(stats.pLineBits);
+        }
+        if (iStream) { // already written
+            fclose(oHandle);
+            return 0;
+        }
         oHandle = fopen(argv[2], "w+b");
         if (oHandle == NULL) {
             printf("Error opening output file %s\n", argv[2]);
@@ -162,10 +347,12 @@ FILE *oHandle;
         if (memcmp(&argv[2][strlen(argv[2])-4], ".tif", 4) == 0) {
             // output file is requested to be a TIFF, write the header first
             printf("Output file requested to be a TIFF; adding header...\n");
-            uint8_t ucTemp[256];
-            G4ENC_getTIFFHeader(&g4, ucTemp);
-            iSize = G4ENC_getTIFFHeaderSize();
-            fwrite(ucTemp, 1, iSize, oHandle);
+            uint8_t *pHeader;
+            iSize = G4ENC_getTIFFHeaderSizeEx(&g4);
+            pHeader = (uint8_t *)malloc(iSize);
+            G4ENC_getTIFFHeader(&g4, pHeader);
+            fwrite(pHeader, 1, iSize, oHandle);
+            free(pHeader);
         }
         fwrite(pTemp, 1, G4ENC_getOutSize(&g4), oHandle);
         fclose(oHandle);
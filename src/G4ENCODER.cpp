@@ -22,11 +22,56 @@
 
 // forward references
 int G4ENC_init(G4ENCIMAGE *pImage, int iWidth, int iHeight, int iBitDirection, G4ENC_WRITE_CALLBACK *pfnWrite, uint8_t *pOut, int iOutSize);
+int G4ENC_getWorkspaceSize(int iWidth);
+int G4ENC_initWorkspace(G4ENCIMAGE *pImage, int iWidth, int iHeight, int iBitDirection, G4ENC_WRITE_CALLBACK *pfnWrite, uint8_t *pOut, int iOutSize, void *pWorkspace, int iWorkspaceSize);
+int G4ENC_setWriteCallback(G4ENCIMAGE *pImage, G4ENC_WRITE_CALLBACK_EX *pfnWrite, void *pUser);
+int G4ENC_reset(G4ENCIMAGE *pImage, int iWidth, int iHeight, uint8_t *pOut, int iOutSize);
+int G4ENC_setPingPong(G4ENCIMAGE *pImage, uint8_t *pBuf0, uint8_t *pBuf1, int iBufSize);
+int G4ENC_releaseBuffer(G4ENCIMAGE *pImage, uint8_t *pBuf);
+int G4ENC_getLine(G4ENCIMAGE *pImage);
+int G4ENC_setFlush(G4ENCIMAGE *pImage, int iPolicy, int iValue, uint8_t *pBlockBuf);
 int G4ENC_getTIFFHeaderSize(G4ENCIMAGE *pImage);
+int G4ENC_getTIFFHeaderSizeEx(G4ENCIMAGE *pImage);
 int G4ENC_getTIFFHeader(G4ENCIMAGE *pImage, uint8_t *pOut);
+int G4ENC_startTIFF(G4ENCIMAGE *pImage, G4ENC_SEEK_CALLBACK *pfnSeek);
+int G4ENC_addTIFFPage(G4ENCIMAGE *pImage, int iWidth, int iHeight);
+int G4ENC_setStrips(G4ENCIMAGE *pImage, int iRowsPerStrip, uint32_t *pStripSizes);
+int G4ENC_getStripCount(G4ENCIMAGE *pImage);
+int G4ENC_setT4(G4ENCIMAGE *pImage, int iK, int iOptions);
+int G4ENC_rowsPerStripWorstCase(int iWidth, int iMaxStripSize);
 int G4ENC_addLine(G4ENCIMAGE *pImage, uint8_t *pPixels);
+int G4ENC_addLines(G4ENCIMAGE *pImage, uint8_t *pPixels, int iPitch, int iCount);
+int G4ENC_addLineGray8(G4ENCIMAGE *pImage, uint8_t *pPixels, int iThreshold);
+int G4ENC_addLineRGB(G4ENCIMAGE *pImage, uint8_t *pPixels, int iFormat, int iThreshold);
+int G4ENC_addRunLine(G4ENCIMAGE *pImage, const G4ENC_FLIP *pRunEnds, int iCount);
+int G4ENC_encodeImage(G4ENCIMAGE *pImage, uint8_t *pPixels, int iPitch);
+int G4ENC_encodeRotated(G4ENCIMAGE *pImage, uint8_t *pPixels, int iPitch, int iOrientation);
+int G4ENC_estimateSize(G4ENCIMAGE *pImage, uint8_t *pPixels, int iPitch, int iInterval, int *pError);
+int G4ENC_saveState(G4ENCIMAGE *pImage, uint8_t *pState, int iStateSize);
+int G4ENC_restoreState(G4ENCIMAGE *pImage, const uint8_t *pState, int iStateSize);
+int G4ENC_startFrames(G4ENCIMAGE *pImage, uint8_t *pFrameBuf);
+int G4ENC_encodeFrame(G4ENCIMAGE *pImage, uint8_t *pPixels, int iPitch, int iFlags);
+int G4ENC_maxOutSize(int iWidth, int iHeight);
+#if defined( __MACH__ ) || defined( __LINUX__ )
+int G4ENC_encodeStrips(G4ENCIMAGE *pImage, uint8_t *pPixels, int iPitch, int iThreads);
+int G4ENC_poolInit(G4ENCPOOL *pPool, int iCount);
+int G4ENC_poolAcquire(G4ENCPOOL *pPool, int bWait);
+int G4ENC_poolRelease(G4ENCPOOL *pPool, int iEncoder);
+void G4ENC_poolClose(G4ENCPOOL *pPool);
+#endif
 int G4ENC_getOutSize(G4ENCIMAGE *pImage);
 void G4ENC_getOBDLine(int iWidth, uint8_t *pImage, int iLine, uint8_t *pPixels);
+void G4ENC_getOBDPage(int iWidth, uint8_t *pImage, int iPage, uint8_t *pPixels, int iPitch);
+int G4ENC_addOBDPage(G4ENCIMAGE *pImage, uint8_t *pPage);
+int G4ENC_setVerify(G4ENCIMAGE *pImage, G4DECIMAGE *pDec, int iInterval);
+#ifdef G4ENC_STATS
+int G4ENC_setStats(G4ENCIMAGE *pImage, G4ENCSTATS *pStats);
+#endif
+int G4DEC_init(G4DECIMAGE *pDec, int iWidth, int iHeight, int iBitDirection, uint8_t *pData, int iDataSize);
+int G4DEC_getWorkspaceSize(int iWidth);
+int G4DEC_initWorkspace(G4DECIMAGE *pDec, int iWidth, int iHeight, int iBitDirection, uint8_t *pData, int iDataSize, void *pWorkspace, int iWorkspaceSize);
+int G4DEC_decodeLine(G4DECIMAGE *pDec, uint8_t *pPixels);
+G4ENC_FLIP * G4DEC_getRunEnds(G4DECIMAGE *pDec);
 #include "g4enc.inl"
 
 int G4ENCODER::init(int iWidth, int iHeight, int iBitDirection, G4ENC_WRITE_CALLBACK *pfnWrite, uint8_t *pOut, int iOutSize)
@@ -34,9 +79,49 @@ int G4ENCODER::init(int iWidth, int iHeight, int iBitDirection, G4ENC_WRITE_CALL
 	return G4ENC_init(&_g4, iWidth, iHeight, iBitDirection, pfnWrite, pOut, iOutSize);
 } /* init() */
 
+int G4ENCODER::init(int iWidth, int iHeight, int iBitDirection, G4ENC_WRITE_CALLBACK *pfnWrite, uint8_t *pOut, int iOutSize, void *pWorkspace, int iWorkspaceSize)
+{
+	return G4ENC_initWorkspace(&_g4, iWidth, iHeight, iBitDirection, pfnWrite, pOut, iOutSize, pWorkspace, iWorkspaceSize);
+} /* init() */
+
+int G4ENCODER::getWorkspaceSize(int iWidth)
+{
+	return G4ENC_getWorkspaceSize(iWidth);
+} /* getWorkspaceSize() */
+
+int G4ENCODER::setWriteCallback(G4ENC_WRITE_CALLBACK_EX *pfnWrite, void *pUser)
+{
+	return G4ENC_setWriteCallback(&_g4, pfnWrite, pUser);
+} /* setWriteCallback() */
+
+int G4ENCODER::reset(int iWidth, int iHeight, uint8_t *pOut, int iOutSize)
+{
+	return G4ENC_reset(&_g4, iWidth, iHeight, pOut, iOutSize);
+} /* reset() */
+
+int G4ENCODER::setPingPong(uint8_t *pBuf0, uint8_t *pBuf1, int iBufSize)
+{
+	return G4ENC_setPingPong(&_g4, pBuf0, pBuf1, iBufSize);
+} /* setPingPong() */
+
+int G4ENCODER::releaseBuffer(uint8_t *pBuf)
+{
+	return G4ENC_releaseBuffer(&_g4, pBuf);
+} /* releaseBuffer() */
+
+int G4ENCODER::getLine()
+{
+	return G4ENC_getLine(&_g4);
+} /* getLine() */
+
+int G4ENCODER::setFlush(int iPolicy, int iValue, uint8_t *pBlockBuf)
+{
+	return G4ENC_setFlush(&_g4, iPolicy, iValue, pBlockBuf);
+} /* setFlush() */
+
 int G4ENCODER::getTIFFHeaderSize()
 {
-	return G4ENC_getTIFFHeaderSize();
+	return G4ENC_getTIFFHeaderSizeEx(&_g4);
 } /* getTIFFHeaderSize() */
 
 int G4ENCODER::getTIFFHeader(uint8_t *pOut)
@@ -44,11 +129,123 @@ int G4ENCODER::getTIFFHeader(uint8_t *pOut)
 	return G4ENC_getTIFFHeader(&_g4, pOut);
 } /* getTIFFHeader() */
 
+int G4ENCODER::startTIFF(G4ENC_SEEK_CALLBACK *pfnSeek)
+{
+	return G4ENC_startTIFF(&_g4, pfnSeek);
+} /* startTIFF() */
+
+int G4ENCODER::addTIFFPage(int iWidth, int iHeight)
+{
+	return G4ENC_addTIFFPage(&_g4, iWidth, iHeight);
+} /* addTIFFPage() */
+
+int G4ENCODER::setStrips(int iRowsPerStrip, uint32_t *pStripSizes)
+{
+	return G4ENC_setStrips(&_g4, iRowsPerStrip, pStripSizes);
+} /* setStrips() */
+
+int G4ENCODER::getStripCount()
+{
+	return G4ENC_getStripCount(&_g4);
+} /* getStripCount() */
+
+int G4ENCODER::setT4(int iK, int iOptions)
+{
+	return G4ENC_setT4(&_g4, iK, iOptions);
+} /* setT4() */
+
 int G4ENCODER::addLine(uint8_t *pPixels)
 {
 	return G4ENC_addLine(&_g4, pPixels);
 } /* addLine() */
 
+int G4ENCODER::addLines(uint8_t *pPixels, int iPitch, int iCount)
+{
+	return G4ENC_addLines(&_g4, pPixels, iPitch, iCount);
+} /* addLines() */
+
+int G4ENCODER::addLineGray8(uint8_t *pPixels, int iThreshold)
+{
+	return G4ENC_addLineGray8(&_g4, pPixels, iThreshold);
+} /* addLineGray8() */
+
+int G4ENCODER::addLineRGB(uint8_t *pPixels, int iFormat, int iThreshold)
+{
+	return G4ENC_addLineRGB(&_g4, pPixels, iFormat, iThreshold);
+} /* addLineRGB() */
+
+int G4ENCODER::addRunLine(const G4ENC_FLIP *pRunEnds, int iCount)
+{
+	return G4ENC_addRunLine(&_g4, pRunEnds, iCount);
+} /* addRunLine() */
+
+int G4ENCODER::encodeImage(uint8_t *pPixels, int iPitch)
+{
+	return G4ENC_encodeImage(&_g4, pPixels, iPitch);
+} /* encodeImage() */
+
+int G4ENCODER::encodeRotated(uint8_t *pPixels, int iPitch, int iOrientation)
+{
+	return G4ENC_encodeRotated(&_g4, pPixels, iPitch, iOrientation);
+} /* encodeRotated() */
+
+int G4ENCODER::estimateSize(uint8_t *pPixels, int iPitch, int iInterval, int *pError)
+{
+	return G4ENC_estimateSize(&_g4, pPixels, iPitch, iInterval, pError);
+} /* estimateSize() */
+
+int G4ENCODER::saveState(uint8_t *pState, int iStateSize)
+{
+	return G4ENC_saveState(&_g4, pState, iStateSize);
+} /* saveState() */
+
+int G4ENCODER::restoreState(const uint8_t *pState, int iStateSize)
+{
+	return G4ENC_restoreState(&_g4, pState, iStateSize);
+} /* restoreState() */
+
+int G4ENCODER::startFrames(uint8_t *pFrameBuf)
+{
+	return G4ENC_startFrames(&_g4, pFrameBuf);
+} /* startFrames() */
+
+int G4ENCODER::encodeFrame(uint8_t *pPixels, int iPitch, int iFlags)
+{
+	return G4ENC_encodeFrame(&_g4, pPixels, iPitch, iFlags);
+} /* encodeFrame() */
+
+int G4ENCODER::maxOutSize(int iWidth, int iHeight)
+{
+	return G4ENC_maxOutSize(iWidth, iHeight);
+} /* maxOutSize() */
+
+#if defined( __MACH__ ) || defined( __LINUX__ )
+int G4ENCODER::encodeStrips(uint8_t *pPixels, int iPitch, int iThreads)
+{
+	return G4ENC_encodeStrips(&_g4, pPixels, iPitch, iThreads);
+} /* encodeStrips() */
+
+int G4ENCODERPOOL::init(int iCount)
+{
+	return G4ENC_poolInit(&_pool, iCount);
+} /* init() */
+
+int G4ENCODERPOOL::acquire(int bWait)
+{
+	return G4ENC_poolAcquire(&_pool, bWait);
+} /* acquire() */
+
+int G4ENCODERPOOL::release(int iEncoder)
+{
+	return G4ENC_poolRelease(&_pool, iEncoder);
+} /* release() */
+
+void G4ENCODERPOOL::close()
+{
+	G4ENC_poolClose(&_pool);
+} /* close() */
+#endif
+
 int G4ENCODER::getOutSize()
 {
 	return _g4.iDataSize;
@@ -58,3 +255,52 @@ void G4ENCODER::getOBDLine(int iWidth, uint8_t *pImage, int iLine, uint8_t *pPix
 {
     return G4ENC_getOBDLine(iWidth, pImage, iLine, pPixels);
 } /* getOBDLine() */
+
+void G4ENCODER::getOBDPage(int iWidth, uint8_t *pImage, int iPage, uint8_t *pPixels, int iPitch)
+{
+    G4ENC_getOBDPage(iWidth, pImage, iPage, pPixels, iPitch);
+} /* getOBDPage() */
+
+int G4ENCODER::addOBDPage(uint8_t *pPage)
+{
+	return G4ENC_addOBDPage(&_g4, pPage);
+} /* addOBDPage() */
+
+int G4ENCODER::setVerify(G4DECODER *pDecoder, int iInterval)
+{
+	return G4ENC_setVerify(&_g4, (pDecoder) ? &pDecoder->_g4dec : NULL, iInterval);
+} /* setVerify() */
+#ifdef G4ENC_STATS
+
+int G4ENCODER::setStats(G4ENCSTATS *pStats)
+{
+	return G4ENC_setStats(&_g4, pStats);
+} /* setStats() */
+#endif
+//
+// Companion decoder methods
+//
+int G4DECODER::init(int iWidth, int iHeight, int iBitDirection, uint8_t *pData, int iDataSize)
+{
+	return G4DEC_init(&_g4dec, iWidth, iHeight, iBitDirection, pData, iDataSize);
+} /* init() */
+
+int G4DECODER::init(int iWidth, int iHeight, int iBitDirection, uint8_t *pData, int iDataSize, void *pWorkspace, int iWorkspaceSize)
+{
+	return G4DEC_initWorkspace(&_g4dec, iWidth, iHeight, iBitDirection, pData, iDataSize, pWorkspace, iWorkspaceSize);
+} /* init() */
+
+int G4DECODER::getWorkspaceSize(int iWidth)
+{
+	return G4DEC_getWorkspaceSize(iWidth);
+} /* getWorkspaceSize() */
+
+int G4DECODER::decodeLine(uint8_t *pPixels)
+{
+	return G4DEC_decodeLine(&_g4dec, pPixels);
+} /* decodeLine() */
+
+G4ENC_FLIP * G4DECODER::getRunEnds()
+{
+	return G4DEC_getRunEnds(&_g4dec);
+} /* getRunEnds() */
@@ -18,6 +18,8 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
 #define memcpy_P memcpy
 #define PROGMEM
 #define pgm_read_byte(s) *s
@@ -45,10 +47,79 @@
 #define G4ENC_TAG_ASCII 2
 #define G4ENC_TAG_SHORT 3
 #define G4ENC_TAG_LONG 4
+// Image sizes are written as SHORT unless they need a LONG (workspace mode allows widths > 65535)
+#define G4ENC_TAG_TYPE(v) (((v) > 0xffff) ? G4ENC_TAG_LONG : G4ENC_TAG_SHORT)
+#ifndef OUTPUT_BUF_SIZE
 #define OUTPUT_BUF_SIZE 1024
+#endif
+// Widest image which fits the buffers built into G4ENCIMAGE
+// Wider images need a workspace (see G4ENC_getWorkspaceSize/G4ENC_initWorkspace)
+// Define it as 0 to remove the built-in buffers when memory is tight
+#ifndef G4ENC_MAX_WIDTH
 #define G4ENC_MAX_WIDTH 1024
+#endif
 #define G4ENC_MSB_FIRST     1
 #define G4ENC_LSB_FIRST     2
+// Input pixel formats (G4ENC_addLineGray8/G4ENC_addLineRGB)
+#define G4ENC_PIXEL_1BPP    0
+#define G4ENC_PIXEL_GRAY8   1
+#define G4ENC_PIXEL_RGB24   2
+#define G4ENC_PIXEL_BGR24   3
+#define G4ENC_PIXEL_RGBA32  4
+#define G4ENC_PIXEL_BGRA32  5
+#define G4ENC_PIXEL_OBD     6 // OneBitDisplay page (G4ENC_addOBDPage)
+#define G4ENC_PIXEL_RUNS    7 // run-ends (G4ENC_addRunLine)
+// Threshold which picks a level for each line from its darkest and brightest pixels
+#define G4ENC_THRESHOLD_AUTO -1
+// Orientations for G4ENC_encodeRotated (clockwise turn of the framebuffer)
+#define G4ENC_ROTATE_0      0
+#define G4ENC_ROTATE_90     1
+#define G4ENC_ROTATE_180    2
+#define G4ENC_ROTATE_270    3
+#define G4ENC_MIRROR        4 // mirror left to right after turning
+// T.4 (Group 3) option for G4ENC_setT4 (same bit as the TIFF T4Options tag)
+#define G4ENC_T4_EOL_ALIGN  4 // fill bits so that each EOL ends on a byte boundary
+// Frame sequences (G4ENC_startFrames/G4ENC_encodeFrame)
+// Each frame starts with a G4ENC_FRAME_HEADER_SIZE byte header:
+// 0 = G4ENC_FRAME_KEY or G4ENC_FRAME_DELTA, 1 = frame number (mod 256),
+// 2-3 = width, 4-5 = height (little-endian), followed by the G4 data.
+// A delta frame codes the pixels which changed since the previous frame
+// as black, so the receiver inverts the pixels which are black in it
+#define G4ENC_FRAME_KEY     0
+#define G4ENC_FRAME_DELTA   1
+#define G4ENC_FRAME_HEADER_SIZE 6
+// Output flush policies (G4ENC_setFlush)
+#define G4ENC_FLUSH_FULL    0 // when the staging buffer is full (default)
+#define G4ENC_FLUSH_LINES   1 // after every N lines
+#define G4ENC_FLUSH_BYTES   2 // as soon as N bytes are ready
+#define G4ENC_FLUSH_BLOCKS  3 // in chunks of exactly N bytes
+#define G4ENC_FLUSH_PAD     0x100 // with G4ENC_FLUSH_BLOCKS, fill the last chunk to N bytes with 0's
+// Worst case size (in bytes) of an encoder snapshot (G4ENC_saveState)
+// (a few counters, the pending bits and the reference line as run lengths)
+#define G4ENC_MAX_STATE_SIZE(w) ((w) + ((w) >> 6) + 64)
+// Worst case size (in bytes) of a single encoded line
+// (7 bits per pixel + T.4 EOL, EOFB or RTC, pending accumulator bits and the word-wide flush)
+#define G4ENC_MAX_LINE_SIZE(w) ((((w) * 7) >> 3) + 48)
+// Number of run-end (flip) entries needed for a line
+// (a transition on every pixel + the xsize markers which terminate the list)
+#define G4ENC_FLIP_COUNT(w) ((w) + 8)
+
+// Run-ends are 16-bits on MCUs to save RAM (widths up to 32767)
+// and 32-bits on 64-bit CPUs; define G4ENC_WIDE_FLIPS to force 32-bit
+#if !defined( G4ENC_WIDE_FLIPS ) && (defined( __LP64__ ) || defined( _WIN64 ))
+#define G4ENC_WIDE_FLIPS
+#endif
+#ifdef G4ENC_WIDE_FLIPS
+typedef int32_t G4ENC_FLIP;
+// 32-bit run-ends could hold any int width, but the sizes are ints too:
+// the workspace needs about 9 bytes per pixel of width (two lists of run-ends,
+// a worst case line and a line of pixels), so 200 million keeps
+// G4ENC_getWorkspaceSize() (1.8GB) and the w * 7 of G4ENC_MAX_LINE_SIZE below 2^31
+#define G4ENC_FLIP_MAX_WIDTH 200000000
+#else
+typedef int16_t G4ENC_FLIP;
+#define G4ENC_FLIP_MAX_WIDTH 0x7fff
+#endif
 
 // Error codes returned by getLastError()
 enum {
@@ -56,18 +127,129 @@ enum {
     G4ENC_NOT_INITIALIZED,
     G4ENC_INVALID_PARAMETER,
     G4ENC_DATA_OVERFLOW,
-    G4ENC_IMAGE_COMPLETE
+    G4ENC_IMAGE_COMPLETE,
+    G4ENC_NO_MEMORY,
+    G4ENC_DECODE_ERROR,
+    G4ENC_VERIFY_FAILED,
+    G4ENC_BUSY, // both output buffers are still being written (G4ENC_setPingPong)
+    G4ENC_WRITE_ERROR // the write callback didn't take the data
 };
 
+// Byte swap and count leading/trailing zeros; MSVC has its own intrinsics
+// instead of the GCC/clang builtins. The 32-bit trailing zero count uses the
+// long version since int is only 16 bits on AVR
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <stdlib.h>
+#define G4ENC_BSWAP32(u) _byteswap_ulong(u)
+#define G4ENC_BSWAP64(u) _byteswap_uint64(u)
+static __inline int G4ENCClz32(uint32_t u) { unsigned long i; _BitScanReverse(&i, u); return 31 - (int)i; }
+static __inline int G4ENCCtz32(uint32_t u) { unsigned long i; _BitScanForward(&i, u); return (int)i; }
+#define G4ENC_CLZ32(u) G4ENCClz32(u)
+#define G4ENC_CTZ32(u) G4ENCCtz32(u)
+#ifdef _WIN64
+static __inline int G4ENCClz64(uint64_t u) { unsigned long i; _BitScanReverse64(&i, u); return 63 - (int)i; }
+#define G4ENC_CLZ64(u) G4ENCClz64(u)
+#endif
+#else
+#define G4ENC_BSWAP32(u) __builtin_bswap32(u)
+#define G4ENC_BSWAP64(u) __builtin_bswap64(u)
+#define G4ENC_CLZ32(u) __builtin_clz(u)
+#define G4ENC_CLZ64(u) __builtin_clzll(u)
+#define G4ENC_CTZ32(u) __builtin_ctzl((unsigned long)(u))
+#endif
+
+// The bit accumulator is 64-bits on 64-bit CPUs and 32-bits everywhere else
+// Define G4ENC_64BIT_ACCUMULATOR to use the 64-bit version on a 32-bit CPU
+// which handles 64-bit shifts well (e.g. ESP32-S3); it spills 8 bytes at a time
+#if !defined( G4ENC_64BIT_ACCUMULATOR ) && (defined( __LP64__ ) || defined( _WIN64 ))
+#define G4ENC_64BIT_ACCUMULATOR
+#endif
+#ifdef G4ENC_64BIT_ACCUMULATOR
+#define BIGUINT uint64_t
+#define REGISTER_WIDTH 64
+#define G4ENC_BSWAP(u) G4ENC_BSWAP64(u)
+#if defined( __clang__ ) && defined( __has_builtin )
+#if __has_builtin( __builtin_bitreverse64 )
+#define G4ENC_BITREV(u) __builtin_bitreverse64(u)
+#endif
+#endif
+#else
+#define BIGUINT uint32_t
+#define REGISTER_WIDTH 32
+#define G4ENC_BSWAP(u) G4ENC_BSWAP32(u)
+#if defined( __clang__ ) && defined( __has_builtin )
+#if __has_builtin( __builtin_bitreverse32 )
+#define G4ENC_BITREV(u) __builtin_bitreverse32(u)
+#endif
+#endif
+#endif
+
+#ifdef G4ENC_STATS
+// Bitstream statistics gathered as lines are added (see G4ENC_setStats)
+// They're compiled out unless G4ENC_STATS is defined
+#define G4ENC_RUN_BUCKETS 13 // run lengths of 0, 1, 2-3, 4-7 ... 1024-2047, 2048+
+typedef struct g4enc_stats_tag
+{
+    uint32_t ulPass; // pass mode codes
+    uint32_t ulVert[7]; // vertical mode codes V(-3) to V(+3); ulVert[3] is V0
+    uint32_t ulHoriz; // horizontal mode codes
+    uint32_t ulPassBits, ulVertBits, ulHorizBits; // bits spent in each mode
+    uint32_t ul1DBits; // bits of the T.4 1D (MH) lines
+    uint32_t ulEOLBits; // T.4 EOLs and the RTC/EOFB at the end of each strip
+    uint32_t ulFillBits; // EOL alignment and the pad bits of the last byte of each strip
+    uint32_t ulLines; // lines added
+    uint32_t ulMinLineBits, ulMaxLineBits; // smallest and largest line (without its EOL)
+    int iMaxLine; // which line was the largest
+    uint32_t ulRuns[2][G4ENC_RUN_BUCKETS]; // coded runs [white/black] by length (horizontal mode and 1D)
+    uint32_t ulMakeup[2][41]; // make-up codes used [white/black][length / 64] (64 to 2560)
+    uint32_t *pLineBits; // optional (caller supplied) bits of each line; iHeight entries
+} G4ENCSTATS;
+#endif
+
 typedef struct pil_buffered_bits
 {
 unsigned char *pBuf; // buffer pointer
-uint32_t ulBits; // buffered bits
+BIGUINT ulBits; // buffered bits
 uint32_t ulBitOff; // current bit offset
 uint32_t ulDataSize; // available data
+uint32_t ulMirror; // non-zero to store the bits LSB first (FillOrder=2)
+#ifdef G4ENC_STATS
+G4ENCSTATS *pStats; // optional statistics of the codes written
+#endif
 } BUFFERED_BITS;
 
+// Write callbacks return iLen once the data is written; any other value
+// (e.g. a full disk) stops the encoder with G4ENC_WRITE_ERROR
 typedef int (G4ENC_WRITE_CALLBACK)(uint8_t *pBuf, int iLen);
+// Write callback which also receives the pointer given to G4ENC_setWriteCallback
+typedef int (G4ENC_WRITE_CALLBACK_EX)(void *pUser, uint8_t *pBuf, int iLen);
+// With double buffered output (G4ENC_setPingPong), a write callback returns iLen
+// when it's done with the buffer or G4ENC_WRITE_PENDING if it's still writing it
+// (e.g. by DMA) and will call G4ENC_releaseBuffer() when it's finished
+#define G4ENC_WRITE_PENDING (-1)
+// Moves the write position of a streamed TIFF file (absolute byte offset)
+// and returns a negative value if it can't (e.g. fseek() or lseek())
+typedef int (G4ENC_SEEK_CALLBACK)(int iPosition);
+
+//
+// State of the companion G4 decoder
+//
+typedef struct g4dec_image_tag
+{
+    int iWidth, iHeight; // image size
+    int iError;
+    int y; // next line to decode
+    uint8_t ucFillOrder;
+    uint8_t *pData; // G4 data to decode
+    int iDataSize;
+    int iBitPos; // current bit offset in pData
+    G4ENC_FLIP *pCur, *pRef; // pointers to swap current and reference lines
+#if G4ENC_MAX_WIDTH > 0
+    G4ENC_FLIP CurFlips[G4ENC_FLIP_COUNT(G4ENC_MAX_WIDTH)];
+    G4ENC_FLIP RefFlips[G4ENC_FLIP_COUNT(G4ENC_MAX_WIDTH)];
+#endif
+} G4DECIMAGE;
 
 //
 // our private structure to hold a TIFF image encode state
@@ -81,15 +263,66 @@ typedef struct g4enc_image_tag
     int iOutSize;
     int iDataSize; // generated output size
     uint8_t *pOutBuf;
-    int16_t *pCur, *pRef; // pointers to swap current and reference lines
+    G4ENC_FLIP *pCur, *pRef; // pointers to swap current and reference lines
     G4ENC_WRITE_CALLBACK *pfnWrite;
+    G4ENC_WRITE_CALLBACK_EX *pfnWriteEx; // used instead of pfnWrite when set
+    void *pUser; // passed to pfnWriteEx
+    uint8_t *pPingPong[2]; // optional double buffered output (G4ENC_setPingPong)
+    int iPingPongSize;
+    int iActive; // output buffer being filled
+    volatile uint8_t ucBusy[2]; // set while the write callback owns the buffer
+    int iFlushPolicy, iFlushValue; // G4ENC_setFlush
+    uint8_t *pBlockBuf; // collects the output of G4ENC_FLUSH_BLOCKS
+    int iBlockLen; // bytes in pBlockBuf
+    G4ENC_SEEK_CALLBACK *pfnSeek; // set when streaming a TIFF file (G4ENC_startTIFF)
+    int iTIFFPageOff; // file offset of the current page's header/IFD (streamed TIFF)
+    int iTIFFDataOff; // file offset of the G4 data of a streamed TIFF
+    int iMaxWidth; // widest image the line buffers can hold
+    int iRowsPerStrip; // 0 = whole image is a single strip
+    int iStripCount, iStrip; // total strips and current strip
+    int iStripStart; // output offset where the current strip begins
+    uint32_t *pStripSizes; // optional (caller supplied) compressed size of each strip
+    G4DECIMAGE *pVerify; // optional decoder which checks the encoded lines
+    int iVerifyInterval; // check 1 out of every N lines
+    uint8_t *pFileBuf; // where the bit writer is working (the staging buffer or directly in pOutBuf)
+    int iFileBufSize;
+    uint8_t *pStageBuf; // holds temporary output data (ucFileBuf or workspace)
+    int iStageBufSize;
+    uint8_t *pPrevLine; // copy of the previous line to detect repeated lines
+    int bPrevLine; // pPrevLine is valid (not after gray/RGB input)
+    int iT4K; // 0 = T.6 (G4), 1 = T.4 1D (MH), 2+ = T.4 2D (MR) with a 1D line every iT4K lines
+    int iT4Options; // G4ENC_T4_EOL_ALIGN
+    uint8_t *pFrameBuf; // previous frame of a frame sequence (G4ENC_startFrames)
+    int iFrame; // number of frames encoded
+#ifdef G4ENC_STATS
+    G4ENCSTATS *pStats; // G4ENC_setStats
+#endif
     BUFFERED_BITS bb;
-    int16_t CurFlips[G4ENC_MAX_WIDTH];
-    int16_t RefFlips[G4ENC_MAX_WIDTH];
-    uint8_t ucFileBuf[OUTPUT_BUF_SIZE]; // holds temporary output data
+#if G4ENC_MAX_WIDTH > 0
+    G4ENC_FLIP CurFlips[G4ENC_FLIP_COUNT(G4ENC_MAX_WIDTH)];
+    G4ENC_FLIP RefFlips[G4ENC_FLIP_COUNT(G4ENC_MAX_WIDTH)];
+    uint8_t ucFileBuf[OUTPUT_BUF_SIZE + G4ENC_MAX_LINE_SIZE(G4ENC_MAX_WIDTH)]; // room for a worst case line past the high-water mark
+    uint8_t ucPrevLine[(G4ENC_MAX_WIDTH + 7) / 8];
+#endif
 } G4ENCIMAGE;
 
+#if defined( __MACH__ ) || defined( __LINUX__ )
+#define G4ENC_POOL_MAX 256
+//
+// Thread safe pool of encoders (G4ENC_poolInit)
+//
+typedef struct g4enc_pool_tag
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; // signalled when an encoder is released
+    int iCount; // number of encoders in the pool
+    int iFree; // number of entries in iFreeList
+    int iFreeList[G4ENC_POOL_MAX]; // encoders not in use (the last one is handed out next)
+} G4ENCPOOL;
+#endif
+
 #ifdef __cplusplus
+class G4DECODER;
 //
 // The G4ENCODER class wraps portable C code which does the actual work
 //
@@ -97,32 +330,162 @@ class G4ENCODER
 {
   public:
     int init(int iWidth, int iHeight, int iBitDirection, G4ENC_WRITE_CALLBACK *pfnWrite, uint8_t *pOut, int iOutSize);
+    int init(int iWidth, int iHeight, int iBitDirection, G4ENC_WRITE_CALLBACK *pfnWrite, uint8_t *pOut, int iOutSize, void *pWorkspace, int iWorkspaceSize);
+    static int getWorkspaceSize(int iWidth);
+    int setWriteCallback(G4ENC_WRITE_CALLBACK_EX *pfnWrite, void *pUser);
+    int reset(int iWidth, int iHeight, uint8_t *pOut, int iOutSize);
+    int setPingPong(uint8_t *pBuf0, uint8_t *pBuf1, int iBufSize);
+    int releaseBuffer(uint8_t *pBuf);
+    int getLine();
+    int setFlush(int iPolicy, int iValue, uint8_t *pBlockBuf);
     int getTIFFHeaderSize();
     int getTIFFHeader(uint8_t *pOut);
+    int startTIFF(G4ENC_SEEK_CALLBACK *pfnSeek);
+    int addTIFFPage(int iWidth, int iHeight);
+    int setStrips(int iRowsPerStrip, uint32_t *pStripSizes);
+    int setT4(int iK, int iOptions);
+    int getStripCount();
     int addLine(uint8_t *pPixels);
+    int addLines(uint8_t *pPixels, int iPitch, int iCount);
+    int addLineGray8(uint8_t *pPixels, int iThreshold);
+    int addLineRGB(uint8_t *pPixels, int iFormat, int iThreshold);
+    int addRunLine(const G4ENC_FLIP *pRunEnds, int iCount);
+    int encodeImage(uint8_t *pPixels, int iPitch);
+    int encodeRotated(uint8_t *pPixels, int iPitch, int iOrientation);
+    int estimateSize(uint8_t *pPixels, int iPitch, int iInterval, int *pError);
+    int saveState(uint8_t *pState, int iStateSize);
+    int restoreState(const uint8_t *pState, int iStateSize);
+    int startFrames(uint8_t *pFrameBuf);
+    int encodeFrame(uint8_t *pPixels, int iPitch, int iFlags);
+    static int maxOutSize(int iWidth, int iHeight);
+#if defined( __MACH__ ) || defined( __LINUX__ )
+    int encodeStrips(uint8_t *pPixels, int iPitch, int iThreads);
+#endif
     int getOutSize();
     void getOBDLine(int iWidth, uint8_t *pImage, int iLine, uint8_t *pPixels);
+    void getOBDPage(int iWidth, uint8_t *pImage, int iPage, uint8_t *pPixels, int iPitch);
+    int addOBDPage(uint8_t *pPage);
+
+    int setVerify(G4DECODER *pDecoder, int iInterval);
+#ifdef G4ENC_STATS
+    int setStats(G4ENCSTATS *pStats);
+#endif
 
   private:
     G4ENCIMAGE _g4;
 };
+#if defined( __MACH__ ) || defined( __LINUX__ )
+//
+// Thread safe pool of encoder numbers; the caller owns the G4ENCODER objects
+//
+class G4ENCODERPOOL
+{
+  public:
+    int init(int iCount);
+    int acquire(int bWait);
+    int release(int iEncoder);
+    void close();
+
+  private:
+    G4ENCPOOL _pool;
+};
+#endif
+//
+// The G4DECODER class wraps the companion decoder
+//
+class G4DECODER
+{
+  public:
+    int init(int iWidth, int iHeight, int iBitDirection, uint8_t *pData, int iDataSize);
+    int init(int iWidth, int iHeight, int iBitDirection, uint8_t *pData, int iDataSize, void *pWorkspace, int iWorkspaceSize);
+    static int getWorkspaceSize(int iWidth);
+    int decodeLine(uint8_t *pPixels);
+    G4ENC_FLIP *getRunEnds();
+
+  private:
+    friend class G4ENCODER;
+    G4DECIMAGE _g4dec;
+};
 #else
 int G4ENC_init(G4ENCIMAGE *pImage, int iWidth, int iHeight, int iBitDirection, G4ENC_WRITE_CALLBACK *pfnWrite, uint8_t *pOut, int iOutSize);
+int G4ENC_getWorkspaceSize(int iWidth);
+int G4ENC_initWorkspace(G4ENCIMAGE *pImage, int iWidth, int iHeight, int iBitDirection, G4ENC_WRITE_CALLBACK *pfnWrite, uint8_t *pOut, int iOutSize, void *pWorkspace, int iWorkspaceSize);
+int G4ENC_setWriteCallback(G4ENCIMAGE *pImage, G4ENC_WRITE_CALLBACK_EX *pfnWrite, void *pUser);
+int G4ENC_reset(G4ENCIMAGE *pImage, int iWidth, int iHeight, uint8_t *pOut, int iOutSize);
+int G4ENC_setPingPong(G4ENCIMAGE *pImage, uint8_t *pBuf0, uint8_t *pBuf1, int iBufSize);
+int G4ENC_releaseBuffer(G4ENCIMAGE *pImage, uint8_t *pBuf);
+int G4ENC_getLine(G4ENCIMAGE *pImage);
+int G4ENC_setFlush(G4ENCIMAGE *pImage, int iPolicy, int iValue, uint8_t *pBlockBuf);
 int G4ENC_getTIFFHeaderSize(void);
+int G4ENC_getTIFFHeaderSizeEx(G4ENCIMAGE *pImage);
 int G4ENC_getTIFFHeader(G4ENCIMAGE *pImage, uint8_t *pOut);
+int G4ENC_startTIFF(G4ENCIMAGE *pImage, G4ENC_SEEK_CALLBACK *pfnSeek);
+int G4ENC_addTIFFPage(G4ENCIMAGE *pImage, int iWidth, int iHeight);
+int G4ENC_setStrips(G4ENCIMAGE *pImage, int iRowsPerStrip, uint32_t *pStripSizes);
+int G4ENC_getStripCount(G4ENCIMAGE *pImage);
+int G4ENC_setT4(G4ENCIMAGE *pImage, int iK, int iOptions);
+int G4ENC_rowsPerStripWorstCase(int iWidth, int iMaxStripSize);
 int G4ENC_addLine(G4ENCIMAGE *pImage, uint8_t *pPixels);
+int G4ENC_addLines(G4ENCIMAGE *pImage, uint8_t *pPixels, int iPitch, int iCount);
+int G4ENC_addLineGray8(G4ENCIMAGE *pImage, uint8_t *pPixels, int iThreshold);
+int G4ENC_addLineRGB(G4ENCIMAGE *pImage, uint8_t *pPixels, int iFormat, int iThreshold);
+int G4ENC_addRunLine(G4ENCIMAGE *pImage, const G4ENC_FLIP *pRunEnds, int iCount);
+int G4ENC_encodeImage(G4ENCIMAGE *pImage, uint8_t *pPixels, int iPitch);
+int G4ENC_encodeRotated(G4ENCIMAGE *pImage, uint8_t *pPixels, int iPitch, int iOrientation);
+int G4ENC_estimateSize(G4ENCIMAGE *pImage, uint8_t *pPixels, int iPitch, int iInterval, int *pError);
+int G4ENC_saveState(G4ENCIMAGE *pImage, uint8_t *pState, int iStateSize);
+int G4ENC_restoreState(G4ENCIMAGE *pImage, const uint8_t *pState, int iStateSize);
+int G4ENC_startFrames(G4ENCIMAGE *pImage, uint8_t *pFrameBuf);
+int G4ENC_encodeFrame(G4ENCIMAGE *pImage, uint8_t *pPixels, int iPitch, int iFlags);
+int G4ENC_maxOutSize(int iWidth, int iHeight);
+#if defined( __MACH__ ) || defined( __LINUX__ )
+int G4ENC_encodeStrips(G4ENCIMAGE *pImage, uint8_t *pPixels, int iPitch, int iThreads);
+int G4ENC_poolInit(G4ENCPOOL *pPool, int iCount);
+int G4ENC_poolAcquire(G4ENCPOOL *pPool, int bWait);
+int G4ENC_poolRelease(G4ENCPOOL *pPool, int iEncoder);
+void G4ENC_poolClose(G4ENCPOOL *pPool);
+#endif
 int G4ENC_getOutSize(G4ENCIMAGE *pImage);
 void G4ENC_getOBDLine(int iWidth, uint8_t *pImage, int iLine, uint8_t *pPixels);
+void G4ENC_getOBDPage(int iWidth, uint8_t *pImage, int iPage, uint8_t *pPixels, int iPitch);
+int G4ENC_addOBDPage(G4ENCIMAGE *pImage, uint8_t *pPage);
+int G4ENC_setVerify(G4ENCIMAGE *pImage, G4DECIMAGE *pDec, int iInterval);
+#ifdef G4ENC_STATS
+int G4ENC_setStats(G4ENCIMAGE *pImage, G4ENCSTATS *pStats);
+#endif
+int G4DEC_init(G4DECIMAGE *pDec, int iWidth, int iHeight, int iBitDirection, uint8_t *pData, int iDataSize);
+int G4DEC_getWorkspaceSize(int iWidth);
+int G4DEC_initWorkspace(G4DECIMAGE *pDec, int iWidth, int iHeight, int iBitDirection, uint8_t *pData, int iDataSize, void *pWorkspace, int iWorkspaceSize);
+int G4DEC_decodeLine(G4DECIMAGE *pDec, uint8_t *pPixels);
+G4ENC_FLIP * G4DEC_getRunEnds(G4DECIMAGE *pDec);
 #endif
 
 // Due to unaligned memory causing an exception, we have to do these macros the slow way
 #define MOTOLONG(p) (((*p)<<24UL) + ((*(p+1))<<16UL) + ((*(p+2))<<8UL) + (*(p+3)))
 #define TOP_BIT 0x80000000
 #define MAX_VALUE 0xffffffff
-#define BIGUINT uint32_t
 #define LONGWHITECODEMASK 0x2000000
 #define LONGBLACKCODEMASK 0x10000000
-// Must be a 32-bit target processor
-#define REGISTER_WIDTH 32
+
+// Run-end extraction works a word at a time on CPUs with a count leading
+// zeros instruction; AVR uses the original byte at a time table method
+#if defined( __AVR__ ) && !defined( G4ENC_BYTE_RUNS )
+#define G4ENC_BYTE_RUNS
+#endif
+#ifdef G4ENC_BYTE_RUNS
+#elif defined( __LP64__ ) || defined( _WIN64 )
+#define G4RUNWORD uint64_t
+#define G4ENC_RUNWORD_CLZ(w) G4ENC_CLZ64(w)
+#define G4ENC_RUNWORD_BSWAP(w) G4ENC_BSWAP64(w)
+#else
+#define G4RUNWORD uint32_t
+#define G4ENC_RUNWORD_CLZ(w) G4ENC_CLZ32(w)
+#define G4ENC_RUNWORD_BSWAP(w) G4ENC_BSWAP32(w)
+#endif
+#if defined( __AVX2__ ) || defined( __SSE2__ )
+#include <immintrin.h>
+#elif defined( __ARM_NEON ) && defined( __aarch64__ )
+#include <arm_neon.h>
+#endif
 
 #endif // __G4ENCODER__
@@ -0,0 +1,464 @@
+//
+// G4Enc
+// A CCITT G4 / 1-bpp image encoding library
+// written by Larry Bank
+// bitbank@pobox.com
+//
+// Copyright 2022 BitBank Software, Inc. All Rights Reserved.
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===========================================================================
+//
+// Companion G4 (T.6) decoder
+// Used to check the encoder output (see G4ENC_setVerify) or to decode
+// G4 data back into 1-bpp pixels or run-ends
+// This file is included by g4enc.inl
+//
+
+/* 2D mode codes indexed by the next 7 bits (mode << 4) | code length */
+/* modes 0-6 = vertical a1 = b1+3 .. b1-3, 7 = pass, 8 = horizontal */
+/* a length of 0 is an invalid code or EOL */
+static const uint8_t g4dec_modes[128] PROGMEM = {
+    0x00,0x00,0x67,0x07,0x56,0x56,0x16,0x16,0x74,0x74,0x74,0x74,0x74,0x74,0x74,0x74,
+    0x83,0x83,0x83,0x83,0x83,0x83,0x83,0x83,0x83,0x83,0x83,0x83,0x83,0x83,0x83,0x83,
+    0x43,0x43,0x43,0x43,0x43,0x43,0x43,0x43,0x43,0x43,0x43,0x43,0x43,0x43,0x43,0x43,
+    0x23,0x23,0x23,0x23,0x23,0x23,0x23,0x23,0x23,0x23,0x23,0x23,0x23,0x23,0x23,0x23,
+    0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,
+    0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,
+    0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,
+    0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31,0x31};
+
+/* MH run length codes indexed by the next 8 bits (length << 12) | run */
+/* codes longer than 8 bits have a length of 15 and point to the second */
+/* table, which is indexed by the 4 (white) or 5 (black) bits which follow */
+static const uint16_t g4dec_white[256] PROGMEM = {
+    0x0000,0xf080,0x801d,0x801e,0x802d,0x802e,0x7016,0x7016,
+    0x7017,0x7017,0x802f,0x8030,0x600d,0x600d,0x600d,0x600d,
+    0x7014,0x7014,0x8021,0x8022,0x8023,0x8024,0x8025,0x8026,
+    0x7013,0x7013,0x801f,0x8020,0x6001,0x6001,0x6001,0x6001,
+    0x600c,0x600c,0x600c,0x600c,0x8035,0x8036,0x701a,0x701a,
+    0x8027,0x8028,0x8029,0x802a,0x802b,0x802c,0x7015,0x7015,
+    0x701c,0x701c,0x803d,0x803e,0x803f,0x8000,0x8140,0x8180,
+    0x500a,0x500a,0x500a,0x500a,0x500a,0x500a,0x500a,0x500a,
+    0x500b,0x500b,0x500b,0x500b,0x500b,0x500b,0x500b,0x500b,
+    0x701b,0x701b,0x803b,0x803c,0xf060,0xf070,0x7012,0x7012,
+    0x7018,0x7018,0x8031,0x8032,0x8033,0x8034,0x7019,0x7019,
+    0x8037,0x8038,0x8039,0x803a,0x60c0,0x60c0,0x60c0,0x60c0,
+    0x6680,0x6680,0x6680,0x6680,0x81c0,0x8200,0xf000,0x8280,
+    0x8240,0xf010,0xf020,0xf030,0xf040,0xf050,0x7100,0x7100,
+    0x4002,0x4002,0x4002,0x4002,0x4002,0x4002,0x4002,0x4002,
+    0x4002,0x4002,0x4002,0x4002,0x4002,0x4002,0x4002,0x4002,
+    0x4003,0x4003,0x4003,0x4003,0x4003,0x4003,0x4003,0x4003,
+    0x4003,0x4003,0x4003,0x4003,0x4003,0x4003,0x4003,0x4003,
+    0x5080,0x5080,0x5080,0x5080,0x5080,0x5080,0x5080,0x5080,
+    0x5008,0x5008,0x5008,0x5008,0x5008,0x5008,0x5008,0x5008,
+    0x5009,0x5009,0x5009,0x5009,0x5009,0x5009,0x5009,0x5009,
+    0x6010,0x6010,0x6010,0x6010,0x6011,0x6011,0x6011,0x6011,
+    0x4004,0x4004,0x4004,0x4004,0x4004,0x4004,0x4004,0x4004,
+    0x4004,0x4004,0x4004,0x4004,0x4004,0x4004,0x4004,0x4004,
+    0x4005,0x4005,0x4005,0x4005,0x4005,0x4005,0x4005,0x4005,
+    0x4005,0x4005,0x4005,0x4005,0x4005,0x4005,0x4005,0x4005,
+    0x600e,0x600e,0x600e,0x600e,0x600f,0x600f,0x600f,0x600f,
+    0x5040,0x5040,0x5040,0x5040,0x5040,0x5040,0x5040,0x5040,
+    0x4006,0x4006,0x4006,0x4006,0x4006,0x4006,0x4006,0x4006,
+    0x4006,0x4006,0x4006,0x4006,0x4006,0x4006,0x4006,0x4006,
+    0x4007,0x4007,0x4007,0x4007,0x4007,0x4007,0x4007,0x4007,
+    0x4007,0x4007,0x4007,0x4007,0x4007,0x4007,0x4007,0x4007};
+
+static const uint16_t g4dec_white2[144] PROGMEM = {
+    0x92c0,0x92c0,0x92c0,0x92c0,0x92c0,0x92c0,0x92c0,0x92c0,
+    0x9300,0x9300,0x9300,0x9300,0x9300,0x9300,0x9300,0x9300,
+    0x9340,0x9340,0x9340,0x9340,0x9340,0x9340,0x9340,0x9340,
+    0x9380,0x9380,0x9380,0x9380,0x9380,0x9380,0x9380,0x9380,
+    0x93c0,0x93c0,0x93c0,0x93c0,0x93c0,0x93c0,0x93c0,0x93c0,
+    0x9400,0x9400,0x9400,0x9400,0x9400,0x9400,0x9400,0x9400,
+    0x9440,0x9440,0x9440,0x9440,0x9440,0x9440,0x9440,0x9440,
+    0x9480,0x9480,0x9480,0x9480,0x9480,0x9480,0x9480,0x9480,
+    0x94c0,0x94c0,0x94c0,0x94c0,0x94c0,0x94c0,0x94c0,0x94c0,
+    0x9500,0x9500,0x9500,0x9500,0x9500,0x9500,0x9500,0x9500,
+    0x9540,0x9540,0x9540,0x9540,0x9540,0x9540,0x9540,0x9540,
+    0x9580,0x9580,0x9580,0x9580,0x9580,0x9580,0x9580,0x9580,
+    0x95c0,0x95c0,0x95c0,0x95c0,0x95c0,0x95c0,0x95c0,0x95c0,
+    0x9600,0x9600,0x9600,0x9600,0x9600,0x9600,0x9600,0x9600,
+    0x9640,0x9640,0x9640,0x9640,0x9640,0x9640,0x9640,0x9640,
+    0x96c0,0x96c0,0x96c0,0x96c0,0x96c0,0x96c0,0x96c0,0x96c0,
+    0xb700,0xb700,0xc7c0,0xc800,0xc840,0xc880,0xc8c0,0xc900,
+    0xb740,0xb740,0xb780,0xb780,0xc940,0xc980,0xc9c0,0xca00};
+
+static const uint16_t g4dec_black[256] PROGMEM = {
+    0x0000,0xf0c0,0xf080,0xf0a0,0x800d,0xf040,0xf060,0x800e,
+    0x700a,0x700a,0x700b,0x700b,0xf020,0xf000,0x700c,0x700c,
+    0x6009,0x6009,0x6009,0x6009,0x6008,0x6008,0x6008,0x6008,
+    0x5007,0x5007,0x5007,0x5007,0x5007,0x5007,0x5007,0x5007,
+    0x4006,0x4006,0x4006,0x4006,0x4006,0x4006,0x4006,0x4006,
+    0x4006,0x4006,0x4006,0x4006,0x4006,0x4006,0x4006,0x4006,
+    0x4005,0x4005,0x4005,0x4005,0x4005,0x4005,0x4005,0x4005,
+    0x4005,0x4005,0x4005,0x4005,0x4005,0x4005,0x4005,0x4005,
+    0x3001,0x3001,0x3001,0x3001,0x3001,0x3001,0x3001,0x3001,
+    0x3001,0x3001,0x3001,0x3001,0x3001,0x3001,0x3001,0x3001,
+    0x3001,0x3001,0x3001,0x3001,0x3001,0x3001,0x3001,0x3001,
+    0x3001,0x3001,0x3001,0x3001,0x3001,0x3001,0x3001,0x3001,
+    0x3004,0x3004,0x3004,0x3004,0x3004,0x3004,0x3004,0x3004,
+    0x3004,0x3004,0x3004,0x3004,0x3004,0x3004,0x3004,0x3004,
+    0x3004,0x3004,0x3004,0x3004,0x3004,0x3004,0x3004,0x3004,
+    0x3004,0x3004,0x3004,0x3004,0x3004,0x3004,0x3004,0x3004,
+    0x2003,0x2003,0x2003,0x2003,0x2003,0x2003,0x2003,0x2003,
+    0x2003,0x2003,0x2003,0x2003,0x2003,0x2003,0x2003,0x2003,
+    0x2003,0x2003,0x2003,0x2003,0x2003,0x2003,0x2003,0x2003,
+    0x2003,0x2003,0x2003,0x2003,0x2003,0x2003,0x2003,0x2003,
+    0x2003,0x2003,0x2003,0x2003,0x2003,0x2003,0x2003,0x2003,
+    0x2003,0x2003,0x2003,0x2003,0x2003,0x2003,0x2003,0x2003,
+    0x2003,0x2003,0x2003,0x2003,0x2003,0x2003,0x2003,0x2003,
+    0x2003,0x2003,0x2003,0x2003,0x2003,0x2003,0x2003,0x2003,
+    0x2002,0x2002,0x2002,0x2002,0x2002,0x2002,0x2002,0x2002,
+    0x2002,0x2002,0x2002,0x2002,0x2002,0x2002,0x2002,0x2002,
+    0x2002,0x2002,0x2002,0x2002,0x2002,0x2002,0x2002,0x2002,
+    0x2002,0x2002,0x2002,0x2002,0x2002,0x2002,0x2002,0x2002,
+    0x2002,0x2002,0x2002,0x2002,0x2002,0x2002,0x2002,0x2002,
+    0x2002,0x2002,0x2002,0x2002,0x2002,0x2002,0x2002,0x2002,
+    0x2002,0x2002,0x2002,0x2002,0x2002,0x2002,0x2002,0x2002,
+    0x2002,0x2002,0x2002,0x2002,0x2002,0x2002,0x2002,0x2002};
+
+static const uint16_t g4dec_black2[224] PROGMEM = {
+    0xb014,0xb014,0xb014,0xb014,0xc022,0xc022,0xc023,0xc023,
+    0xc024,0xc024,0xc025,0xc025,0xc026,0xc026,0xc027,0xc027,
+    0xb015,0xb015,0xb015,0xb015,0xc02a,0xc02a,0xc02b,0xc02b,
+    0xa000,0xa000,0xa000,0xa000,0xa000,0xa000,0xa000,0xa000,
+    0x900f,0x900f,0x900f,0x900f,0x900f,0x900f,0x900f,0x900f,
+    0x900f,0x900f,0x900f,0x900f,0x900f,0x900f,0x900f,0x900f,
+    0xc080,0xc080,0xc0c0,0xc0c0,0xc01a,0xc01a,0xc01b,0xc01b,
+    0xc01c,0xc01c,0xc01d,0xc01d,0xb013,0xb013,0xb013,0xb013,
+    0xb017,0xb017,0xb017,0xb017,0xc032,0xc032,0xc033,0xc033,
+    0xc02c,0xc02c,0xc02d,0xc02d,0xc02e,0xc02e,0xc02f,0xc02f,
+    0xc039,0xc039,0xc03a,0xc03a,0xc03d,0xc03d,0xc100,0xc100,
+    0xa010,0xa010,0xa010,0xa010,0xa010,0xa010,0xa010,0xa010,
+    0xa011,0xa011,0xa011,0xa011,0xa011,0xa011,0xa011,0xa011,
+    0xc030,0xc030,0xc031,0xc031,0xc03e,0xc03e,0xc03f,0xc03f,
+    0xc01e,0xc01e,0xc01f,0xc01f,0xc020,0xc020,0xc021,0xc021,
+    0xc028,0xc028,0xc029,0xc029,0xb016,0xb016,0xb016,0xb016,
+    0xa012,0xa012,0xa012,0xa012,0xa012,0xa012,0xa012,0xa012,
+    0xc034,0xc034,0xd280,0xd2c0,0xd300,0xd340,0xc037,0xc037,
+    0xc038,0xc038,0xd500,0xd540,0xd580,0xd5c0,0xc03b,0xc03b,
+    0xc03c,0xc03c,0xd600,0xd640,0xb018,0xb018,0xb018,0xb018,
+    0xb019,0xb019,0xb019,0xb019,0xd680,0xd6c0,0xc140,0xc140,
+    0xc180,0xc180,0xc1c0,0xc1c0,0xd200,0xd240,0xc035,0xc035,
+    0xc036,0xc036,0xd380,0xd3c0,0xd400,0xd440,0xd480,0xd4c0,
+    0xa040,0xa040,0xa040,0xa040,0xa040,0xa040,0xa040,0xa040,
+    0xb700,0xb700,0xb700,0xb700,0xc7c0,0xc7c0,0xc800,0xc800,
+    0xc840,0xc840,0xc880,0xc880,0xc8c0,0xc8c0,0xc900,0xc900,
+    0xb740,0xb740,0xb740,0xb740,0xb780,0xb780,0xb780,0xb780,
+    0xc940,0xc940,0xc980,0xc980,0xc9c0,0xc9c0,0xca00,0xca00};
+
+
+#define G4DEC_MODE_PASS 7
+#define G4DEC_MODE_HORIZ 8
+#define G4DEC_ESCAPE 15
+
+//
+// Bit reader; the unread bits are kept left aligned in a register sized window
+//
+typedef struct g4dec_bits_tag
+{
+const uint8_t *pData;
+int iDataSize;
+int iOff; // next byte to load into the window
+BIGUINT ulBits; // unread bits (MSB first)
+int iValid; // number of valid bits in ulBits
+uint8_t ucFillOrder;
+} G4DECBITS;
+
+#define G4DEC_FILL_BYTES ((int)sizeof(BIGUINT)/2)
+
+static void G4DECInitBits(G4DECBITS *pBits, const uint8_t *pData, int iDataSize, int iBitPos, uint8_t ucFillOrder)
+{
+    pBits->pData = pData;
+    pBits->iDataSize = iDataSize;
+    pBits->iOff = iBitPos >> 3;
+    pBits->ulBits = 0;
+    pBits->iValid = 0;
+    pBits->ucFillOrder = ucFillOrder;
+} /* G4DECInitBits() */
+//
+// Top up the window so that it holds at least half a register of bits
+// (more than the longest code); bits past the end of the data read as 0
+//
+static inline void G4DECFillBits(G4DECBITS *pBits)
+{
+BIGUINT ul;
+int i;
+
+    if (pBits->iValid > REGISTER_WIDTH/2)
+        return;
+    ul = 0;
+    if (pBits->ucFillOrder == G4ENC_MSB_FIRST && pBits->iOff + G4DEC_FILL_BYTES <= pBits->iDataSize) {
+#ifdef G4ENC_64BIT_ACCUMULATOR
+        uint32_t u32;
+        memcpy(&u32, &pBits->pData[pBits->iOff], sizeof(uint32_t));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        u32 = G4ENC_BSWAP32(u32);
+#endif
+        ul = u32;
+#else
+        ul = (pBits->pData[pBits->iOff] << 8) | pBits->pData[pBits->iOff+1];
+#endif
+    } else { // end of the data or reversed bits
+        for (i=0; i<G4DEC_FILL_BYTES; i++) {
+            ul <<= 8;
+            if (pBits->iOff + i < pBits->iDataSize)
+                ul |= (pBits->ucFillOrder == G4ENC_MSB_FIRST) ? pBits->pData[pBits->iOff+i] : ucMirror[pBits->pData[pBits->iOff+i]];
+        }
+    }
+    pBits->ulBits |= ul << (REGISTER_WIDTH/2 - pBits->iValid);
+    pBits->iValid += REGISTER_WIDTH/2;
+    pBits->iOff += G4DEC_FILL_BYTES;
+} /* G4DECFillBits() */
+//
+// Returns the current bit offset in the data
+//
+static inline int G4DECBitPos(G4DECBITS *pBits)
+{
+    return (pBits->iOff * 8) - pBits->iValid;
+} /* G4DECBitPos() */
+//
+// Decode a MH run length (make-up codes + terminating code)
+// Returns -1 for an invalid code
+//
+static inline int G4DECGetRun(G4DECBITS *pBits, const uint16_t *pTable, const uint16_t *pTable2, int iExtraBits)
+{
+int iRun, iLen, iVal;
+uint16_t u16;
+
+    iRun = 0;
+    do {
+        G4DECFillBits(pBits);
+        u16 = pgm_read_word(&pTable[pBits->ulBits >> (REGISTER_WIDTH - 8)]);
+        if ((u16 >> 12) == G4DEC_ESCAPE) // longer code; look at the bits which follow
+            u16 = pgm_read_word(&pTable2[(u16 & 0xfff) + ((pBits->ulBits << 8) >> (REGISTER_WIDTH - iExtraBits))]);
+        iLen = u16 >> 12;
+        if (iLen == 0) // invalid code or EOL
+            return -1;
+        pBits->ulBits <<= iLen;
+        pBits->iValid -= iLen;
+        iVal = u16 & 0xfff;
+        iRun += iVal;
+    } while (iVal >= 64); // make-up codes are followed by more codes
+    return iRun;
+} /* G4DECGetRun() */
+//
+// Decode one line of G4 data into run-ends (the same format the encoder uses)
+// pRef holds the run-ends of the reference (previous) line
+// Returns G4ENC_SUCCESS or G4ENC_DECODE_ERROR
+//
+static int G4DECDecodeFlips(const uint8_t *pData, int iDataSize, int *pBitPos, uint8_t ucFillOrder, G4ENC_FLIP *pRef, G4ENC_FLIP *pCur, int xsize)
+{
+int a0, a1, a2, b1, b2;
+int iCur, iRef, iRun, iRun2, iMode;
+G4DECBITS bits;
+uint8_t uc;
+
+    G4DECInitBits(&bits, pData, iDataSize, *pBitPos, ucFillOrder);
+    G4DECFillBits(&bits);
+    bits.ulBits <<= (*pBitPos & 7); // start in the middle of a byte
+    bits.iValid -= (*pBitPos & 7);
+    a0 = 0;
+    iCur = iRef = 0;
+    while (a0 < xsize) {
+        G4DECFillBits(&bits);
+        if (iCur >= xsize + 2 || G4DECBitPos(&bits) >= iDataSize * 8) // runaway or out of data
+            return G4ENC_DECODE_ERROR;
+        b1 = pRef[iRef];
+        b2 = pRef[iRef+1];
+        if ((bits.ulBits >> (REGISTER_WIDTH - 1)) != 0) { // V0 is by far the most common code
+            iMode = 3;
+            uc = 1;
+        } else {
+            uc = pgm_read_byte(&g4dec_modes[bits.ulBits >> (REGISTER_WIDTH - 7)]);
+            if ((uc & 0xf) == 0)
+                return G4ENC_DECODE_ERROR;
+            iMode = uc >> 4;
+            uc &= 0xf;
+        }
+        bits.ulBits <<= uc;
+        bits.iValid -= uc;
+        if (iMode == G4DEC_MODE_PASS) {
+            if (b2 >= xsize)
+                return G4ENC_DECODE_ERROR;
+            a0 = b2;
+            iRef += 2;
+        } else if (iMode == G4DEC_MODE_HORIZ) {
+            if (iCur & 1) { // currently black
+                iRun = G4DECGetRun(&bits, g4dec_black, g4dec_black2, 5);
+                iRun2 = G4DECGetRun(&bits, g4dec_white, g4dec_white2, 4);
+            } else {
+                iRun = G4DECGetRun(&bits, g4dec_white, g4dec_white2, 4);
+                iRun2 = G4DECGetRun(&bits, g4dec_black, g4dec_black2, 5);
+            }
+            a1 = a0 + iRun;
+            a2 = a1 + iRun2;
+            if ((iRun | iRun2) < 0 || a2 > xsize)
+                return G4ENC_DECODE_ERROR;
+            pCur[iCur++] = (G4ENC_FLIP)a1;
+            pCur[iCur++] = (G4ENC_FLIP)a2;
+            a0 = a2;
+            if (a0 != xsize) {
+                while (pRef[iRef] != xsize && pRef[iRef] <= a0)
+                    iRef += 2;
+            }
+        } else { // vertical mode
+            a1 = b1 + 3 - iMode;
+            if (a1 < a0 || a1 > xsize)
+                return G4ENC_DECODE_ERROR;
+            pCur[iCur++] = (G4ENC_FLIP)a1;
+            a0 = a1;
+            if (a0 != xsize) {
+                if (iRef != 0)
+                    iRef -= 2;
+                iRef++; /* Skip a color change in cur and ref */
+                while (pRef[iRef] <= a0 && pRef[iRef] != xsize)
+                    iRef += 2;
+            }
+        }
+    } /* while a0 < xsize */
+    pCur[iCur++] = xsize; // terminate the line the same way as the encoder
+    pCur[iCur++] = xsize;
+    pCur[iCur++] = xsize;
+    pCur[iCur] = xsize;
+    *pBitPos = G4DECBitPos(&bits);
+    return G4ENC_SUCCESS;
+} /* G4DECDecodeFlips() */
+//
+// Draw the black runs of a line of run-ends as 1-bpp pixels (1 = white)
+//
+static void G4DECDrawLine(G4ENC_FLIP *pFlips, uint8_t *pPixels, int xsize)
+{
+int i, x1, x2;
+uint8_t ucMask;
+
+    memset(pPixels, 0xff, (xsize + 7) >> 3);
+    for (i=0; pFlips[i] < xsize; i+=2) {
+        x1 = pFlips[i];
+        x2 = pFlips[i+1];
+        if (x2 > xsize)
+            x2 = xsize;
+        while (x1 < x2 && (x1 & 7)) { // leading partial byte
+            pPixels[x1 >> 3] &= ~(0x80 >> (x1 & 7));
+            x1++;
+        }
+        if (x2 - x1 >= 8) { // whole bytes
+            memset(&pPixels[x1 >> 3], 0, (x2 - x1) >> 3);
+            x1 += (x2 - x1) & ~7;
+        }
+        if (x1 < x2) { // trailing partial byte
+            ucMask = (uint8_t)(0xff00 >> (x2 - x1));
+            pPixels[x1 >> 3] &= ~(ucMask >> (x1 & 7));
+        }
+    }
+} /* G4DECDrawLine() */
+//
+// Common setup of the decoder state
+//
+static int G4DECInitState(G4DECIMAGE *pDec, int iWidth, int iHeight, int iBitDirection, uint8_t *pData, int iDataSize, G4ENC_FLIP *pCur, G4ENC_FLIP *pRef)
+{
+    if (iWidth <= 0 || iWidth > G4ENC_FLIP_MAX_WIDTH || iHeight <= 0 || iDataSize < 0 || (iBitDirection != G4ENC_LSB_FIRST && iBitDirection != G4ENC_MSB_FIRST))
+        return G4ENC_INVALID_PARAMETER;
+    pDec->iWidth = iWidth;
+    pDec->iHeight = iHeight;
+    pDec->ucFillOrder = (uint8_t)iBitDirection;
+    pDec->pData = pData;
+    pDec->iDataSize = iDataSize;
+    pDec->iBitPos = 0;
+    pDec->y = 0;
+    pDec->pCur = pCur;
+    pDec->pRef = pRef;
+    for (int i=0; i<4; i++) { // the first line refers to an imaginary white line
+        pRef[i] = iWidth;
+        pCur[i] = iWidth;
+    }
+    pDec->iError = G4ENC_SUCCESS;
+    return G4ENC_SUCCESS;
+} /* G4DECInitState() */
+//
+// Initialize the decoder to read iDataSize bytes of G4 data
+// Uses the buffers inside G4DECIMAGE, so the width is limited to G4ENC_MAX_WIDTH
+// pData can be NULL if the decoder is only used to verify the encoder output
+//
+int G4DEC_init(G4DECIMAGE *pDec, int iWidth, int iHeight, int iBitDirection, uint8_t *pData, int iDataSize)
+{
+    if (pDec == NULL || iWidth > G4ENC_MAX_WIDTH)
+        return G4ENC_INVALID_PARAMETER;
+#if G4ENC_MAX_WIDTH > 0
+    return G4DECInitState(pDec, iWidth, iHeight, iBitDirection, pData, iDataSize, pDec->CurFlips, pDec->RefFlips);
+#else
+    (void)iHeight; (void)iBitDirection; (void)pData; (void)iDataSize;
+    return G4ENC_INVALID_PARAMETER; // built-in buffers were compiled out
+#endif
+} /* G4DEC_init() */
+//
+// Returns the number of bytes of workspace needed by G4DEC_initWorkspace()
+//
+int G4DEC_getWorkspaceSize(int iWidth)
+{
+    if (iWidth <= 0 || iWidth > G4ENC_FLIP_MAX_WIDTH)
+        return 0;
+    return (2 * G4ENC_FLIP_COUNT(iWidth) * (int)sizeof(G4ENC_FLIP)) + (int)sizeof(uint32_t);
+} /* G4DEC_getWorkspaceSize() */
+//
+// Initialize the decoder with a caller supplied workspace for the run-ends
+// (removes the G4ENC_MAX_WIDTH limit)
+//
+int G4DEC_initWorkspace(G4DECIMAGE *pDec, int iWidth, int iHeight, int iBitDirection, uint8_t *pData, int iDataSize, void *pWorkspace, int iWorkspaceSize)
+{
+    G4ENC_FLIP *pFlips;
+
+    if (pDec == NULL || pWorkspace == NULL || G4DEC_getWorkspaceSize(iWidth) == 0 || iWorkspaceSize < G4DEC_getWorkspaceSize(iWidth))
+        return G4ENC_INVALID_PARAMETER;
+    pFlips = (G4ENC_FLIP *)(((uintptr_t)pWorkspace + sizeof(uint32_t) - 1) & ~(uintptr_t)(sizeof(uint32_t) - 1));
+    return G4DECInitState(pDec, iWidth, iHeight, iBitDirection, pData, iDataSize, pFlips, &pFlips[G4ENC_FLIP_COUNT(iWidth)]);
+} /* G4DEC_initWorkspace() */
+//
+// Decode the next line of the image
+// If pPixels is not NULL, the line is drawn there as 1-bpp pixels (MSB first, 1 = white)
+// The run-ends of the line are available from G4DEC_getRunEnds() until the next call
+// Returns G4ENC_SUCCESS for each line and G4ENC_IMAGE_COMPLETE for the last line
+//
+int G4DEC_decodeLine(G4DECIMAGE *pDec, uint8_t *pPixels)
+{
+    G4ENC_FLIP *pTemp;
+    int iErr;
+
+    if (pDec == NULL || pDec->pData == NULL)
+        return G4ENC_INVALID_PARAMETER;
+    if (pDec->iError != G4ENC_SUCCESS)
+        return pDec->iError;
+    if (pDec->y >= pDec->iHeight)
+        return G4ENC_IMAGE_COMPLETE;
+    iErr = G4DECDecodeFlips(pDec->pData, pDec->iDataSize, &pDec->iBitPos, pDec->ucFillOrder, pDec->pRef, pDec->pCur, pDec->iWidth);
+    if (iErr != G4ENC_SUCCESS) {
+        pDec->iError = iErr;
+        return iErr;
+    }
+    if (pPixels)
+        G4DECDrawLine(pDec->pCur, pPixels, pDec->iWidth);
+    pTemp = pDec->pCur; // the new line becomes the reference line
+    pDec->pCur = pDec->pRef;
+    pDec->pRef = pTemp;
+    pDec->y++;
+    return (pDec->y == pDec->iHeight) ? G4ENC_IMAGE_COMPLETE : G4ENC_SUCCESS;
+} /* G4DEC_decodeLine() */
+//
+// Returns the run-ends of the most recently decoded line
+// (the positions where the color changes, terminated by the image width)
+//
+G4ENC_FLIP * G4DEC_getRunEnds(G4DECIMAGE *pDec)
+{
+    if (pDec == NULL)
+        return NULL;
+    return pDec->pRef;
+} /* G4DEC_getRunEnds() */
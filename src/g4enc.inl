@@ -20,6 +20,7 @@
 //
 #include "G4ENCODER.h"
 
+#ifdef G4ENC_BYTE_RUNS
 /* Number of consecutive 1 bits in a byte from MSB to LSB */
 static uint8_t bitcount[256] =
         {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,  /* 0-15 */
@@ -38,65 +39,71 @@ static uint8_t bitcount[256] =
          2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,  /* 208-223 */
          3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,  /* 224-239 */
          4,4,4,4,4,4,4,4,5,5,5,5,6,6,7,8}; /* 240-255 */
+#endif // G4ENC_BYTE_RUNS
 
-/* Table of vertical codes for G4 encoding */
-/* code followed by length, starting with v(-3) */
-static const uint8_t vtable[14] =
-        {3,7,     /* V(-3) = 0000011 */
-         3,6,     /* V(-2) = 000011  */
-         3,3,     /* V(-1) = 011     */
-         1,1,     /* V(0)  = 1       */
-         2,3,     /* V(1)  = 010     */
-         2,6,     /* V(2)  = 000010  */
-         2,7};    /* V(3)  = 0000010 */
+/* All of the code tables are packed as (length << 8) | code */
+/* every code value fits in 8 bits, so one 16-bit read gives both */
+#define G4ENC_MH(code, len) (((len) << 8) | (code))
+#define G4ENC_MH_CODE(u) ((u) & 0xff)
+#define G4ENC_MH_LEN(u) ((u) >> 8)
+
+/* Table of vertical codes for G4 encoding, starting with v(-3) */
+static const uint16_t vtable[7] =
+        {G4ENC_MH(3,7),     /* V(-3) = 0000011 */
+         G4ENC_MH(3,6),     /* V(-2) = 000011  */
+         G4ENC_MH(3,3),     /* V(-1) = 011     */
+         G4ENC_MH(1,1),     /* V(0)  = 1       */
+         G4ENC_MH(2,3),     /* V(1)  = 010     */
+         G4ENC_MH(2,6),     /* V(2)  = 000010  */
+         G4ENC_MH(2,7)};    /* V(3)  = 0000010 */
 
 /* Group 3 Huffman codes ordered for MH encoding */
-/* first, the terminating codes for white (code, length) */
-static const short huff_white[128] =
-        {0x35,8,7,6,7,4,8,4,0xb,4, /* 0,1,2,3,4 */
-         0xc,4,0xe,4,0xf,4,0x13,5,0x14,5,7,5,8,5, /* 5,6,7,8,9,10,11 */
-         8,6,3,6,0x34,6,0x35,6,0x2a,6,0x2b,6,0x27,7, /* 12,13,14,15,16,17,18 */
-         0xc,7,8,7,0x17,7,3,7,4,7,0x28,7,0x2b,7, /* 19,20,21,22,23,24,25 */
-         0x13,7,0x24,7,0x18,7,2,8,3,8,0x1a,8,0x1b,8, /* 26,27,28,29,30,31,32 */
-         0x12,8,0x13,8,0x14,8,0x15,8,0x16,8,0x17,8,0x28,8, /* 33,34,35,36,37,38,39 */
-         0x29,8,0x2a,8,0x2b,8,0x2c,8,0x2d,8,4,8,5,8, /* 40,41,42,43,44,45,46 */
-         0xa,8,0xb,8,0x52,8,0x53,8,0x54,8,0x55,8,0x24,8, /* 47,48,49,50,51,52,53 */
-         0x25,8,0x58,8,0x59,8,0x5a,8,0x5b,8,0x4a,8,0x4b,8, /* 54,55,56,57,58,59,60 */
-         0x32,8,0x33,8,0x34,8};                        /* 61,62,63 */
+/* first, the terminating codes for white */
+static const uint16_t huff_white[64] =
+        {G4ENC_MH(0x35,8),G4ENC_MH(7,6),G4ENC_MH(7,4),G4ENC_MH(8,4),G4ENC_MH(0xb,4), /* 0,1,2,3,4 */
+         G4ENC_MH(0xc,4),G4ENC_MH(0xe,4),G4ENC_MH(0xf,4),G4ENC_MH(0x13,5),G4ENC_MH(0x14,5),G4ENC_MH(7,5),G4ENC_MH(8,5), /* 5,6,7,8,9,10,11 */
+         G4ENC_MH(8,6),G4ENC_MH(3,6),G4ENC_MH(0x34,6),G4ENC_MH(0x35,6),G4ENC_MH(0x2a,6),G4ENC_MH(0x2b,6),G4ENC_MH(0x27,7), /* 12,13,14,15,16,17,18 */
+         G4ENC_MH(0xc,7),G4ENC_MH(8,7),G4ENC_MH(0x17,7),G4ENC_MH(3,7),G4ENC_MH(4,7),G4ENC_MH(0x28,7),G4ENC_MH(0x2b,7), /* 19,20,21,22,23,24,25 */
+         G4ENC_MH(0x13,7),G4ENC_MH(0x24,7),G4ENC_MH(0x18,7),G4ENC_MH(2,8),G4ENC_MH(3,8),G4ENC_MH(0x1a,8),G4ENC_MH(0x1b,8), /* 26,27,28,29,30,31,32 */
+         G4ENC_MH(0x12,8),G4ENC_MH(0x13,8),G4ENC_MH(0x14,8),G4ENC_MH(0x15,8),G4ENC_MH(0x16,8),G4ENC_MH(0x17,8),G4ENC_MH(0x28,8), /* 33,34,35,36,37,38,39 */
+         G4ENC_MH(0x29,8),G4ENC_MH(0x2a,8),G4ENC_MH(0x2b,8),G4ENC_MH(0x2c,8),G4ENC_MH(0x2d,8),G4ENC_MH(4,8),G4ENC_MH(5,8), /* 40,41,42,43,44,45,46 */
+         G4ENC_MH(0xa,8),G4ENC_MH(0xb,8),G4ENC_MH(0x52,8),G4ENC_MH(0x53,8),G4ENC_MH(0x54,8),G4ENC_MH(0x55,8),G4ENC_MH(0x24,8), /* 47,48,49,50,51,52,53 */
+         G4ENC_MH(0x25,8),G4ENC_MH(0x58,8),G4ENC_MH(0x59,8),G4ENC_MH(0x5a,8),G4ENC_MH(0x5b,8),G4ENC_MH(0x4a,8),G4ENC_MH(0x4b,8), /* 54,55,56,57,58,59,60 */
+         G4ENC_MH(0x32,8),G4ENC_MH(0x33,8),G4ENC_MH(0x34,8)};                      /* 61,62,63 */
 
 /* now the white make-up codes */
-static const short huff_wmuc[82] =
-       {0,0,0x1b,5,0x12,5,0x17,6,0x37,7,0x36,8,   /* null,64,128,192,256,320 */
-        0x37,8,0x64,8,0x65,8,0x68,8,0x67,8,0xcc,9, /* 384,448,512,576,640,704 */
-        0xcd,9,0xd2,9,0xd3,9,0xd4,9,0xd5,9,    /* 768,832,896,960,1024 */
-        0xd6,9,0xd7,9,0xd8,9,0xd9,9,0xda,9,    /* 1088,1152,1216,1280,1344 */
-        0xdb,9,0x98,9,0x99,9,0x9a,9,0x18,6,    /* 1408,1472,1536,1600,1664 */
-        0x9b,9,8,11,0xc,11,0xd,11,0x12,12,     /* 1728,1792,1856,1920,1984 */
-        0x13,12,0x14,12,0x15,12,0x16,12,0x17,12, /* 2048,2112,2176,2240,2304 */
-        0x1c,12,0x1d,12,0x1e,12,0x1f,12};       /* 2368,2432,2496,2560 */
+static const uint16_t huff_wmuc[41] =
+       {G4ENC_MH(0,0),G4ENC_MH(0x1b,5),G4ENC_MH(0x12,5),G4ENC_MH(0x17,6),G4ENC_MH(0x37,7),G4ENC_MH(0x36,8), /* null,64,128,192,256,320 */
+        G4ENC_MH(0x37,8),G4ENC_MH(0x64,8),G4ENC_MH(0x65,8),G4ENC_MH(0x68,8),G4ENC_MH(0x67,8),G4ENC_MH(0xcc,9), /* 384,448,512,576,640,704 */
+        G4ENC_MH(0xcd,9),G4ENC_MH(0xd2,9),G4ENC_MH(0xd3,9),G4ENC_MH(0xd4,9),G4ENC_MH(0xd5,9), /* 768,832,896,960,1024 */
+        G4ENC_MH(0xd6,9),G4ENC_MH(0xd7,9),G4ENC_MH(0xd8,9),G4ENC_MH(0xd9,9),G4ENC_MH(0xda,9), /* 1088,1152,1216,1280,1344 */
+        G4ENC_MH(0xdb,9),G4ENC_MH(0x98,9),G4ENC_MH(0x99,9),G4ENC_MH(0x9a,9),G4ENC_MH(0x18,6), /* 1408,1472,1536,1600,1664 */
+        G4ENC_MH(0x9b,9),G4ENC_MH(8,11),G4ENC_MH(0xc,11),G4ENC_MH(0xd,11),G4ENC_MH(0x12,12), /* 1728,1792,1856,1920,1984 */
+        G4ENC_MH(0x13,12),G4ENC_MH(0x14,12),G4ENC_MH(0x15,12),G4ENC_MH(0x16,12),G4ENC_MH(0x17,12), /* 2048,2112,2176,2240,2304 */
+        G4ENC_MH(0x1c,12),G4ENC_MH(0x1d,12),G4ENC_MH(0x1e,12),G4ENC_MH(0x1f,12)};     /* 2368,2432,2496,2560 */
 
 /* black terminating codes */
-static const short huff_black[128] =
-      {0x37,10,2,3,3,2,2,2,3,3,                         /* 0,1,2,3,4 */
-       3,4,2,4,3,5,5,6,4,6,4,7,5,7,                     /* 5,6,7,8,9,10,11 */
-       7,7,4,8,7,8,0x18,9,0x17,10,0x18,10,8,10,         /* 12,13,14,15,16,17,18 */
-       0x67,11,0x68,11,0x6c,11,0x37,11,0x28,11,0x17,11, /* 19,20,21,22,23,24 */
-       0x18,11,0xca,12,0xcb,12,0xcc,12,0xcd,12,0x68,12, /* 25,26,27,28,29,30 */
-       0x69,12,0x6a,12,0x6b,12,0xd2,12,0xd3,12,0xd4,12, /* 31,32,33,34,35,36 */
-       0xd5,12,0xd6,12,0xd7,12,0x6c,12,0x6d,12,0xda,12, /* 37,38,39,40,41,42 */
-       0xdb,12,0x54,12,0x55,12,0x56,12,0x57,12,0x64,12, /* 43,44,45,46,47,48 */
-       0x65,12,0x52,12,0x53,12,0x24,12,0x37,12,0x38,12, /* 49,50,51,52,53,54 */
-       0x27,12,0x28,12,0x58,12,0x59,12,0x2b,12,0x2c,12, /* 55,56,57,58,59,60 */
-       0x5a,12,0x66,12,0x67,12};                        /* 61,62,63 */
+static const uint16_t huff_black[64] =
+      {G4ENC_MH(0x37,10),G4ENC_MH(2,3),G4ENC_MH(3,2),G4ENC_MH(2,2),G4ENC_MH(3,3), /* 0,1,2,3,4 */
+       G4ENC_MH(3,4),G4ENC_MH(2,4),G4ENC_MH(3,5),G4ENC_MH(5,6),G4ENC_MH(4,6),G4ENC_MH(4,7),G4ENC_MH(5,7), /* 5,6,7,8,9,10,11 */
+       G4ENC_MH(7,7),G4ENC_MH(4,8),G4ENC_MH(7,8),G4ENC_MH(0x18,9),G4ENC_MH(0x17,10),G4ENC_MH(0x18,10),G4ENC_MH(8,10), /* 12,13,14,15,16,17,18 */
+       G4ENC_MH(0x67,11),G4ENC_MH(0x68,11),G4ENC_MH(0x6c,11),G4ENC_MH(0x37,11),G4ENC_MH(0x28,11),G4ENC_MH(0x17,11), /* 19,20,21,22,23,24 */
+       G4ENC_MH(0x18,11),G4ENC_MH(0xca,12),G4ENC_MH(0xcb,12),G4ENC_MH(0xcc,12),G4ENC_MH(0xcd,12),G4ENC_MH(0x68,12), /* 25,26,27,28,29,30 */
+       G4ENC_MH(0x69,12),G4ENC_MH(0x6a,12),G4ENC_MH(0x6b,12),G4ENC_MH(0xd2,12),G4ENC_MH(0xd3,12),G4ENC_MH(0xd4,12), /* 31,32,33,34,35,36 */
+       G4ENC_MH(0xd5,12),G4ENC_MH(0xd6,12),G4ENC_MH(0xd7,12),G4ENC_MH(0x6c,12),G4ENC_MH(0x6d,12),G4ENC_MH(0xda,12), /* 37,38,39,40,41,42 */
+       G4ENC_MH(0xdb,12),G4ENC_MH(0x54,12),G4ENC_MH(0x55,12),G4ENC_MH(0x56,12),G4ENC_MH(0x57,12),G4ENC_MH(0x64,12), /* 43,44,45,46,47,48 */
+       G4ENC_MH(0x65,12),G4ENC_MH(0x52,12),G4ENC_MH(0x53,12),G4ENC_MH(0x24,12),G4ENC_MH(0x37,12),G4ENC_MH(0x38,12), /* 49,50,51,52,53,54 */
+       G4ENC_MH(0x27,12),G4ENC_MH(0x28,12),G4ENC_MH(0x58,12),G4ENC_MH(0x59,12),G4ENC_MH(0x2b,12),G4ENC_MH(0x2c,12), /* 55,56,57,58,59,60 */
+       G4ENC_MH(0x5a,12),G4ENC_MH(0x66,12),G4ENC_MH(0x67,12)};                      /* 61,62,63 */
 /* black make up codes */
-static const short huff_bmuc[82] =
-       {0,0,0xf,10,0xc8,12,0xc9,12,0x5b,12,0x33,12, /* null,64,128,192,256,320 */
-        0x34,12,0x35,12,0x6c,13,0x6d,13,0x4a,13,0x4b,13,   /* 384,448,512,576,640,704 */
-        0x4c,13,0x4d,13,0x72,13,0x73,13,0x74,13,0x75,13,   /* 768,832,896,960,1024,1088 */
-        0x76,13,0x77,13,0x52,13,0x53,13,0x54,13,0x55,13,   /* 1152,1216,1280,1344,1408,1472 */
-        0x5a,13,0x5b,13,0x64,13,0x65,13,8,11,0xc,11,       /* 1536,1600,1664,1728,1792,1856 */
-        0xd,11,0x12,12,0x13,12,0x14,12,0x15,12,0x16,12,    /* 1920,1984,2048,2112,2176,2240 */
-        0x17,12,0x1c,12,0x1d,12,0x1e,12,0x1f,12};          /* 2304,2368,2432,2496,2560 */
+static const uint16_t huff_bmuc[41] =
+       {G4ENC_MH(0,0),G4ENC_MH(0xf,10),G4ENC_MH(0xc8,12),G4ENC_MH(0xc9,12),G4ENC_MH(0x5b,12),G4ENC_MH(0x33,12), /* null,64,128,192,256,320 */
+        G4ENC_MH(0x34,12),G4ENC_MH(0x35,12),G4ENC_MH(0x6c,13),G4ENC_MH(0x6d,13),G4ENC_MH(0x4a,13),G4ENC_MH(0x4b,13), /* 384,448,512,576,640,704 */
+        G4ENC_MH(0x4c,13),G4ENC_MH(0x4d,13),G4ENC_MH(0x72,13),G4ENC_MH(0x73,13),G4ENC_MH(0x74,13),G4ENC_MH(0x75,13), /* 768,832,896,960,1024,1088 */
+        G4ENC_MH(0x76,13),G4ENC_MH(0x77,13),G4ENC_MH(0x52,13),G4ENC_MH(0x53,13),G4ENC_MH(0x54,13),G4ENC_MH(0x55,13), /* 1152,1216,1280,1344,1408,1472 */
+        G4ENC_MH(0x5a,13),G4ENC_MH(0x5b,13),G4ENC_MH(0x64,13),G4ENC_MH(0x65,13),G4ENC_MH(8,11),G4ENC_MH(0xc,11), /* 1536,1600,1664,1728,1792,1856 */
+        G4ENC_MH(0xd,11),G4ENC_MH(0x12,12),G4ENC_MH(0x13,12),G4ENC_MH(0x14,12),G4ENC_MH(0x15,12),G4ENC_MH(0x16,12), /* 1920,1984,2048,2112,2176,2240 */
+        G4ENC_MH(0x17,12),G4ENC_MH(0x1c,12),G4ENC_MH(0x1d,12),G4ENC_MH(0x1e,12),G4ENC_MH(0x1f,12)};        /* 2304,2368,2432,2496,2560 */
 
 /* Table of byte flip values to mirror-image incoming CCITT data */
 static const uint8_t ucMirror[256] =
@@ -119,11 +126,49 @@ static const uint8_t ucMirror[256] =
 
 const char *SOFTWARE = "Created with G4ENCODER by Larry Bank";
 
-static void G4ENCInsertCode(BUFFERED_BITS *bb, BIGUINT ulCode, int iLen)
+#include "g4dec.inl"
+
+//
+// Write the accumulator to the output in big-endian order
+// memcpy() keeps this safe on CPUs which fault on unaligned stores
+// and compiles to a single store on those which don't
+//
+static inline void G4ENCStoreBits(uint8_t *pBuf, BIGUINT ulBits)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    ulBits = G4ENC_BSWAP(ulBits);
+#endif
+    memcpy(pBuf, &ulBits, sizeof(BIGUINT));
+} /* G4ENCStoreBits() */
+//
+// Mirror the bits within each byte of the accumulator
+// this is how LSB first (FillOrder=2) output is generated without a
+// second pass over the data; a few shifts and masks per accumulator store
+// instead of a table lookup per byte
+//
+static inline BIGUINT G4ENCMirrorBits(BIGUINT u)
+{
+#ifdef G4ENC_BITREV // e.g. ARM RBIT
+    return G4ENC_BSWAP(G4ENC_BITREV(u));
+#else
+    u = ((u >> 1) & (BIGUINT)0x5555555555555555ULL) | ((u & (BIGUINT)0x5555555555555555ULL) << 1);
+    u = ((u >> 2) & (BIGUINT)0x3333333333333333ULL) | ((u & (BIGUINT)0x3333333333333333ULL) << 2);
+    return ((u >> 4) & (BIGUINT)0x0f0f0f0f0f0f0f0fULL) | ((u & (BIGUINT)0x0f0f0f0f0f0f0f0fULL) << 4);
+#endif
+} /* G4ENCMirrorBits() */
+//
+// Write the accumulator in the selected bit order
+//
+static inline void G4ENCSpillBits(BUFFERED_BITS *bb)
+{
+    G4ENCStoreBits(bb->pBuf, (bb->ulMirror) ? G4ENCMirrorBits(bb->ulBits) : bb->ulBits);
+} /* G4ENCSpillBits() */
+
+static inline void G4ENCInsertCode(BUFFERED_BITS *bb, BIGUINT ulCode, int iLen)
 {
     if ((bb->ulBitOff + iLen) > REGISTER_WIDTH) { // need to write data
         bb->ulBits |= (ulCode >> (bb->ulBitOff + iLen - REGISTER_WIDTH)); // partial bits on first word
-        *(BIGUINT *)bb->pBuf = __builtin_bswap32(bb->ulBits);
+        G4ENCSpillBits(bb);
         bb->pBuf += sizeof(BIGUINT);
         bb->ulBits = ulCode << ((REGISTER_WIDTH*2) - (bb->ulBitOff + iLen));
         bb->ulBitOff += iLen - REGISTER_WIDTH;
@@ -134,118 +179,572 @@ static void G4ENCInsertCode(BUFFERED_BITS *bb, BIGUINT ulCode, int iLen)
 } /* G4ENCInsertCode() */
 //
 // Flush any buffered bits to the output
+// The whole accumulator is written with a single store and the output
+// pointer advances past the complete bytes plus one more (partial or empty) byte.
+// Up to sizeof(BIGUINT) bytes past the end of the data may be written.
 //
 void G4ENCFlushBits(BUFFERED_BITS *bb)
 {
-    while (bb->ulBitOff >= 8)
-    {
-        *bb->pBuf++ = (unsigned char) (bb->ulBits >> (REGISTER_WIDTH - 8));
-        bb->ulBits <<= 8;
-        bb->ulBitOff -= 8;
-    }
-   *bb->pBuf++ = (unsigned char) (bb->ulBits >> (REGISTER_WIDTH - 8));
-   bb->ulBitOff = 0;
-   bb->ulBits = 0;
+int iBytes;
+
+    iBytes = (int)(bb->ulBitOff >> 3) + 1;
+    G4ENCSpillBits(bb);
+    if (iBytes > (int)sizeof(BIGUINT)) // the accumulator was full
+        bb->pBuf[sizeof(BIGUINT)] = 0;
+    bb->pBuf += iBytes;
+    bb->ulBitOff = 0;
+    bb->ulBits = 0;
 } /* G4ENCFlushBits() */
 //
+// Move the complete bytes of the accumulator to the output
+// (the bits of a partial byte stay in the accumulator)
+//
+static void G4ENCPushBytes(BUFFERED_BITS *bb)
+{
+int iBytes = (int)(bb->ulBitOff >> 3);
+
+    if (iBytes == 0)
+        return;
+    G4ENCSpillBits(bb);
+    bb->pBuf += iBytes;
+    bb->ulBits = (iBytes < (int)sizeof(BIGUINT)) ? (bb->ulBits << (iBytes * 8)) : 0;
+    bb->ulBitOff &= 7;
+} /* G4ENCPushBytes() */
+//
+// Look up the code for a run of less than 2560 pixels
+// The make-up code (if any) and the terminating code are joined
+// into a single code of up to 25 bits so that the run costs one insert
+//
+static inline int G4ENCRunCode(int iLen, const uint16_t *pTerm, const uint16_t *pMakeup, uint32_t *pulCode)
+{
+uint32_t u, ulCode;
+int iBits;
+
+    u = pTerm[iLen & 63];
+    ulCode = G4ENC_MH_CODE(u);
+    iBits = G4ENC_MH_LEN(u);
+    if (iLen >= 64) { /* Makeup code = mult of 64 */
+        u = pMakeup[iLen >> 6];
+        ulCode |= G4ENC_MH_CODE(u) << iBits;
+        iBits += G4ENC_MH_LEN(u);
+    }
+    *pulCode = ulCode;
+    return iBits;
+} /* G4ENCRunCode() */
+//
 // Internal function to add a WHITE pixel run
 //
 void G4ENCAddWhite(int iLen, BUFFERED_BITS *bb)
 {
-//    int iOldLen = iLen;
-//    int iBitLen = 0;
-while (iLen >= 64)
-   {
-       if (iLen >= 2560)
-    {
+uint32_t ulCode;
+int iBits;
+
+    while (iLen >= 2560) {
         G4ENCInsertCode(bb, 0x1f, 12); /* Add the 2560 code */
         iLen -= 2560;
-//        iBitLen += 12;
     }
-    else
-      {
-      int iCode;
-      iCode = iLen >> 6; /* Makeup code = mult of 64 */
-          G4ENCInsertCode(bb, huff_wmuc[iCode*2], huff_wmuc[iCode*2+1]);
- //         iBitLen += huff_wmuc[iCode*2+1];
-      iLen &= 63; /* Get the remainder */
-      }
-   }
-   /* Add the terminating code */
-    G4ENCInsertCode(bb, huff_white[iLen*2], huff_white[iLen*2+1]);
- //   iBitLen += huff_white[iLen*2+1];
- //   printf("white len %d in %d bits\n", iOldLen, iBitLen);
+    iBits = G4ENCRunCode(iLen, huff_white, huff_wmuc, &ulCode);
+    G4ENCInsertCode(bb, ulCode, iBits);
 } /* G4ENCAddWhite() */
 //
 // Internal function to add a BLACK pixel run
 //
 static void G4ENCAddBlack(int iLen, BUFFERED_BITS *bb)
 {
-//    int iBitLen = 0; // debugging the length
-//    int iOldLen = iLen;
-while (iLen >= 64)
-   {
-   if (iLen >= 2560)
-      {
-          G4ENCInsertCode(bb, 0x1f, 12); /* Add the 2560 code */
-      iLen -= 2560;
-  //        iBitLen += 12;
-      }
-   else
-      {
-      int iCode;
-      iCode = iLen >> 6; /* Makeup code = mult of 64 */
-          G4ENCInsertCode(bb, huff_bmuc[iCode*2], huff_bmuc[iCode*2+1]);
-    //      iBitLen += huff_bmuc[iCode*2+1];
-      iLen &= 63; /* Get the remainder */
-      }
-   }
-   /* Add the terminating code */
-    G4ENCInsertCode(bb, huff_black[iLen*2], huff_black[iLen*2+1]);
- //   iBitLen += huff_black[iLen*2+1];
- //   printf("black len %d in %d bits\n", iOldLen, iBitLen);
-} /* PILAddBlack() */
+uint32_t ulCode;
+int iBits;
+
+    while (iLen >= 2560) {
+        G4ENCInsertCode(bb, 0x1f, 12); /* Add the 2560 code */
+        iLen -= 2560;
+    }
+    iBits = G4ENCRunCode(iLen, huff_black, huff_bmuc, &ulCode);
+    G4ENCInsertCode(bb, ulCode, iBits);
+} /* G4ENCAddBlack() */
 //
-// Initialize the compressor
-// This must be called before adding data to the output
+// Internal function to add a horizontal mode code (001 + run + run)
+// iColor is the color of the first run (0=white, 1=black)
+// When both runs are shorter than 2560 pixels, the whole sequence is
+// joined into one code and written with a single insert if it fits in the
+// accumulator (always true for 64-bit, 2 inserts at most for 32-bit)
 //
-int G4ENC_init(G4ENCIMAGE *pImage, int iWidth, int iHeight, int iBitDirection, G4ENC_WRITE_CALLBACK *pfnWrite, uint8_t *pOut, int iOutSize)
+static inline void G4ENCAddHorizontal(BUFFERED_BITS *pBB, int iRun1, int iRun2, int iColor)
+{
+uint32_t ulCode1, ulCode2;
+int iBits1, iBits2;
+
+    if (iRun1 >= 2560 || iRun2 >= 2560) { /* rare - needs repeated 2560 codes */
+        G4ENCInsertCode(pBB, 1, 3); /* Horizontal code = 001 */
+        if (iColor) {
+            G4ENCAddBlack(iRun1, pBB);
+            G4ENCAddWhite(iRun2, pBB);
+        } else {
+            G4ENCAddWhite(iRun1, pBB);
+            G4ENCAddBlack(iRun2, pBB);
+        }
+        return;
+    }
+    if (iColor) {
+        iBits1 = G4ENCRunCode(iRun1, huff_black, huff_bmuc, &ulCode1);
+        iBits2 = G4ENCRunCode(iRun2, huff_white, huff_wmuc, &ulCode2);
+    } else {
+        iBits1 = G4ENCRunCode(iRun1, huff_white, huff_wmuc, &ulCode1);
+        iBits2 = G4ENCRunCode(iRun2, huff_black, huff_bmuc, &ulCode2);
+    }
+    ulCode1 |= (uint32_t)1 << iBits1; /* Horizontal code = 001 */
+    iBits1 += 3;
+    if (iBits1 + iBits2 < REGISTER_WIDTH) {
+        G4ENCInsertCode(pBB, ((BIGUINT)ulCode1 << iBits2) | ulCode2, iBits1 + iBits2);
+    } else {
+        G4ENCInsertCode(pBB, ulCode1, iBits1);
+        G4ENCInsertCode(pBB, ulCode2, iBits2);
+    }
+} /* G4ENCAddHorizontal() */
+//
+// Pass output data to whichever write callback was set
+//
+#define G4ENC_HAS_WRITER(p) ((p)->pfnWrite != NULL || (p)->pfnWriteEx != NULL)
+// The busy flags of the double buffered output are cleared by the sink
+// (another thread or an interrupt handler), so they're read with acquire and
+// written with release ordering: GCC/clang atomics, else C++11 <atomic> or
+// C11 <stdatomic.h> fences. Without any of those, the flags are only volatile,
+// which is safe on a single core CPU with the sink in an interrupt handler.
+#if defined( __GNUC__ ) || defined( __clang__ )
+#define G4ENC_GET_BUSY(p, i) __atomic_load_n(&(p)->ucBusy[i], __ATOMIC_ACQUIRE)
+#define G4ENC_SET_BUSY(p, i, v) __atomic_store_n(&(p)->ucBusy[i], (uint8_t)(v), __ATOMIC_RELEASE)
+#else
+#if defined( __cplusplus ) && (__cplusplus >= 201103L || (defined( _MSVC_LANG ) && _MSVC_LANG >= 201103L))
+#include <atomic>
+#define G4ENC_FENCE(o) std::atomic_thread_fence(std::o)
+#elif !defined( __cplusplus ) && defined( __STDC_VERSION__ ) && __STDC_VERSION__ >= 201112L && !defined( __STDC_NO_ATOMICS__ )
+#include <stdatomic.h>
+#define G4ENC_FENCE(o) atomic_thread_fence(o)
+#else
+#define G4ENC_FENCE(o)
+#endif
+static inline uint8_t G4ENCGetBusy(G4ENCIMAGE *pImage, int i)
+{
+    uint8_t ucBusy = pImage->ucBusy[i];
+    G4ENC_FENCE(memory_order_acquire); // see what the sink did before it cleared the flag
+    return ucBusy;
+} /* G4ENCGetBusy() */
+static inline void G4ENCSetBusy(G4ENCIMAGE *pImage, int i, int iValue)
+{
+    G4ENC_FENCE(memory_order_release); // finish with the buffer before handing it over
+    pImage->ucBusy[i] = (uint8_t)iValue;
+} /* G4ENCSetBusy() */
+#define G4ENC_GET_BUSY(p, i) G4ENCGetBusy(p, i)
+#define G4ENC_SET_BUSY(p, i, v) G4ENCSetBusy(p, i, v)
+#endif
+static int G4ENCWrite(G4ENCIMAGE *pImage, uint8_t *pBuf, int iLen)
+{
+    if (pImage->pfnWriteEx)
+        return (*pImage->pfnWriteEx)(pImage->pUser, pBuf, iLen);
+    return (*pImage->pfnWrite)(pBuf, iLen);
+} /* G4ENCWrite() */
+//
+// Choose where the bit writer puts the next output
+// Without a write callback, the data is encoded directly into the caller's
+// buffer as long as it has more room left than the staging buffer; only
+// the last part of the output goes through the staging buffer so that
+// an overflow is caught before writing past the end of the caller's buffer
+//
+static void G4ENCSetOutput(G4ENCIMAGE *pImage)
+{
+    int iRoom = pImage->iOutSize - pImage->iDataSize;
+
+    if (pImage->pPingPong[0] != NULL) { // double buffered
+        pImage->pFileBuf = pImage->pPingPong[pImage->iActive];
+        pImage->iFileBufSize = pImage->iPingPongSize;
+    } else if (!G4ENC_HAS_WRITER(pImage) && pImage->pOutBuf != NULL && iRoom > pImage->iStageBufSize) {
+        pImage->pFileBuf = &pImage->pOutBuf[pImage->iDataSize];
+        pImage->iFileBufSize = iRoom;
+    } else {
+        pImage->pFileBuf = pImage->pStageBuf;
+        pImage->iFileBufSize = pImage->iStageBufSize;
+    }
+} /* G4ENCSetOutput() */
+//
+// Common setup of the encoder state
+// pCur/pRef must each hold G4ENC_FLIP_COUNT(iWidth) entries, the staging
+// buffer needs room for at least one worst case line and pPrevLine holds one line of pixels
+//
+static int G4ENCInitState(G4ENCIMAGE *pImage, int iWidth, int iHeight, int iBitDirection, G4ENC_WRITE_CALLBACK *pfnWrite, uint8_t *pOut, int iOutSize, G4ENC_FLIP *pCur, G4ENC_FLIP *pRef, uint8_t *pFileBuf, int iFileBufSize, uint8_t *pPrevLine)
 {
     int iError = G4ENC_SUCCESS;
-    
-    if (pImage == NULL || iWidth > G4ENC_MAX_WIDTH || iHeight <= 0 || (iBitDirection != G4ENC_LSB_FIRST && iBitDirection != G4ENC_MSB_FIRST))
+
+    if (iWidth <= 0 || iWidth > G4ENC_FLIP_MAX_WIDTH || iHeight <= 0 || (iBitDirection != G4ENC_LSB_FIRST && iBitDirection != G4ENC_MSB_FIRST))
+        return G4ENC_INVALID_PARAMETER;
+    if (G4ENC_MAX_LINE_SIZE(iWidth) > iFileBufSize)
         return G4ENC_INVALID_PARAMETER;
     pImage->iWidth = iWidth; // image size
     pImage->iHeight = iHeight;
-    pImage->pCur = pImage->CurFlips;
-    pImage->pRef = pImage->RefFlips;
+    pImage->pCur = pCur;
+    pImage->pRef = pRef;
+    pImage->pStageBuf = pFileBuf;
+    pImage->iStageBufSize = iFileBufSize;
+    pImage->pPrevLine = pPrevLine;
+    memset(pPrevLine, 0xff, (iWidth + 7) >> 3); // the first line refers to an imaginary white line
+    pImage->bPrevLine = 1;
     pImage->ucFillOrder = (uint8_t)iBitDirection;
     pImage->pfnWrite = pfnWrite; // optional output write callback
     pImage->pOutBuf = pOut; // optional output buffer
     pImage->iOutSize = iOutSize; // output buffer pre-allocated size
     pImage->iDataSize = 0; // no data yet
     pImage->y = 0;
-    for (int i=0; i<G4ENC_MAX_WIDTH; i++) {
-        pImage->RefFlips[i] = iWidth;
-        pImage->CurFlips[i] = iWidth;
+    pImage->iRowsPerStrip = 0; // single strip unless G4ENC_setStrips() is called
+    pImage->iStripCount = 1;
+    pImage->iStrip = 0;
+    pImage->iStripStart = 0;
+    pImage->pStripSizes = NULL;
+    pImage->pVerify = NULL;
+    pImage->pfnSeek = NULL; // not streaming a TIFF file
+    pImage->iTIFFPageOff = 0;
+    pImage->iTIFFDataOff = 0;
+    pImage->iVerifyInterval = 1;
+    pImage->iBlockLen = 0; // the flush policy is kept
+    pImage->iT4K = 0; // T.6 unless G4ENC_setT4() is called
+    pImage->iT4Options = 0;
+    pImage->pFrameBuf = NULL; // not a frame sequence
+    pImage->iFrame = 0;
+    for (int i=0; i<4; i++) { // the coder stops at the first entry of xsize
+        pRef[i] = iWidth; // so only the start of the lists needs to be set
+        pCur[i] = iWidth;
     }
-    pImage->bb.pBuf = pImage->ucFileBuf;
+    G4ENCSetOutput(pImage);
+    pImage->bb.pBuf = pImage->pFileBuf;
     pImage->bb.ulBits = 0;
     pImage->bb.ulBitOff = 0;
+    pImage->bb.ulMirror = (iBitDirection == G4ENC_LSB_FIRST); // the bits are mirrored as they're written
+#ifdef G4ENC_STATS
+    pImage->bb.pStats = pImage->pStats; // kept until G4ENC_init()
+#endif
     pImage->iError = iError;
     return iError;
+} /* G4ENCInitState() */
+//
+// Initialize the compressor
+// This must be called before adding data to the output
+// Uses the buffers inside G4ENCIMAGE, so the width is limited to G4ENC_MAX_WIDTH
+// If pfnWrite and pOut are both NULL, the encoder only counts the output;
+// G4ENC_getOutSize() then returns the exact size the G4 data would have
+//
+int G4ENC_init(G4ENCIMAGE *pImage, int iWidth, int iHeight, int iBitDirection, G4ENC_WRITE_CALLBACK *pfnWrite, uint8_t *pOut, int iOutSize)
+{
+    if (pImage == NULL || iWidth > G4ENC_MAX_WIDTH)
+        return G4ENC_INVALID_PARAMETER;
+#if G4ENC_MAX_WIDTH > 0
+    pImage->iMaxWidth = G4ENC_MAX_WIDTH;
+    pImage->pfnWriteEx = NULL; // G4ENC_setWriteCallback() can be called after this
+    pImage->pUser = NULL;
+    pImage->pPingPong[0] = pImage->pPingPong[1] = NULL;
+    pImage->iFlushPolicy = G4ENC_FLUSH_FULL;
+    pImage->pBlockBuf = NULL;
+#ifdef G4ENC_STATS
+    pImage->pStats = NULL;
+#endif
+    return G4ENCInitState(pImage, iWidth, iHeight, iBitDirection, pfnWrite, pOut, iOutSize, pImage->CurFlips, pImage->RefFlips, pImage->ucFileBuf, (int)sizeof(pImage->ucFileBuf), pImage->ucPrevLine);
+#else
+    (void)iHeight; (void)iBitDirection; (void)pfnWrite; (void)pOut; (void)iOutSize;
+    return G4ENC_INVALID_PARAMETER; // built-in buffers were compiled out
+#endif
 } /* G4ENC_init() */
 //
+// Returns the number of bytes of workspace needed to encode
+// an image of the given width with G4ENC_initWorkspace()
+// (two lines of run-ends, the output staging buffer and a copy of the previous line)
+//
+int G4ENC_getWorkspaceSize(int iWidth)
+{
+    if (iWidth <= 0 || iWidth > G4ENC_FLIP_MAX_WIDTH)
+        return 0;
+    return (2 * G4ENC_FLIP_COUNT(iWidth) * (int)sizeof(G4ENC_FLIP)) + OUTPUT_BUF_SIZE + G4ENC_MAX_LINE_SIZE(iWidth) + ((iWidth + 7) >> 3) + (int)sizeof(uint32_t);
+} /* G4ENC_getWorkspaceSize() */
+//
+// Initialize the compressor to use a caller supplied workspace instead
+// of the buffers inside G4ENCIMAGE. This removes the G4ENC_MAX_WIDTH limit;
+// the workspace must be at least G4ENC_getWorkspaceSize(iWidth) bytes
+// and stay valid until the image is complete.
+//
+int G4ENC_initWorkspace(G4ENCIMAGE *pImage, int iWidth, int iHeight, int iBitDirection, G4ENC_WRITE_CALLBACK *pfnWrite, uint8_t *pOut, int iOutSize, void *pWorkspace, int iWorkspaceSize)
+{
+    G4ENC_FLIP *pFlips;
+    uint8_t *pFileBuf;
+    int iFlips;
+
+    if (pImage == NULL || pWorkspace == NULL || G4ENC_getWorkspaceSize(iWidth) == 0 || iWorkspaceSize < G4ENC_getWorkspaceSize(iWidth))
+        return G4ENC_INVALID_PARAMETER;
+    iFlips = G4ENC_FLIP_COUNT(iWidth);
+    // the run-ends need to be aligned; the workspace size includes room for it
+    pFlips = (G4ENC_FLIP *)(((uintptr_t)pWorkspace + sizeof(uint32_t) - 1) & ~(uintptr_t)(sizeof(uint32_t) - 1));
+    pFileBuf = (uint8_t *)&pFlips[iFlips * 2];
+    pImage->iMaxWidth = iWidth;
+    pImage->pfnWriteEx = NULL;
+    pImage->pUser = NULL;
+    pImage->pPingPong[0] = pImage->pPingPong[1] = NULL;
+    pImage->iFlushPolicy = G4ENC_FLUSH_FULL;
+    pImage->pBlockBuf = NULL;
+#ifdef G4ENC_STATS
+    pImage->pStats = NULL;
+#endif
+    return G4ENCInitState(pImage, iWidth, iHeight, iBitDirection, pfnWrite, pOut, iOutSize, pFlips, &pFlips[iFlips], pFileBuf, OUTPUT_BUF_SIZE + G4ENC_MAX_LINE_SIZE(iWidth), &pFileBuf[OUTPUT_BUF_SIZE + G4ENC_MAX_LINE_SIZE(iWidth)]);
+} /* G4ENC_initWorkspace() */
+//
+// Use a write callback which also receives a caller pointer (e.g. the
+// connection or file of this image), so several encoders can run at the
+// same time without globals. It replaces the pfnWrite of G4ENC_init()
+// and stays set across G4ENC_reset(); pass NULL to remove it.
+//
+int G4ENC_setWriteCallback(G4ENCIMAGE *pImage, G4ENC_WRITE_CALLBACK_EX *pfnWrite, void *pUser)
+{
+    if (pImage == NULL)
+        return G4ENC_INVALID_PARAMETER;
+    if (pImage->ucFillOrder != G4ENC_MSB_FIRST && pImage->ucFillOrder != G4ENC_LSB_FIRST)
+        return G4ENC_NOT_INITIALIZED;
+    if (pImage->y != 0 || pImage->iDataSize != 0)
+        return G4ENC_INVALID_PARAMETER;
+    pImage->pfnWriteEx = pfnWrite;
+    pImage->pUser = (pfnWrite) ? pUser : NULL;
+    G4ENCSetOutput(pImage);
+    pImage->bb.pBuf = pImage->pFileBuf;
+    return G4ENC_SUCCESS;
+} /* G4ENC_setWriteCallback() */
+//
+// Start a new image with an encoder which was already initialized
+// The fill order, write callbacks and buffers are kept, so this is much less
+// work than G4ENC_init() when encoding many small images; pOut/iOutSize
+// replace the output buffer (both NULL/0 with a write callback or to count the size).
+// Kept: G4ENC_setWriteCallback(), G4ENC_setPingPong() (the buffers must still
+// hold G4ENC_MAX_LINE_SIZE(iWidth) bytes and the sink must be done with them;
+// both start out free again), G4ENC_setFlush() and G4ENC_setStats().
+// Cleared: strips, T.4, verify, streamed TIFF and frame settings.
+//
+int G4ENC_reset(G4ENCIMAGE *pImage, int iWidth, int iHeight, uint8_t *pOut, int iOutSize)
+{
+    if (pImage == NULL)
+        return G4ENC_INVALID_PARAMETER;
+    if (pImage->ucFillOrder != G4ENC_MSB_FIRST && pImage->ucFillOrder != G4ENC_LSB_FIRST)
+        return G4ENC_NOT_INITIALIZED;
+    if (iWidth > pImage->iMaxWidth)
+        return G4ENC_INVALID_PARAMETER;
+    if (pImage->pPingPong[0] != NULL) {
+        if (iWidth <= 0 || pImage->iPingPongSize < G4ENC_MAX_LINE_SIZE(iWidth))
+            return G4ENC_INVALID_PARAMETER; // a line wouldn't fit in the double buffers
+        pImage->iActive = 0;
+        G4ENC_SET_BUSY(pImage, 0, 0);
+        G4ENC_SET_BUSY(pImage, 1, 0);
+    }
+    return G4ENCInitState(pImage, iWidth, iHeight, pImage->ucFillOrder, pImage->pfnWrite, pOut, iOutSize, pImage->pCur, pImage->pRef, pImage->pStageBuf, pImage->iStageBufSize, pImage->pPrevLine);
+} /* G4ENC_reset() */
+//
+// Double buffer the output so the write callback can keep writing one buffer
+// (by DMA or on another thread) while the encoder fills the other one.
+// Each buffer needs room for at least G4ENC_MAX_LINE_SIZE(iWidth) bytes and
+// larger buffers mean fewer writes. The callback returns iLen if it's done
+// with the buffer, G4ENC_WRITE_PENDING if it will call G4ENC_releaseBuffer()
+// later or anything else to stop the encoder with G4ENC_WRITE_ERROR.
+// When the encoder needs a buffer which hasn't been released, the add
+// functions return G4ENC_BUSY and the line which didn't fit (and the ones
+// after it) must be added again after a buffer is released; G4ENC_getLine()
+// tells which line is next. Call after G4ENC_init() and setting a write
+// callback; pass NULL buffers to go back to a single buffer.
+//
+int G4ENC_setPingPong(G4ENCIMAGE *pImage, uint8_t *pBuf0, uint8_t *pBuf1, int iBufSize)
+{
+    if (pImage == NULL || (pBuf0 == NULL) != (pBuf1 == NULL) || (pBuf0 != NULL && pBuf0 == pBuf1))
+        return G4ENC_INVALID_PARAMETER;
+    if (pImage->ucFillOrder != G4ENC_MSB_FIRST && pImage->ucFillOrder != G4ENC_LSB_FIRST)
+        return G4ENC_NOT_INITIALIZED;
+    if (pImage->y != 0 || pImage->iDataSize != 0 || pImage->pfnSeek != NULL || pImage->pBlockBuf != NULL)
+        return G4ENC_INVALID_PARAMETER;
+    if (pBuf0 != NULL && (!G4ENC_HAS_WRITER(pImage) || iBufSize < G4ENC_MAX_LINE_SIZE(pImage->iWidth)))
+        return G4ENC_INVALID_PARAMETER;
+    pImage->pPingPong[0] = pBuf0;
+    pImage->pPingPong[1] = pBuf1;
+    pImage->iPingPongSize = iBufSize;
+    pImage->iActive = 0;
+    G4ENC_SET_BUSY(pImage, 0, 0);
+    G4ENC_SET_BUSY(pImage, 1, 0);
+    G4ENCSetOutput(pImage);
+    pImage->bb.pBuf = pImage->pFileBuf;
+    return G4ENC_SUCCESS;
+} /* G4ENC_setPingPong() */
+//
+// Called by the sink when it has finished writing a buffer which its
+// write callback returned G4ENC_WRITE_PENDING for; this only clears a flag,
+// so it can be called from an interrupt handler or another thread
+//
+int G4ENC_releaseBuffer(G4ENCIMAGE *pImage, uint8_t *pBuf)
+{
+    if (pImage == NULL || pBuf == NULL)
+        return G4ENC_INVALID_PARAMETER;
+    if (pBuf == pImage->pPingPong[0])
+        G4ENC_SET_BUSY(pImage, 0, 0);
+    else if (pBuf == pImage->pPingPong[1])
+        G4ENC_SET_BUSY(pImage, 1, 0);
+    else
+        return G4ENC_INVALID_PARAMETER;
+    return G4ENC_SUCCESS;
+} /* G4ENC_releaseBuffer() */
+//
+// Returns the number of lines added so far (the next line to add)
+//
+int G4ENC_getLine(G4ENCIMAGE *pImage)
+{
+    return (pImage != NULL) ? pImage->y : 0;
+} /* G4ENC_getLine() */
+//
+// Choose when the output is passed on (call after G4ENC_init() and before adding lines)
+// G4ENC_FLUSH_FULL: when the staging buffer is full; the fewest writes (default)
+// G4ENC_FLUSH_LINES: every iValue lines and G4ENC_FLUSH_BYTES: as soon as iValue
+// bytes are ready; for streaming over a radio or socket where the first bytes
+// should leave right away. Each flush writes the complete bytes; the bits of a
+// partial byte go out with the next one.
+// G4ENC_FLUSH_BLOCKS: the write callback only gets chunks of exactly iValue
+// bytes (e.g. 512 byte SD card sectors or flash pages) which are collected in
+// pBlockBuf (iValue bytes); the last one is shorter unless G4ENC_FLUSH_PAD is
+// added. This needs a write callback and can't be combined with streamed TIFF,
+// double buffered output, threaded strips or snapshots.
+//
+int G4ENC_setFlush(G4ENCIMAGE *pImage, int iPolicy, int iValue, uint8_t *pBlockBuf)
+{
+    if (pImage == NULL)
+        return G4ENC_INVALID_PARAMETER;
+    if (pImage->ucFillOrder != G4ENC_MSB_FIRST && pImage->ucFillOrder != G4ENC_LSB_FIRST)
+        return G4ENC_NOT_INITIALIZED;
+    if (pImage->y != 0 || pImage->iDataSize != 0)
+        return G4ENC_INVALID_PARAMETER;
+    switch (iPolicy & ~G4ENC_FLUSH_PAD) {
+        case G4ENC_FLUSH_FULL:
+            iValue = 0;
+            break;
+        case G4ENC_FLUSH_LINES:
+        case G4ENC_FLUSH_BYTES:
+            if (iValue <= 0)
+                return G4ENC_INVALID_PARAMETER;
+            break;
+        case G4ENC_FLUSH_BLOCKS:
+            if (iValue <= 0 || pBlockBuf == NULL || !G4ENC_HAS_WRITER(pImage) || pImage->pfnSeek != NULL || pImage->pPingPong[0] != NULL)
+                return G4ENC_INVALID_PARAMETER;
+            break;
+        default:
+            return G4ENC_INVALID_PARAMETER;
+    }
+    if ((iPolicy & G4ENC_FLUSH_PAD) && (iPolicy & ~G4ENC_FLUSH_PAD) != G4ENC_FLUSH_BLOCKS)
+        return G4ENC_INVALID_PARAMETER;
+    pImage->iFlushPolicy = iPolicy & ~G4ENC_FLUSH_PAD;
+    pImage->iFlushValue = iValue;
+    pImage->pBlockBuf = (pImage->iFlushPolicy == G4ENC_FLUSH_BLOCKS) ? pBlockBuf : NULL;
+    if (pImage->pBlockBuf != NULL)
+        pImage->iFlushPolicy |= (iPolicy & G4ENC_FLUSH_PAD);
+    pImage->iBlockLen = 0;
+    return G4ENC_SUCCESS;
+} /* G4ENC_setFlush() */
+//
+// Divide the image into horizontal strips of iRowsPerStrip lines
+// Each strip is an independent G4 stream (it starts from an all white
+// reference line and ends with its own EOFB), so strips can be encoded
+// in parallel and a decoder can start at any strip.
+// pStripSizes (optional) receives the compressed size of each strip and
+// must have room for G4ENC_getStripCount() entries; it's required
+// to generate a TIFF header for more than 1 strip.
+// Must be called after G4ENC_init() and before the first line is added
+//
+int G4ENC_setStrips(G4ENCIMAGE *pImage, int iRowsPerStrip, uint32_t *pStripSizes)
+{
+    if (pImage == NULL || iRowsPerStrip < 0)
+        return G4ENC_INVALID_PARAMETER;
+    if (pImage->ucFillOrder != G4ENC_MSB_FIRST && pImage->ucFillOrder != G4ENC_LSB_FIRST)
+        return G4ENC_NOT_INITIALIZED;
+    if (pImage->y != 0) // too late to change the layout
+        return G4ENC_INVALID_PARAMETER;
+    if (iRowsPerStrip == 0 || iRowsPerStrip > pImage->iHeight)
+        iRowsPerStrip = pImage->iHeight;
+    if (pImage->pfnSeek != NULL && pStripSizes == NULL && iRowsPerStrip < pImage->iHeight)
+        return G4ENC_INVALID_PARAMETER; // a streamed TIFF needs the strip sizes
+    pImage->iRowsPerStrip = iRowsPerStrip;
+    pImage->iStripCount = (pImage->iHeight + iRowsPerStrip - 1) / iRowsPerStrip;
+    pImage->pStripSizes = pStripSizes;
+    return G4ENC_SUCCESS;
+} /* G4ENC_setStrips() */
+//
+// Returns the number of strips the image will be divided into
+//
+int G4ENC_getStripCount(G4ENCIMAGE *pImage)
+{
+    if (pImage == NULL)
+        return 0;
+    return pImage->iStripCount;
+} /* G4ENC_getStripCount() */
+//
+// Switch the output from T.6 (G4) to T.4 (Group 3) coding
+// iK = 1 codes every line by itself (1D Modified Huffman); iK > 1 codes 2D
+// (Modified READ) lines with a 1D line every iK lines (2 or 4 for fax) and
+// iK = 0 goes back to T.6. Each line starts with an EOL (+ a bit telling if the
+// line is 1D for 2D coding) and each strip ends with an RTC (6 EOLs), so a decoder
+// can find the next line after a damaged one. G4ENC_T4_EOL_ALIGN adds fill bits
+// so that every EOL ends on a byte boundary. The TIFF header becomes
+// Compression=3 with a matching T4Options tag.
+// Must be called after G4ENC_init() and before G4ENC_startTIFF() and the first
+// line. The verify mode only decodes T.6, so the two can't be combined.
+//
+int G4ENC_setT4(G4ENCIMAGE *pImage, int iK, int iOptions)
+{
+    if (pImage == NULL || iK < 0 || (iOptions & ~G4ENC_T4_EOL_ALIGN) != 0)
+        return G4ENC_INVALID_PARAMETER;
+    if (pImage->ucFillOrder != G4ENC_MSB_FIRST && pImage->ucFillOrder != G4ENC_LSB_FIRST)
+        return G4ENC_NOT_INITIALIZED;
+    if (pImage->y != 0 || pImage->pfnSeek != NULL || (iK && pImage->pVerify != NULL))
+        return G4ENC_INVALID_PARAMETER;
+    pImage->iT4K = iK;
+    pImage->iT4Options = (iK) ? iOptions : 0;
+    return G4ENC_SUCCESS;
+} /* G4ENC_setT4() */
+//
+// Returns the number of rows per strip which guarantees that no strip
+// of an image of the given width will compress to more than iMaxStripSize bytes
+// This is a worst case bound (G4ENC_MAX_LINE_SIZE for every line), not a size
+// target; typical documents compress tens of times smaller, so their strips
+// come out far below iMaxStripSize. To aim for a strip size, scale the rows
+// by G4ENC_estimateSize() instead.
+//
+int G4ENC_rowsPerStripWorstCase(int iWidth, int iMaxStripSize)
+{
+    int iRows;
+    if (iWidth <= 0 || iMaxStripSize <= 0)
+        return 0;
+    iRows = iMaxStripSize / G4ENC_MAX_LINE_SIZE(iWidth);
+    return (iRows < 1) ? 1 : iRows;
+} /* G4ENC_rowsPerStripWorstCase() */
+//
+// Returns the largest number of bytes an image of the given size can compress to
+// with any strip layout (+1 for the output buffer overflow check)
+// A line costs at most 7 bits per pixel (a V(+/-3) code for every pixel)
+// plus a few codes at the ends and a T.4 EOL with fill bits; each strip adds
+// an EOFB or a T.4 RTC and a partial byte
+// Returns 0 if the size can't be held in an int
+//
+int G4ENC_maxOutSize(int iWidth, int iHeight)
+{
+    int64_t llSize;
+    if (iWidth <= 0 || iHeight <= 0)
+        return 0;
+    llSize = (int64_t)iHeight * (((int64_t)iWidth * 7 >> 3) + 19) + 1;
+    return (llSize > 0x7fffffff) ? 0 : (int)llSize;
+} /* G4ENC_maxOutSize() */
+#ifdef G4ENC_BYTE_RUNS
+//
 // Internal function to convert uncompressed 1-bit per pixel data
 // into the run-end data needed to feed the G4 encoder
+// (byte at a time version for CPUs without a fast count leading zeros)
 //
-static void G4ENCEncodeLine(unsigned char *buf, int xsize, int16_t *pDest)
+static void G4ENCEncodeLine(unsigned char *buf, int xsize, G4ENC_FLIP *pDest)
 {
 int iCount, xborder;
 uint8_t i, c;
 int8_t cBits;
 int iLen;
-int16_t x;
+int x;
 
    xborder = xsize;
    iCount = (xsize + 7) >> 3; /* Number of bytes per line */
@@ -265,14 +764,16 @@ int16_t x;
          {
          iLen += cBits; /* Adjust length */
          cBits = 8;
-         c = *buf++;  /* Get another data byte */
          iCount--;
+         if (iCount < 0)
+            break;
+         c = *buf++;  /* Get another data byte */
          continue; /* Keep doing white until color change */
          }
       c = ~c; /* flip color to count black pixels */
    /* Store the white run length */
       xborder -= iLen;
-      if (xborder < 0)
+      if (xborder <= 0) /* pad bits past the end don't count */
          {
          iLen += xborder; /* Make sure run length is not past end */
          break;
@@ -289,17 +790,17 @@ doblack:
          {
          iLen += cBits; /* Adjust length */
          cBits = 8;
-         c = *buf++;  /* Get another data byte */
-         c = ~c;   /* Flip color to find black */
          iCount--;
          if (iCount < 0)
             break;
+         c = *buf++;  /* Get another data byte */
+         c = ~c;   /* Flip color to find black */
          goto doblack;
          }
    /* Store the black run length */
       c = ~c;       /* Flip color again to find white pixels */
       xborder -= iLen;
-      if (xborder < 0)
+      if (xborder <= 0)
          {
          iLen += xborder; /* Make sure run length is not past end */
          break;
@@ -310,103 +811,512 @@ doblack:
       } /* while */
 
    x += iLen;
+   if (x > xsize) /* the last run included pad bits */
+      x = xsize;
    *pDest++ = x;
    *pDest++ = x; // Store a few more XSIZE to end the line
    *pDest++ = x; // so that the compressor doesn't go past
    *pDest++ = x; // the end of the line
 } /* G4ENCEncodeLine() */
+#else
+//
+// Read a word of pixels in big-endian order (pixel 0 in the MSB)
+// memcpy() keeps this safe on CPUs which don't allow unaligned reads
+//
+static inline G4RUNWORD G4ENCLoadWord(const uint8_t *s)
+{
+G4RUNWORD w;
+    memcpy(&w, s, sizeof(w));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    w = G4ENC_RUNWORD_BSWAP(w);
+#endif
+    return w;
+} /* G4ENCLoadWord() */
+//
+// Returns the byte offset of the first vector in the line which isn't entirely
+// made of ucColor pixels (or iEnd if they all are). This lets long white margins
+// and solid black areas go by a whole SIMD register at a time
+//
+static inline int G4ENCSkipSolid(const uint8_t *s, int iOff, int iEnd, uint8_t ucColor)
+{
+#if defined( __AVX2__ )
+    __m256i vColor = _mm256_set1_epi8((char)ucColor);
+    while (iOff + 32 <= iEnd) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)&s[iOff]);
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, vColor)) != -1)
+            return iOff;
+        iOff += 32;
+    }
+#elif defined( __SSE2__ )
+    __m128i vColor = _mm_set1_epi8((char)ucColor);
+    while (iOff + 16 <= iEnd) {
+        __m128i v = _mm_loadu_si128((const __m128i *)&s[iOff]);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, vColor)) != 0xffff)
+            return iOff;
+        iOff += 16;
+    }
+#elif defined( __ARM_NEON ) && defined( __aarch64__ )
+    uint8x16_t vColor = vdupq_n_u8(ucColor);
+    while (iOff + 16 <= iEnd) {
+        uint8x16_t v = vld1q_u8(&s[iOff]);
+        if (vminvq_u8(vceqq_u8(v, vColor)) == 0)
+            return iOff;
+        iOff += 16;
+    }
+#endif
+    while (iOff + (int)sizeof(G4RUNWORD) <= iEnd) { // then a word at a time
+        if (G4ENCLoadWord(&s[iOff]) != (G4RUNWORD)(ucColor ? ~(G4RUNWORD)0 : 0))
+            break;
+        iOff += sizeof(G4RUNWORD);
+    }
+    return iOff;
+} /* G4ENCSkipSolid() */
+//
+// Internal function to convert uncompressed 1-bit per pixel data
+// into the run-end data needed to feed the G4 encoder
+// This version works a word at a time: the color changes are found by
+// counting the leading zeros of the pixels XOR'd with the current color.
+// Pad bits beyond xsize in the last byte are ignored.
+//
+static void G4ENCEncodeLine(unsigned char *buf, int xsize, G4ENC_FLIP *pDest)
+{
+G4RUNWORD w, d, color;
+int i, x, iOff, iBytes;
 
+    iBytes = (xsize + 7) >> 3; /* Number of bytes per line */
+    color = ~(G4RUNWORD)0; /* lines start with white (1 bits) */
+    iOff = 0;
+    while (iOff < iBytes) {
+        if (iOff + (int)sizeof(G4RUNWORD) <= iBytes) {
+            w = G4ENCLoadWord(&buf[iOff]);
+        } else { // partial word at the end of the line
+            w = 0;
+            for (i=0; i<(int)sizeof(G4RUNWORD); i++) {
+                w <<= 8;
+                if (iOff + i < iBytes)
+                    w |= buf[iOff + i];
+            }
+        }
+        x = iOff << 3;
+        d = w ^ color; // 1's where the pixels differ from the current color
+        if (d == 0) { // no color change in this word; skip ahead
+            iOff = G4ENCSkipSolid(buf, iOff + sizeof(G4RUNWORD), iBytes, (uint8_t)color);
+            continue;
+        }
+        while (d) {
+            i = G4ENC_RUNWORD_CLZ(d);
+            if (x + i >= xsize) // pad bits past the end don't count
+                goto line_end;
+            *pDest++ = (G4ENC_FLIP)(x + i);
+            color = ~color;
+            d = (w ^ color) & (~(G4RUNWORD)0 >> i); // changes to the right of this one
+        }
+        iOff += sizeof(G4RUNWORD);
+    }
+line_end:
+    *pDest++ = xsize;
+    *pDest++ = xsize; // Store a few more XSIZE to end the line
+    *pDest++ = xsize; // so that the compressor doesn't go past
+    *pDest++ = xsize; // the end of the line
+} /* G4ENCEncodeLine() */
+#endif // G4ENC_BYTE_RUNS
 //
-// Reverse the bit order of the data
+// Brightness (0-255) of a group of color pixels (ITU-R BT.601 weights in
+// 8-bit fixed point). The format is checked once so that the loops are simple
+// enough for the compiler to vectorize.
 //
-static void G4ENCReverse(uint8_t *pData, int iLen)
+static void G4ENCColorLuma(const uint8_t *s, int iCount, int iFormat, uint8_t *pLuma)
 {
-    for (int i=0; i<iLen; i++) {
-        pData[i] = ucMirror[pData[i]];
+    int i, iBpp = (iFormat <= G4ENC_PIXEL_BGR24) ? 3 : 4;
+
+    if (iFormat == G4ENC_PIXEL_RGB24 || iFormat == G4ENC_PIXEL_RGBA32) {
+        for (i=0; i<iCount; i++, s += iBpp)
+            pLuma[i] = (uint8_t)((s[0] * 77 + s[1] * 150 + s[2] * 29 + 128) >> 8);
+    } else { // BGR(A)
+        for (i=0; i<iCount; i++, s += iBpp)
+            pLuma[i] = (uint8_t)((s[2] * 77 + s[1] * 150 + s[0] * 29 + 128) >> 8);
     }
-} /* G4ENCReverse() */
+} /* G4ENCColorLuma() */
+#if defined( __ARM_NEON ) && defined( __aarch64__ ) && !defined( __SSE2__ )
 //
-// Compress a line of pixels and add it to the output
-// the input format is expected to be MSB (most significant bit) first
-// for example, pixel 0 is in byte 0 at bit 7 (0x80)
-// Returns G4ENC_SUCCESS for each line if all is well and G4ENC_IMAGE_COMPLETE
-// for the last line
+// NEON has no movemask; each lane keeps its own bit of the 0xff/0x00
+// compare results, then the lanes are added together
 //
-//#define EXPERIMENT
-int G4ENC_addLine(G4ENCIMAGE *pImage, uint8_t *pPixels)
+static inline uint32_t G4ENCNeonMask(uint8x16_t v0, uint8x16_t v1)
 {
-int16_t a0, a0_c, b2, a1;
-int dx;
-int xsize, iErr;
-int iCur, iRef, iLen;
-int iHighWater;
-int16_t *CurFlips, *RefFlips;
-BUFFERED_BITS bb;
+    static const uint8_t ucBits[16] = {1,2,4,8,16,32,64,128,1,2,4,8,16,32,64,128};
+    uint8x16_t vBits = vld1q_u8(ucBits);
+    v0 = vandq_u8(v0, vBits);
+    v1 = vandq_u8(v1, vBits);
+    return (uint32_t)vaddv_u8(vget_low_u8(v0)) | ((uint32_t)vaddv_u8(vget_high_u8(v0)) << 8) |
+        ((uint32_t)vaddv_u8(vget_low_u8(v1)) << 16) | ((uint32_t)vaddv_u8(vget_high_u8(v1)) << 24);
+} /* G4ENCNeonMask() */
+#endif
+//
+// Compare 32 brightness values with the threshold
+// Returns a mask with bit N set if pixel N is white (>= threshold)
+//
+static inline uint32_t G4ENCLumaMask(const uint8_t *pLuma, uint8_t ucThreshold)
+{
+#if defined( __AVX2__ )
+    __m256i v = _mm256_loadu_si256((const __m256i *)pLuma);
+    // unsigned x >= t is max(x, t) == x
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_set1_epi8((char)ucThreshold)), v));
+#elif defined( __SSE2__ )
+    __m128i vT = _mm_set1_epi8((char)ucThreshold);
+    __m128i v0 = _mm_loadu_si128((const __m128i *)pLuma);
+    __m128i v1 = _mm_loadu_si128((const __m128i *)&pLuma[16]);
+    uint32_t u32 = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v0, vT), v0));
+    return u32 | ((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v1, vT), v1)) << 16);
+#elif defined( __ARM_NEON ) && defined( __aarch64__ )
+    uint8x16_t vT = vdupq_n_u8(ucThreshold);
+    return G4ENCNeonMask(vcgeq_u8(vld1q_u8(pLuma), vT), vcgeq_u8(vld1q_u8(&pLuma[16]), vT));
+#else
+    uint32_t u32 = 0;
+    for (int i=0; i<32; i++)
+        u32 |= (uint32_t)(pLuma[i] >= ucThreshold) << i;
+    return u32;
+#endif
+} /* G4ENCLumaMask() */
+//
+// Pick a threshold for a line halfway between its darkest and brightest pixels
+// Lines without much contrast use the middle value so that a blank (or solid) line
+// doesn't turn into noise
+//
+static int G4ENCLineThreshold(const uint8_t *s, int xsize, int iFormat, int iBpp)
+{
+    uint8_t ucLuma[32];
+    const uint8_t *pLuma = s;
+    int i, x, iCount, iMin = 255, iMax = 0;
 
-    if (pImage == NULL || pPixels == NULL)
-        return G4ENC_INVALID_PARAMETER;
-    if (pImage->ucFillOrder != G4ENC_MSB_FIRST && pImage->ucFillOrder != G4ENC_LSB_FIRST)
-        return G4ENC_NOT_INITIALIZED;
-    memcpy(&bb, &pImage->bb, sizeof(BUFFERED_BITS)); // keep local copy
-    CurFlips = pImage->pCur;
-    RefFlips = pImage->pRef;
-    iErr = 0;
-    xsize = pImage->iWidth; /* For performance reasons */
+    for (x=0; x<xsize; x+=32) {
+        iCount = (xsize - x < 32) ? xsize - x : 32;
+        if (iFormat == G4ENC_PIXEL_GRAY8) {
+            pLuma = &s[x];
+        } else {
+            G4ENCColorLuma(&s[x * iBpp], iCount, iFormat, ucLuma);
+            pLuma = ucLuma;
+        }
+        for (i=0; i<iCount; i++) {
+            if (pLuma[i] < iMin) iMin = pLuma[i];
+            if (pLuma[i] > iMax) iMax = pLuma[i];
+        }
+    }
+    if (iMax - iMin < 64)
+        return 128;
+    return (iMin + iMax + 1) >> 1;
+} /* G4ENCLineThreshold() */
+//
+// Add the run-ends of a group of 32 pixels given as a mask (bit N set = pixel N is white)
+// The color changes are found by counting the trailing zeros of the pixels XOR'd
+// with the current color. Returns the updated run-end pointer.
+//
+static inline G4ENC_FLIP * G4ENCMaskRuns(uint32_t u32Mask, uint32_t u32Valid, int x, uint32_t *pColor, G4ENC_FLIP *pDest)
+{
+    uint32_t u32Color = *pColor;
+    uint32_t u32Diff = (u32Mask ^ u32Color) & u32Valid; // 1's where the pixels differ from the current color
+    int i;
 
-    iHighWater = OUTPUT_BUF_SIZE - 8;
-    // Convert the incoming line of pixels into run-end data
-    G4ENCEncodeLine(pPixels, pImage->iWidth, CurFlips);
+    while (u32Diff) {
+        i = G4ENC_CTZ32(u32Diff);
+        *pDest++ = (G4ENC_FLIP)(x + i);
+        u32Color = ~u32Color;
+        u32Diff = (u32Mask ^ u32Color) & u32Valid & ((uint32_t)0xfffffffe << i); // changes after this one
+    }
+    *pColor = u32Color;
+    return pDest;
+} /* G4ENCMaskRuns() */
+//
+// Convert a line of gray or color pixels directly into run-end data
+// Pixels darker than the threshold are black. Each group of 32 pixels is compared
+// with the threshold into a bit mask and the color changes are found by counting
+// the trailing zeros, so the line is never stored as 1-bpp pixels.
+//
+static void G4ENCThresholdLine(const uint8_t *s, int xsize, int iFormat, int iThreshold, G4ENC_FLIP *pDest)
+{
+uint8_t ucLuma[32];
+const uint8_t *pLuma;
+uint32_t u32Color, u32Valid;
+int x, iCount, iBpp;
 
-      /* Encode this line as G4 */
-      a0 = a0_c = 0;
-      iCur = iRef = 0;
-      while (a0 < xsize)
-         {
-         b2 = RefFlips[iRef+1];
-         a1 = CurFlips[iCur];
-         if (b2 < a1) /* Is b2 to the left of a1? */
-            {
-            /* yes, do pass mode */
-            a0 = b2;
-            iRef += 2;
-#ifdef EXPERIMENT
-            G4ENCInsertCode(&bb, 4, 6); /* Pass code = 000100 */
-#else
-            G4ENCInsertCode(&bb, 1, 4); /* Pass code = 0001 */
-#endif // EXPERIMENT
-            }
-         else /* Try vertical and horizontal mode */
-            {
-            dx = RefFlips[iRef] - a1;  /* b1 - a1 */
-            if (dx > 3 || dx < -3) /* Horizontal mode */
-               {
-#ifdef EXPERIMENT
-                   int w1 = CurFlips[iCur] - a0;
-                   int w2 = CurFlips[iCur+1] - CurFlips[iCur];
-                   if (w1 >= 1 && w2 >= 1 && w1+w2 <= 3) { // dither optimization
-                       G4ENCInsertCode(&bb, 4, 6); /* dither code = 000101, 000110 or 000111 */
-                   } else {
-                       G4ENCInsertCode(&bb, 1, 3); /* Horizontal code = 001 */
-                       printf("horizontal code\n");
-                       // use expansion bit idea
-                       if (w1 < 8 && w2 < 16) G4ENCInsertCode(&bb, 0, 8); // short
-                       else if (w1 < 64 && w2 < 256) G4ENCInsertCode(&bb, 0, 15); // medium
-                       else G4ENCInsertCode(&bb, 0, 24); // long
-                   }
+    iBpp = (iFormat == G4ENC_PIXEL_GRAY8) ? 1 : (iFormat <= G4ENC_PIXEL_BGR24) ? 3 : 4;
+    if (iThreshold == G4ENC_THRESHOLD_AUTO)
+        iThreshold = G4ENCLineThreshold(s, xsize, iFormat, iBpp);
+    memset(ucLuma, 0, sizeof(ucLuma));
+    u32Color = 0xffffffff; // lines start with white
+    for (x=0; x<xsize; x+=32) {
+        iCount = xsize - x;
+        if (iCount >= 32) {
+            iCount = 32;
+            u32Valid = 0xffffffff;
+        } else {
+            u32Valid = ((uint32_t)1 << iCount) - 1;
+        }
+        if (iFormat != G4ENC_PIXEL_GRAY8) {
+            G4ENCColorLuma(&s[x * iBpp], iCount, iFormat, ucLuma);
+            pLuma = ucLuma;
+        } else if (iCount == 32) { // compare them in place
+            pLuma = &s[x];
+        } else {
+            memcpy(ucLuma, &s[x], iCount);
+            pLuma = ucLuma;
+        }
+        pDest = G4ENCMaskRuns(G4ENCLumaMask(pLuma, (uint8_t)iThreshold), u32Valid, x, &u32Color, pDest);
+    }
+    *pDest++ = xsize;
+    *pDest++ = xsize; // Store a few more XSIZE to end the line
+    *pDest++ = xsize; // so that the compressor doesn't go past
+    *pDest++ = xsize; // the end of the line
+} /* G4ENCThresholdLine() */
+//
+// Read 8 bytes as a little-endian (byte 0 in the low bits) or big-endian 64-bit value
+//
+static inline uint64_t G4ENCLoad64(const uint8_t *s, int bBigEndian)
+{
+uint64_t u64;
+    memcpy(&u64, s, sizeof(u64));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (bBigEndian)
 #else
-                   G4ENCInsertCode(&bb, 1, 3); /* Horizontal code = 001 */
-               //    printf("horizontal code\n");
-               if (a0_c) /* If currently black */
-                  {
-                      G4ENCAddBlack(CurFlips[iCur] - a0, &bb);
-                      G4ENCAddWhite(CurFlips[iCur+1] - CurFlips[iCur], &bb);
-                  }
-               else /* currently white */
-                  {
-                      G4ENCAddWhite(CurFlips[iCur] - a0, &bb);
-                      G4ENCAddBlack(CurFlips[iCur+1] - CurFlips[iCur], &bb);
-                  }
+    if (!bBigEndian)
+#endif
+        u64 = G4ENC_BSWAP64(u64);
+    return u64;
+} /* G4ENCLoad64() */
+//
+// Transpose an 8x8 block of bits (SWAR)
+// Byte N of the result holds bit N of each of the 8 input bytes
+//
+static inline uint64_t G4ENCTranspose8x8(uint64_t x)
+{
+uint64_t t;
+    t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaULL;
+    x ^= t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000cccc0000ccccULL;
+    x ^= t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ULL;
+    x ^= t ^ (t << 28);
+    return x;
+} /* G4ENCTranspose8x8() */
+//
+// Get one row of 32 pixels from a OneBitDisplay page (each byte is a column
+// of 8 pixels, bit N = row N, set = black)
+// Returns a mask with bit N set if pixel N is white
+//
+static inline uint32_t G4ENCOBDMask(const uint8_t *s, int iRow)
+{
+#if defined( __AVX2__ )
+    // shift the row's bit to the top of each byte and gather them
+    return ~(uint32_t)_mm256_movemask_epi8(_mm256_sll_epi16(_mm256_loadu_si256((const __m256i *)s), _mm_cvtsi32_si128(7 - iRow)));
+#elif defined( __SSE2__ )
+    __m128i vCount = _mm_cvtsi32_si128(7 - iRow);
+    uint32_t u32 = (uint32_t)_mm_movemask_epi8(_mm_sll_epi16(_mm_loadu_si128((const __m128i *)s), vCount));
+    return ~(u32 | ((uint32_t)_mm_movemask_epi8(_mm_sll_epi16(_mm_loadu_si128((const __m128i *)&s[16]), vCount)) << 16));
+#elif defined( __ARM_NEON ) && defined( __aarch64__ )
+    uint8x16_t vBit = vdupq_n_u8((uint8_t)(1 << iRow));
+    return ~G4ENCNeonMask(vtstq_u8(vld1q_u8(s), vBit), vtstq_u8(vld1q_u8(&s[16]), vBit));
+#else
+    uint32_t u32 = 0;
+    for (int i=0; i<32; i+=8) // SWAR; the multiply gathers the row's bit of 8 bytes into the top byte
+        u32 |= (uint32_t)((((G4ENCLoad64(&s[i], 0) >> iRow) & 0x0101010101010101ULL) * 0x0102040810204080ULL) >> 56) << i;
+    return ~u32;
 #endif
+} /* G4ENCOBDMask() */
+//
+// Convert one row of a OneBitDisplay page directly into run-end data
+//
+static void G4ENCOBDLine(const uint8_t *s, int xsize, int iRow, G4ENC_FLIP *pDest)
+{
+uint8_t ucTemp[32];
+uint32_t u32Color, u32Valid, u32Mask;
+int x, iCount;
+
+    u32Color = 0xffffffff; // lines start with white
+    for (x=0; x<xsize; x+=32) {
+        iCount = xsize - x;
+        if (iCount >= 32) {
+            u32Mask = G4ENCOBDMask(&s[x], iRow);
+            u32Valid = 0xffffffff;
+        } else { // don't read past the end of the page
+            memset(ucTemp, 0, sizeof(ucTemp));
+            memcpy(ucTemp, &s[x], iCount);
+            u32Mask = G4ENCOBDMask(ucTemp, iRow);
+            u32Valid = ((uint32_t)1 << iCount) - 1;
+        }
+        pDest = G4ENCMaskRuns(u32Mask, u32Valid, x, &u32Color, pDest);
+    }
+    *pDest++ = xsize;
+    *pDest++ = xsize; // Store a few more XSIZE to end the line
+    *pDest++ = xsize; // so that the compressor doesn't go past
+    *pDest++ = xsize; // the end of the line
+} /* G4ENCOBDLine() */
+
+//
+// Collect output in the block buffer and pass it to the write callback
+// in chunks of exactly iFlushValue bytes (G4ENC_FLUSH_BLOCKS)
+//
+static int G4ENCWriteBlocks(G4ENCIMAGE *pImage, const uint8_t *s, int iLen)
+{
+int iCount;
+
+    while (iLen > 0) {
+        iCount = pImage->iFlushValue - pImage->iBlockLen;
+        if (iCount > iLen)
+            iCount = iLen;
+        memcpy(&pImage->pBlockBuf[pImage->iBlockLen], s, iCount);
+        pImage->iBlockLen += iCount;
+        s += iCount;
+        iLen -= iCount;
+        if (pImage->iBlockLen == pImage->iFlushValue) {
+            pImage->iBlockLen = 0;
+            if (G4ENCWrite(pImage, pImage->pBlockBuf, pImage->iFlushValue) != pImage->iFlushValue)
+                return G4ENC_WRITE_ERROR;
+        }
+    }
+    return G4ENC_SUCCESS;
+} /* G4ENCWriteBlocks() */
+//
+// Write the last (partial) block of the image
+// With G4ENC_FLUSH_PAD it's filled to the block size with 0's; the output
+// size doesn't include them
+//
+static int G4ENCFinishBlocks(G4ENCIMAGE *pImage)
+{
+int iLen = pImage->iBlockLen;
+
+    if (iLen == 0)
+        return G4ENC_SUCCESS;
+    if (pImage->iFlushPolicy & G4ENC_FLUSH_PAD) {
+        memset(&pImage->pBlockBuf[iLen], 0, pImage->iFlushValue - iLen);
+        iLen = pImage->iFlushValue;
+    }
+    pImage->iBlockLen = 0;
+    if (G4ENCWrite(pImage, pImage->pBlockBuf, iLen) != iLen) {
+        pImage->iError = G4ENC_WRITE_ERROR;
+        return G4ENC_WRITE_ERROR;
+    }
+    return G4ENC_SUCCESS;
+} /* G4ENCFinishBlocks() */
+//
+// Pass the data held in our internal buffer to the write callback
+// or copy it to the user supplied output buffer
+// When encoding directly into the user's buffer, the data is already in place
+//
+static int G4ENCWriteData(G4ENCIMAGE *pImage, int iLen)
+{
+    int rc;
+
+    if (pImage->pPingPong[0] != NULL) { // hand the buffer to the sink and switch to the other one
+        G4ENC_SET_BUSY(pImage, pImage->iActive, 1); // before the sink can release it
+        rc = G4ENCWrite(pImage, pImage->pFileBuf, iLen);
+        if (rc == iLen) { // finished with it already
+            G4ENC_SET_BUSY(pImage, pImage->iActive, 0);
+        } else if (rc != G4ENC_WRITE_PENDING) {
+            G4ENC_SET_BUSY(pImage, pImage->iActive, 0);
+            pImage->iError = G4ENC_WRITE_ERROR;
+            return G4ENC_WRITE_ERROR;
+        }
+        pImage->iActive ^= 1;
+    } else if (pImage->pBlockBuf != NULL) { // cut it into blocks
+        if (G4ENCWriteBlocks(pImage, pImage->pFileBuf, iLen) != G4ENC_SUCCESS) {
+            pImage->iError = G4ENC_WRITE_ERROR;
+            return G4ENC_WRITE_ERROR;
+        }
+    } else if (G4ENC_HAS_WRITER(pImage)) { // pass the data to the callback
+        if (G4ENCWrite(pImage, pImage->pFileBuf, iLen) != iLen) {
+            pImage->iError = G4ENC_WRITE_ERROR;
+            return G4ENC_WRITE_ERROR;
+        }
+    } else if (pImage->pOutBuf) { // the user supplied a buffer; check if we hit the end
+        if (pImage->iDataSize + iLen >= pImage->iOutSize) {// not enough space
+            pImage->iError = G4ENC_DATA_OVERFLOW; // we don't have a better error
+            return G4ENC_DATA_OVERFLOW;
+        }
+        // we're good to go
+        if (pImage->pFileBuf == pImage->pStageBuf)
+            memcpy(&pImage->pOutBuf[pImage->iDataSize], pImage->pFileBuf, iLen);
+    } // otherwise we're only counting the output size
+    pImage->iDataSize += iLen;
+    G4ENCSetOutput(pImage);
+    return G4ENC_SUCCESS;
+} /* G4ENCWriteData() */
+#ifdef G4ENC_STATS
+//
+// Count a coded run in the run length histogram and the make-up codes it uses
+// Returns the number of bits of the run's codes
+//
+static int G4ENCStatRun(G4ENCSTATS *pStats, int iLen, int iColor)
+{
+uint32_t ulCode;
+int i, iBits = 0;
+
+    for (i=0; i<G4ENC_RUN_BUCKETS-1 && (iLen >> i) != 0; i++) {}
+    pStats->ulRuns[iColor][i]++;
+    while (iLen >= 2560) {
+        pStats->ulMakeup[iColor][40]++;
+        iBits += 12;
+        iLen -= 2560;
+    }
+    if (iLen >= 64)
+        pStats->ulMakeup[iColor][iLen >> 6]++;
+    if (iColor)
+        iBits += G4ENCRunCode(iLen, huff_black, huff_bmuc, &ulCode);
+    else
+        iBits += G4ENCRunCode(iLen, huff_white, huff_wmuc, &ulCode);
+    return iBits;
+} /* G4ENCStatRun() */
+//
+// Count a line; iBits doesn't include its EOL
+//
+static void G4ENCStatLine(G4ENCSTATS *pStats, int y, int iBits)
+{
+    if (pStats->ulLines == 0 || (uint32_t)iBits < pStats->ulMinLineBits)
+        pStats->ulMinLineBits = (uint32_t)iBits;
+    if (pStats->ulLines == 0 || (uint32_t)iBits > pStats->ulMaxLineBits) {
+        pStats->ulMaxLineBits = (uint32_t)iBits;
+        pStats->iMaxLine = y;
+    }
+    pStats->ulLines++;
+    if (pStats->pLineBits)
+        pStats->pLineBits[y] = (uint32_t)iBits;
+} /* G4ENCStatLine() */
+// The coders record what they write when a G4ENCSTATS is attached
+#define G4ENC_STAT(pBB, x) do { if ((pBB)->pStats) { G4ENCSTATS *pS = (pBB)->pStats; x; } } while (0)
+#else
+#define G4ENC_STAT(pBB, x) do { } while (0)
+#endif // G4ENC_STATS
+//
+// Internal function to encode one line of run-ends as G4
+// against the run-ends of the reference (previous) line
+//
+static void G4ENCCodeLine(BUFFERED_BITS *pBB, G4ENC_FLIP *CurFlips, G4ENC_FLIP *RefFlips, int xsize)
+{
+int a0, a0_c, b2, a1;
+int dx;
+int iCur, iRef;
+
+      /* Encode this line as G4 */
+      a0 = a0_c = 0;
+      iCur = iRef = 0;
+      while (a0 < xsize)
+         {
+         b2 = RefFlips[iRef+1];
+         a1 = CurFlips[iCur];
+         if (b2 < a1) /* Is b2 to the left of a1? */
+            {
+            /* yes, do pass mode */
+            a0 = b2;
+            iRef += 2;
+            G4ENCInsertCode(pBB, 1, 4); /* Pass code = 0001 */
+            G4ENC_STAT(pBB, pS->ulPass++; pS->ulPassBits += 4);
+            }
+         else /* Try vertical and horizontal mode */
+            {
+            dx = RefFlips[iRef] - a1;  /* b1 - a1 */
+            if (dx > 3 || dx < -3) /* Horizontal mode */
+               {
+               G4ENCAddHorizontal(pBB, CurFlips[iCur] - a0, CurFlips[iCur+1] - CurFlips[iCur], a0_c);
+               G4ENC_STAT(pBB, pS->ulHoriz++; pS->ulHorizBits += 3 + G4ENCStatRun(pS, CurFlips[iCur] - a0, a0_c) + G4ENCStatRun(pS, CurFlips[iCur+1] - CurFlips[iCur], 1-a0_c));
                a0 = CurFlips[iCur+1]; /* a0 = a2 */
                if (a0 != xsize)
                   {
@@ -417,8 +1327,9 @@ BUFFERED_BITS bb;
                } /* horizontal mode */
             else /* Vertical mode */
                {
-               dx = (dx + 3) * 2; /* Convert to index table */
-                   G4ENCInsertCode(&bb, vtable[dx], vtable[dx+1]);
+               G4ENC_STAT(pBB, pS->ulVert[dx + 3]++; pS->ulVertBits += G4ENC_MH_LEN(vtable[dx + 3]));
+               dx = vtable[dx + 3];
+                   G4ENCInsertCode(pBB, G4ENC_MH_CODE(dx), G4ENC_MH_LEN(dx));
                a0 = a1;
                a0_c = 1-a0_c;
                if (a0 != xsize)
@@ -433,82 +1344,1242 @@ BUFFERED_BITS bb;
                } /* vertical mode */
             } /* horiz/vert mode */
          } /* while x < xsize */
-    iLen = (int)(bb.pBuf-pImage->ucFileBuf);
-   if (iLen >= iHighWater) // need to dump some data
-   {
-       if (pImage->ucFillOrder == G4ENC_LSB_FIRST) { // need to reverse the bits
-           G4ENCReverse(pImage->ucFileBuf, iLen);
-       }
-          // Our internal buffer is full, do we copy it to the user supplied buffer or pass it to the WRITE callback?
-          if (pImage->pfnWrite) { // pass the data to the callback
-              (*pImage->pfnWrite)(pImage->ucFileBuf, iLen);
-          } else { // the user supplied a buffer check; if we hit the end
-              if (pImage->iDataSize + iLen >= pImage->iOutSize) {// not enough space
-                  pImage->iError = iErr = G4ENC_DATA_OVERFLOW; // we don't have a better error
-                  return iErr;
-              }
-              // we're good to go
-              memcpy(&pImage->pOutBuf[pImage->iDataSize], pImage->ucFileBuf, iLen);
-          }
-          pImage->iDataSize += iLen;
-          bb.pBuf = pImage->ucFileBuf; // reset to start of output buffer
-      }
-    if (pImage->y == pImage->iHeight-1) { // last line of image
-      /* Add two EOL's to the end for RTC */
-        G4ENCInsertCode(&bb, 1, 12); /* EOL */
-        G4ENCInsertCode(&bb, 1, 12); /* EOL */
-        G4ENCFlushBits(&bb); // output the final buffered bits
-        // wrap up final output
-        iLen = (int)(bb.pBuf-pImage->ucFileBuf);
-        if (pImage->ucFillOrder == G4ENC_LSB_FIRST) { // need to reverse the bits
-            G4ENCReverse(pImage->ucFileBuf, iLen);
-        }
-          if (pImage->pfnWrite) { // pass the data to the callback
-              (*pImage->pfnWrite)(pImage->ucFileBuf, iLen);
-          } else { // the user supplied a buffer; check if we hit the end
-              if (pImage->iDataSize + iLen >= pImage->iOutSize) {// not enough space
-                  pImage->iError = iErr = G4ENC_DATA_OVERFLOW; // we don't have a better error
-                  return iErr;
-              }
-          // we're good to go
-          memcpy(&pImage->pOutBuf[pImage->iDataSize], pImage->ucFileBuf, iLen);
-          } // user supplied buffer
-        pImage->iDataSize += iLen;
-        iErr = G4ENC_IMAGE_COMPLETE;
-    }
-    pImage->pCur = RefFlips; // swap current and reference lines
-    pImage->pRef = CurFlips;
-    pImage->y++;
+} /* G4ENCCodeLine() */
+//
+// Returns true if two lines of pixels are the same (pad bits are ignored)
+//
+static int G4ENCSameLine(uint8_t *pLine1, uint8_t *pLine2, int xsize)
+{
+    int iBytes = xsize >> 3;
+    if (memcmp(pLine1, pLine2, iBytes) != 0)
+        return 0;
+    if (xsize & 7) { // partial byte at the end
+        uint8_t ucMask = (uint8_t)(0xff00 >> (xsize & 7));
+        return ((pLine1[iBytes] ^ pLine2[iBytes]) & ucMask) == 0;
+    }
+    return 1;
+} /* G4ENCSameLine() */
+//
+// Returns true if a line of pixels is all white (pad bits are ignored)
+//
+static int G4ENCBlankLine(uint8_t *pLine, int xsize)
+{
+    int iBytes = xsize >> 3;
+    if (iBytes && (pLine[0] != 0xff || memcmp(pLine, &pLine[1], iBytes-1) != 0))
+        return 0;
+    if (xsize & 7) { // partial byte at the end
+        uint8_t ucMask = (uint8_t)(0xff00 >> (xsize & 7));
+        return (pLine[iBytes] & ucMask) == ucMask;
+    }
+    return 1;
+} /* G4ENCBlankLine() */
+//
+// Encode a line which is the same as the reference line
+// Every color change (and the end of the line) lines up exactly with the
+// one above, so the whole line is a V0 code (a single 1 bit) per change + 1
+//
+static void G4ENCRepeatLine(BUFFERED_BITS *pBB, G4ENC_FLIP *RefFlips, int xsize)
+{
+    int iCount = 1;
+    while (RefFlips[iCount-1] < xsize)
+        iCount++;
+    G4ENC_STAT(pBB, pS->ulVert[3] += (uint32_t)iCount; pS->ulVertBits += (uint32_t)iCount);
+    while (iCount >= 16) {
+        G4ENCInsertCode(pBB, 0xffff, 16);
+        iCount -= 16;
+    }
+    if (iCount)
+        G4ENCInsertCode(pBB, ((uint32_t)1 << iCount) - 1, iCount);
+} /* G4ENCRepeatLine() */
+//
+// Encode a line by itself as T.4 1D (Modified Huffman)
+// The runs alternate between white and black starting with white
+// (a line which starts black begins with a white run of 0)
+//
+static void G4ENCCodeLine1D(BUFFERED_BITS *pBB, G4ENC_FLIP *CurFlips, int xsize)
+{
+int x = 0, iColor = 0;
+
+    while (x < xsize) {
+        if (iColor)
+            G4ENCAddBlack(*CurFlips - x, pBB);
+        else
+            G4ENCAddWhite(*CurFlips - x, pBB);
+        G4ENC_STAT(pBB, pS->ul1DBits += (uint32_t)G4ENCStatRun(pS, *CurFlips - x, iColor));
+        x = *CurFlips++;
+        iColor ^= 1;
+    }
+} /* G4ENCCodeLine1D() */
+//
+// Write the T.4 EOL which starts each line (and makes up the RTC)
+// 2D coding follows it with 1 if the next line is 1D or 0 if it's 2D
+// With G4ENC_T4_EOL_ALIGN, 0 fill bits end the EOL on a byte boundary
+//
+static void G4ENCAddEOL(BUFFERED_BITS *pBB, int iK, int iOptions, int b1D)
+{
+int iCode = 1, iLen = 12; // 000000000001
+
+    if (iOptions & G4ENC_T4_EOL_ALIGN)
+        iLen += (4 - (int)pBB->ulBitOff) & 7;
+    if (iK > 1) { // tag bit
+        iCode = 2 | b1D;
+        iLen++;
+    }
+    G4ENC_STAT(pBB, pS->ulEOLBits += (iK > 1) ? 13 : 12; pS->ulFillBits += (uint32_t)iLen - ((iK > 1) ? 13 : 12));
+    G4ENCInsertCode(pBB, iCode, iLen);
+} /* G4ENCAddEOL() */
+//
+// Decode the line just encoded from the staging buffer and compare it
+// to the run-ends it was encoded from
+// iStartBit is the bit offset of the line in the staging buffer
+//
+static int G4ENCVerifyLine(G4ENCIMAGE *pImage, BUFFERED_BITS *pBB, int iStartBit, G4ENC_FLIP *CurFlips, G4ENC_FLIP *RefFlips)
+{
+G4DECIMAGE *pDec = pImage->pVerify;
+int i, iBitPos, iEndBit, iLen;
+
+    // write the pending bits without advancing; the next store overwrites them
+    G4ENCSpillBits(pBB);
+    iLen = (int)(pBB->pBuf - pImage->pFileBuf);
+    iEndBit = (iLen * 8) + (int)pBB->ulBitOff;
+    iBitPos = iStartBit;
+    if (G4DECDecodeFlips(pImage->pFileBuf, iLen + (int)sizeof(BIGUINT), &iBitPos, pImage->ucFillOrder, RefFlips, pDec->pCur, pImage->iWidth) != G4ENC_SUCCESS || iBitPos != iEndBit)
+        return G4ENC_VERIFY_FAILED;
+    for (i=0; CurFlips[i] < pImage->iWidth; i++) {
+        if (pDec->pCur[i] != CurFlips[i])
+            return G4ENC_VERIFY_FAILED;
+    }
+    if (pDec->pCur[i] != pImage->iWidth) // decoded too many transitions
+        return G4ENC_VERIFY_FAILED;
+    pDec->y++;
+    return G4ENC_SUCCESS;
+} /* G4ENCVerifyLine() */
+//
+// Enable (or disable with NULL) verification of the encoder output
+// Lines added with G4ENC_addLine/addLines are decoded again right after they're
+// encoded and compared with the input; a mismatch stops the encoder with
+// G4ENC_VERIFY_FAILED. Each line is checked against the reference line the
+// encoder used, so checking 1 out of every iInterval lines still checks
+// those lines completely while reducing the cost. pDec must be initialized
+// for the same width (G4DEC_init with no data); its line count tells how
+// many lines were checked. Lines encoded by G4ENC_encodeStrips() are not verified.
+//
+int G4ENC_setVerify(G4ENCIMAGE *pImage, G4DECIMAGE *pDec, int iInterval)
+{
+    if (pImage == NULL || iInterval < 1)
+        return G4ENC_INVALID_PARAMETER;
+    if (pDec != NULL && (pDec->iWidth != pImage->iWidth || pImage->iT4K != 0)) // T.6 only
+        return G4ENC_INVALID_PARAMETER;
+    pImage->pVerify = pDec;
+    pImage->iVerifyInterval = iInterval;
+    return G4ENC_SUCCESS;
+} /* G4ENC_setVerify() */
+#ifdef G4ENC_STATS
+//
+// Gather statistics of the codes written for the lines which follow:
+// the count of each mode, the bits spent in each one, the bits of each line
+// and histograms of the run lengths and make-up codes. The counters are
+// cleared (pStats->pLineBits is kept and should hold iHeight entries) and
+// keep adding up across G4ENC_reset() and frames until G4ENC_init() or a
+// NULL pStats. Only present when compiled with G4ENC_STATS; lines encoded
+// by G4ENC_encodeStrips() are not counted.
+//
+int G4ENC_setStats(G4ENCIMAGE *pImage, G4ENCSTATS *pStats)
+{
+uint32_t *pLineBits;
+
+    if (pImage == NULL)
+        return G4ENC_INVALID_PARAMETER;
+    if (pImage->ucFillOrder != G4ENC_MSB_FIRST && pImage->ucFillOrder != G4ENC_LSB_FIRST)
+        return G4ENC_NOT_INITIALIZED;
+    if (pStats != NULL) {
+        pLineBits = pStats->pLineBits;
+        memset(pStats, 0, sizeof(G4ENCSTATS));
+        pStats->pLineBits = pLineBits;
+    }
+    pImage->pStats = pImage->bb.pStats = pStats;
+    return G4ENC_SUCCESS;
+} /* G4ENC_setStats() */
+#endif // G4ENC_STATS
+//
+// Mirror a line horizontally in the run-end domain
+// A change at x moves to xsize-x and the order of the changes is reversed;
+// a change at 0 drops off the end and a line which ends black gains one at 0
+//
+static void G4ENCMirrorRuns(G4ENC_FLIP *pFlips, int xsize)
+{
+int i, j, iCount, iStart;
+G4ENC_FLIP t;
+
+    for (iCount=0; pFlips[iCount] < xsize; iCount++) {};
+    iStart = (iCount && pFlips[0] == 0);
+    for (i=iStart, j=iCount-1; i<j; i++, j--) {
+        t = pFlips[i];
+        pFlips[i] = (G4ENC_FLIP)(xsize - pFlips[j]);
+        pFlips[j] = (G4ENC_FLIP)(xsize - t);
+    }
+    if (i == j)
+        pFlips[i] = (G4ENC_FLIP)(xsize - pFlips[i]);
+    if (iCount & 1) { // ends black, so the mirrored line starts black
+        if (!iStart) {
+            memmove(&pFlips[1], pFlips, iCount * sizeof(G4ENC_FLIP));
+            iCount++;
+        }
+        pFlips[0] = 0;
+    } else if (iStart) {
+        iCount--;
+        memmove(pFlips, &pFlips[1], iCount * sizeof(G4ENC_FLIP));
+    }
+    for (i=0; i<4; i++) // the coder stops at the first entry of xsize
+        pFlips[iCount+i] = (G4ENC_FLIP)xsize;
+} /* G4ENCMirrorRuns() */
+static int G4ENCFinishTIFF(G4ENCIMAGE *pImage); // streamed TIFF (see below)
+//
+// Compress a group of lines of any of the input pixel formats
+// Gray, color and OneBitDisplay lines go straight to run-ends, so
+// there's no 1-bpp copy of them to detect repeated lines
+// (OneBitDisplay pages use a pitch of 0 and take row N for the Nth line)
+// bMirror flips each line horizontally after it's converted to run-ends
+//
+static int G4ENCAddLines(G4ENCIMAGE *pImage, uint8_t *pPixels, int iPitch, int iCount, int iFormat, int iThreshold, int bMirror)
+{
+int xsize, y, iErr, bRepeat, bFlush, b1D = 0, iRow = 0;
+int iLen, iHighWater, iStripEnd, iStartBit, iStripRows;
+G4ENC_FLIP *CurFlips, *RefFlips, *pTemp;
+uint8_t *pPrev;
+BUFFERED_BITS bb;
+
+    if (pImage == NULL || pPixels == NULL || iCount <= 0)
+        return G4ENC_INVALID_PARAMETER;
+    if (pImage->ucFillOrder != G4ENC_MSB_FIRST && pImage->ucFillOrder != G4ENC_LSB_FIRST)
+        return G4ENC_NOT_INITIALIZED;
+    if (pImage->y >= pImage->iHeight) // nothing left to add
+        return G4ENC_IMAGE_COMPLETE;
+    memcpy(&bb, &pImage->bb, sizeof(BUFFERED_BITS)); // keep local copy
+    CurFlips = pImage->pCur;
+    RefFlips = pImage->pRef;
+    pPrev = (pImage->bPrevLine) ? pImage->pPrevLine : NULL;
+    iErr = G4ENC_SUCCESS;
+    xsize = pImage->iWidth; /* For performance reasons */
+    y = pImage->y;
+    if (iCount > pImage->iHeight - y)
+        iCount = pImage->iHeight - y;
+    iHighWater = pImage->iFileBufSize - G4ENC_MAX_LINE_SIZE(xsize); // leave room for a worst case line + EOFB
+    iStripEnd = pImage->iHeight; // first line of the next strip
+    if (pImage->iRowsPerStrip && (y / pImage->iRowsPerStrip + 1) * pImage->iRowsPerStrip < iStripEnd)
+        iStripEnd = (y / pImage->iRowsPerStrip + 1) * pImage->iRowsPerStrip;
+    iStripRows = (pImage->iRowsPerStrip) ? pImage->iRowsPerStrip : pImage->iHeight;
+
+    while (iCount--) {
+        if (pImage->pPingPong[0] != NULL && G4ENC_GET_BUSY(pImage, pImage->iActive)) {
+            iErr = G4ENC_BUSY; // the rest of the lines must be added again
+            break;
+        }
+        if (pImage->iT4K) { // T.4: the first line of each strip and every Kth one after it are 1D
+            b1D = (((y % iStripRows) % pImage->iT4K) == 0);
+            G4ENCAddEOL(&bb, pImage->iT4K, pImage->iT4Options, b1D);
+        }
+        iStartBit = (int)(bb.pBuf - pImage->pFileBuf) * 8 + (int)bb.ulBitOff;
+        bRepeat = (iFormat == G4ENC_PIXEL_1BPP && pPrev != NULL && G4ENCSameLine(pPixels, pPrev, xsize));
+        if (bRepeat) { // same as the line above; the reference line is reused
+            if (b1D)
+                G4ENCCodeLine1D(&bb, RefFlips, xsize);
+            else
+                G4ENCRepeatLine(&bb, RefFlips, xsize);
+        } else {
+            // Convert the incoming line of pixels into run-end data
+            if (iFormat == G4ENC_PIXEL_OBD) { // row N of the page
+                G4ENCOBDLine(pPixels, xsize, iRow, CurFlips);
+            } else if (iFormat == G4ENC_PIXEL_RUNS) { // already in CurFlips
+            } else if (iFormat != G4ENC_PIXEL_1BPP) {
+                G4ENCThresholdLine(pPixels, xsize, iFormat, iThreshold, CurFlips);
+            } else if (G4ENCBlankLine(pPixels, xsize)) {
+                for (iLen=0; iLen<4; iLen++) // the coder stops at the first entry of xsize
+                    CurFlips[iLen] = xsize;
+            } else {
+                G4ENCEncodeLine(pPixels, xsize, CurFlips);
+            }
+            if (bMirror)
+                G4ENCMirrorRuns(CurFlips, xsize);
+            if (b1D)
+                G4ENCCodeLine1D(&bb, CurFlips, xsize);
+            else
+                G4ENCCodeLine(&bb, CurFlips, RefFlips, xsize);
+        }
+        G4ENC_STAT(&bb, G4ENCStatLine(pS, y, (int)(bb.pBuf - pImage->pFileBuf) * 8 + (int)bb.ulBitOff - iStartBit));
+        if (pImage->pVerify && (y % pImage->iVerifyInterval) == 0) {
+            iErr = G4ENCVerifyLine(pImage, &bb, iStartBit, (bRepeat) ? RefFlips : CurFlips, RefFlips);
+            if (iErr != G4ENC_SUCCESS) {
+                pImage->iError = iErr;
+                break;
+            }
+        }
+        pPrev = (iFormat == G4ENC_PIXEL_1BPP) ? pPixels : NULL;
+        pPixels += iPitch;
+        iRow++;
+        if (!bRepeat) {
+            pTemp = CurFlips; // swap current and reference lines
+            CurFlips = RefFlips;
+            RefFlips = pTemp;
+        }
+        y++;
+        if (y == iStripEnd) { // last line of the strip
+            if (pImage->iT4K) { // T.4 RTC = 6 EOLs (with a 1D tag bit for 2D)
+                for (iLen=0; iLen<6; iLen++)
+                    G4ENCInsertCode(&bb, (pImage->iT4K > 1) ? 3 : 1, (pImage->iT4K > 1) ? 13 : 12);
+            } else {
+              /* Add two EOL's to the end for RTC */
+                G4ENCInsertCode(&bb, 1, 12); /* EOL */
+                G4ENCInsertCode(&bb, 1, 12); /* EOL */
+            }
+            G4ENC_STAT(&bb, pS->ulEOLBits += (pImage->iT4K) ? ((pImage->iT4K > 1) ? 78 : 72) : 24; pS->ulFillBits += 8 - (bb.ulBitOff & 7));
+            G4ENCFlushBits(&bb); // output the final buffered bits
+            iLen = (int)(bb.pBuf-pImage->pFileBuf);
+            if (pImage->pStripSizes) {
+                pImage->pStripSizes[pImage->iStrip] = (uint32_t)(pImage->iDataSize + iLen - pImage->iStripStart);
+            }
+            pImage->iStripStart = pImage->iDataSize + iLen;
+            pImage->iStrip++;
+            if (y == pImage->iHeight) { // last line of image
+                // wrap up final output
+                iErr = G4ENCWriteData(pImage, iLen);
+                if (iErr == G4ENC_SUCCESS && pImage->pBlockBuf != NULL)
+                    iErr = G4ENCFinishBlocks(pImage);
+                if (iErr != G4ENC_SUCCESS)
+                    break;
+                bb.pBuf = pImage->pFileBuf;
+                iErr = (pImage->pfnSeek) ? G4ENCFinishTIFF(pImage) : G4ENC_IMAGE_COMPLETE; // streaming a TIFF file
+            } else { // the next strip starts from an imaginary all white line
+                for (iLen=0; iLen<4; iLen++) // the coder stops at the first entry of xsize
+                    RefFlips[iLen] = xsize;
+                pPrev = pImage->pPrevLine;
+                memset(pPrev, 0xff, (xsize + 7) >> 3);
+                iStripEnd += pImage->iRowsPerStrip;
+                if (iStripEnd > pImage->iHeight)
+                    iStripEnd = pImage->iHeight;
+            }
+        }
+        if (y == pImage->iHeight) // the last line went out with the final write
+            break;
+        // The end of a strip is in the buffer before it can be handed over, so
+        // nothing is written to a double buffer after the sink has it
+        iLen = (int)(bb.pBuf-pImage->pFileBuf);
+        bFlush = (iLen >= iHighWater);
+        if (pImage->iFlushPolicy == G4ENC_FLUSH_LINES) // low latency; the complete bytes go out every N lines
+            bFlush |= ((y % pImage->iFlushValue) == 0);
+        else if (pImage->iFlushPolicy == G4ENC_FLUSH_BYTES) // or as soon as there are N bytes
+            bFlush |= (iLen + (int)(bb.ulBitOff >> 3) >= pImage->iFlushValue);
+        if (bFlush && (pImage->iFlushPolicy == G4ENC_FLUSH_LINES || pImage->iFlushPolicy == G4ENC_FLUSH_BYTES)) {
+            G4ENCPushBytes(&bb);
+            iLen = (int)(bb.pBuf-pImage->pFileBuf);
+        }
+        if (bFlush && iLen > 0) { // need to dump some data
+            // Our internal buffer is full, copy it to the user supplied buffer or pass it to the WRITE callback
+            iErr = G4ENCWriteData(pImage, iLen);
+            if (iErr != G4ENC_SUCCESS)
+                break;
+            bb.pBuf = pImage->pFileBuf; // reset to start of output buffer
+            iHighWater = pImage->iFileBufSize - G4ENC_MAX_LINE_SIZE(xsize);
+        }
+    } // while iCount
+    if (pPrev != NULL && pPrev != pImage->pPrevLine) // keep a copy of the last line for the next call
+        memcpy(pImage->pPrevLine, pPrev, (xsize + 7) >> 3);
+    pImage->bPrevLine = (pPrev != NULL);
+    pImage->pCur = CurFlips;
+    pImage->pRef = RefFlips;
+    pImage->y = y;
     memcpy(&pImage->bb, &bb, sizeof(bb));
     return iErr;
+} /* G4ENCAddLines() */
+//
+// Compress a group of lines and add them to the output
+// pPixels points to the first line and iPitch is the number of bytes from
+// one line to the next (use a negative pitch for bottom-up bitmaps)
+// The bit writer and line pointers stay in local variables for the whole group.
+// Returns G4ENC_SUCCESS if all is well and G4ENC_IMAGE_COMPLETE once the
+// last line of the image has been added
+//
+int G4ENC_addLines(G4ENCIMAGE *pImage, uint8_t *pPixels, int iPitch, int iCount)
+{
+    return G4ENCAddLines(pImage, pPixels, iPitch, iCount, G4ENC_PIXEL_1BPP, 0, 0);
+} /* G4ENC_addLines() */
+//
+// Compress a line of 8-bit grayscale pixels (1 byte per pixel, 0 = black)
+// Pixels darker than iThreshold (0-255) become black; G4ENC_THRESHOLD_AUTO
+// picks the level for each line from its darkest and brightest pixels
+// Returns the same values as G4ENC_addLine()
+//
+int G4ENC_addLineGray8(G4ENCIMAGE *pImage, uint8_t *pPixels, int iThreshold)
+{
+    if (iThreshold < G4ENC_THRESHOLD_AUTO || iThreshold > 255)
+        return G4ENC_INVALID_PARAMETER;
+    return G4ENCAddLines(pImage, pPixels, 0, 1, G4ENC_PIXEL_GRAY8, iThreshold, 0);
+} /* G4ENC_addLineGray8() */
+//
+// Compress a line of 24 or 32-bit color pixels
+// iFormat gives the byte order (G4ENC_PIXEL_RGB24/BGR24/RGBA32/BGRA32); the
+// alpha channel is ignored. The brightness of each pixel is compared with
+// iThreshold the same way as G4ENC_addLineGray8()
+//
+int G4ENC_addLineRGB(G4ENCIMAGE *pImage, uint8_t *pPixels, int iFormat, int iThreshold)
+{
+    if (iFormat < G4ENC_PIXEL_RGB24 || iFormat > G4ENC_PIXEL_BGRA32 || iThreshold < G4ENC_THRESHOLD_AUTO || iThreshold > 255)
+        return G4ENC_INVALID_PARAMETER;
+    return G4ENCAddLines(pImage, pPixels, 0, 1, iFormat, iThreshold, 0);
+} /* G4ENC_addLineRGB() */
+//
+// Compress a line given as its run-ends instead of pixels
+// pRunEnds holds the iCount x positions where the color changes, starting
+// from white (a line which starts black begins with 0); e.g. {10, 20} is
+// black from 10 to 19. The positions must increase and be <= the image
+// width (a position equal to the width ends the list). The list goes
+// straight to the coder, so code which already knows its spans (bar codes,
+// text, rectangles) doesn't need a line buffer. iCount = 0 is a white line.
+// The lists returned by G4DEC_getRunEnds() can be passed back as they are.
+// Returns the same values as G4ENC_addLine()
+//
+int G4ENC_addRunLine(G4ENCIMAGE *pImage, const G4ENC_FLIP *pRunEnds, int iCount)
+{
+G4ENC_FLIP *pFlips;
+int i, xsize;
+
+    if (pImage == NULL || iCount < 0 || (pRunEnds == NULL && iCount != 0))
+        return G4ENC_INVALID_PARAMETER;
+    if (pImage->ucFillOrder != G4ENC_MSB_FIRST && pImage->ucFillOrder != G4ENC_LSB_FIRST)
+        return G4ENC_NOT_INITIALIZED;
+    if (pImage->y >= pImage->iHeight) // nothing left to add
+        return G4ENC_IMAGE_COMPLETE;
+    xsize = pImage->iWidth;
+    pFlips = pImage->pCur; // free until the line is coded
+    for (i=0; i<iCount && pRunEnds[i] < xsize; i++) {
+        if (pRunEnds[i] < 0 || (i > 0 && pRunEnds[i] <= pRunEnds[i-1]))
+            return G4ENC_INVALID_PARAMETER;
+        pFlips[i] = pRunEnds[i];
+    }
+    if (i < iCount && pRunEnds[i] > xsize)
+        return G4ENC_INVALID_PARAMETER;
+    for (iCount=0; iCount<4; iCount++) // the coder stops at the first entry of xsize
+        pFlips[i+iCount] = xsize;
+    return G4ENCAddLines(pImage, (uint8_t *)pFlips, 0, 1, G4ENC_PIXEL_RUNS, 0, 0);
+} /* G4ENC_addRunLine() */
+//
+// Compress the next 8 lines (or the rest of the image) from a page of a
+// OneBitDisplay image buffer; pPage points to the page of iWidth bytes where
+// each byte is a column of 8 pixels (bit 0 = top row, set = black),
+// e.g. &ucBuffer[(y / 8) * iWidth]. The lines don't need to be converted first.
+// The image must be on an 8 line boundary.
+// Returns the same values as G4ENC_addLines()
+//
+int G4ENC_addOBDPage(G4ENCIMAGE *pImage, uint8_t *pPage)
+{
+    if (pImage == NULL || (pImage->y & 7) != 0)
+        return G4ENC_INVALID_PARAMETER;
+    return G4ENCAddLines(pImage, pPage, 0, 8, G4ENC_PIXEL_OBD, 0, 0);
+} /* G4ENC_addOBDPage() */
+//
+// Compress a line of pixels and add it to the output
+// the input format is expected to be MSB (most significant bit) first
+// for example, pixel 0 is in byte 0 at bit 7 (0x80)
+// Returns G4ENC_SUCCESS for each line if all is well and G4ENC_IMAGE_COMPLETE
+// for the last line
+//
+int G4ENC_addLine(G4ENCIMAGE *pImage, uint8_t *pPixels)
+{
+    return G4ENC_addLines(pImage, pPixels, 0, 1);
 } /* G4ENC_addLine() */
 //
+// Compress all of the remaining lines of the image in one call
+// pPixels points to the first (top) line and iPitch is the number of bytes
+// from one line to the next (negative for bottom-up bitmaps)
+// Returns G4ENC_IMAGE_COMPLETE if successful
+//
+int G4ENC_encodeImage(G4ENCIMAGE *pImage, uint8_t *pPixels, int iPitch)
+{
+    if (pImage == NULL)
+        return G4ENC_INVALID_PARAMETER;
+    return G4ENC_addLines(pImage, pPixels, iPitch, pImage->iHeight - pImage->y);
+} /* G4ENC_encodeImage() */
+#if G4ENC_MAX_WIDTH > 0
+//
+// Compress the rest of the image from the columns of a framebuffer which is
+// turned by 90 or 270 degrees. The byte column holding the next line is turned
+// into 8 lines with 8x8 bit transposes, so only those 8 lines are held at once
+// (on the stack, which limits the image to G4ENC_MAX_WIDTH pixels wide)
+//
+static int G4ENCAddColumns(G4ENCIMAGE *pImage, uint8_t *pPixels, int iPitch, int iRotation, int bMirror)
+{
+uint8_t ucBand[8 * ((G4ENC_MAX_WIDTH + 7) >> 3)], *s, *d;
+uint64_t u64;
+int i, x, c, iBandPitch, iErr, xsize;
+
+    xsize = pImage->iWidth; // = the height of the framebuffer
+    if (xsize > G4ENC_MAX_WIDTH)
+        return G4ENC_INVALID_PARAMETER;
+    iBandPitch = (xsize + 7) >> 3;
+    iErr = (pImage->y < pImage->iHeight) ? G4ENC_SUCCESS : G4ENC_IMAGE_COMPLETE;
+    while (iErr == G4ENC_SUCCESS) {
+        // framebuffer column of the next line; 90 reads them left to right
+        // (and each one bottom to top), 270 reads them right to left
+        c = (iRotation == G4ENC_ROTATE_90) ? pImage->y : pImage->iHeight - 1 - pImage->y;
+        s = &pPixels[c >> 3];
+        d = ucBand;
+        for (x=0; x<xsize; x+=8) {
+            u64 = 0;
+            if (x + 8 <= xsize) {
+                for (i=0; i<8; i++) // the top row becomes the MSB
+                    u64 = (u64 << 8) | s[i * iPitch];
+            } else { // partial group at the bottom
+                for (i=0; i<8; i++)
+                    u64 = (u64 << 8) | ((x + i < xsize) ? s[i * iPitch] : 0);
+            }
+            u64 = G4ENCTranspose8x8(u64); // byte 7-N is column N
+            d[0] = (uint8_t)(u64 >> 56);
+            d[iBandPitch] = (uint8_t)(u64 >> 48);
+            d[iBandPitch*2] = (uint8_t)(u64 >> 40);
+            d[iBandPitch*3] = (uint8_t)(u64 >> 32);
+            d[iBandPitch*4] = (uint8_t)(u64 >> 24);
+            d[iBandPitch*5] = (uint8_t)(u64 >> 16);
+            d[iBandPitch*6] = (uint8_t)(u64 >> 8);
+            d[iBandPitch*7] = (uint8_t)u64;
+            d++;
+            s += iPitch * 8;
+        }
+        if (iRotation == G4ENC_ROTATE_90)
+            iErr = G4ENCAddLines(pImage, &ucBand[(c & 7) * iBandPitch], iBandPitch, 8 - (c & 7), G4ENC_PIXEL_1BPP, 0, !bMirror);
+        else
+            iErr = G4ENCAddLines(pImage, &ucBand[(c & 7) * iBandPitch], -iBandPitch, (c & 7) + 1, G4ENC_PIXEL_1BPP, 0, bMirror);
+    }
+    return iErr;
+} /* G4ENCAddColumns() */
+#endif // G4ENC_MAX_WIDTH > 0
+//
+// Compress the rest of the image from a framebuffer in its native orientation
+// The image is the framebuffer turned clockwise by G4ENC_ROTATE_0/90/180/270,
+// optionally mirrored left to right afterwards with G4ENC_MIRROR (e.g.
+// G4ENC_ROTATE_90 | G4ENC_MIRROR). Initialize the encoder with the size of the
+// turned image; pPixels/iPitch are the framebuffer (1-bpp, MSB first), which is
+// iHeight pixels wide for 90 and 270. No rotated copy is made: 180 reads the
+// lines bottom up and mirrors their run-ends, 90 and 270 use 8 lines of stack.
+// Returns G4ENC_IMAGE_COMPLETE if successful
+//
+int G4ENC_encodeRotated(G4ENCIMAGE *pImage, uint8_t *pPixels, int iPitch, int iOrientation)
+{
+int y, iRotation, bMirror;
+
+    if (pImage == NULL || pPixels == NULL || iOrientation < 0 || iOrientation > (G4ENC_ROTATE_270 | G4ENC_MIRROR))
+        return G4ENC_INVALID_PARAMETER;
+    if (pImage->ucFillOrder != G4ENC_MSB_FIRST && pImage->ucFillOrder != G4ENC_LSB_FIRST)
+        return G4ENC_NOT_INITIALIZED;
+    iRotation = iOrientation & 3;
+    bMirror = (iOrientation & G4ENC_MIRROR) != 0;
+    y = pImage->y;
+    if (iRotation == G4ENC_ROTATE_0)
+        return G4ENCAddLines(pImage, &pPixels[y * iPitch], iPitch, pImage->iHeight - y, G4ENC_PIXEL_1BPP, 0, bMirror);
+    if (iRotation == G4ENC_ROTATE_180)
+        return G4ENCAddLines(pImage, &pPixels[(pImage->iHeight - 1 - y) * iPitch], -iPitch, pImage->iHeight - y, G4ENC_PIXEL_1BPP, 0, !bMirror);
+#if G4ENC_MAX_WIDTH > 0
+    return G4ENCAddColumns(pImage, pPixels, iPitch, iRotation, bMirror);
+#else
+    return G4ENC_INVALID_PARAMETER;
+#endif
+} /* G4ENC_encodeRotated() */
+//
+// Integer square root for the estimate's error bound
+//
+static uint64_t G4ENCSqrt(uint64_t u)
+{
+    uint64_t r = 0, b = (uint64_t)1 << 62;
+    while (b > u)
+        b >>= 2;
+    while (b) {
+        if (u >= r + b) {
+            u -= r + b;
+            r = (r >> 1) + b;
+        } else {
+            r >>= 1;
+        }
+        b >>= 2;
+    }
+    return r;
+} /* G4ENCSqrt() */
+//
+// Returns the number of bits needed to code one line of an image (for the estimate)
+// The line is coded against the line above it or the imaginary white line
+// at the top of a strip; the staging buffer is used as scratch space
+// T.4 lines include their EOL (fill bits are counted as half a byte) and
+// the 1D lines are coded by themselves
+//
+static int G4ENCLineBits(G4ENCIMAGE *pImage, uint8_t *pPixels, int iPitch, int y, int bTop)
+{
+BUFFERED_BITS bb;
+int i, b1D = 0, iEOL = 0, xsize = pImage->iWidth;
+
+    if (pImage->iT4K) {
+        i = (pImage->iRowsPerStrip) ? pImage->iRowsPerStrip : pImage->iHeight;
+        b1D = (((y % i) % pImage->iT4K) == 0);
+        iEOL = ((pImage->iT4K > 1) ? 13 : 12) + ((pImage->iT4Options & G4ENC_T4_EOL_ALIGN) ? 4 : 0);
+    }
+    if (bTop || b1D) { // (1D lines don't use the reference line)
+        for (i=0; i<4; i++) // the coder stops at the first entry of xsize
+            pImage->pRef[i] = xsize;
+    } else {
+        G4ENCEncodeLine(&pPixels[(y-1) * iPitch], xsize, pImage->pRef);
+    }
+    G4ENCEncodeLine(&pPixels[y * iPitch], xsize, pImage->pCur);
+    bb.pBuf = pImage->pStageBuf; // room for a worst case line
+    bb.ulBits = 0;
+    bb.ulBitOff = 0;
+    bb.ulMirror = 0;
+#ifdef G4ENC_STATS
+    bb.pStats = NULL; // not part of the image
+#endif
+    if (b1D)
+        G4ENCCodeLine1D(&bb, pImage->pCur, xsize);
+    else
+        G4ENCCodeLine(&bb, pImage->pCur, pImage->pRef, xsize);
+    return (int)(bb.pBuf - pImage->pStageBuf) * 8 + (int)bb.ulBitOff + iEOL;
+} /* G4ENCLineBits() */
+//
+// Estimate the compressed size of the whole image by coding a sample of its lines
+// The code for a line only depends on that line and the one above, so the
+// first line of each strip (coded against white and usually the most expensive)
+// is counted exactly and one random line out of every iInterval of the rest is
+// counted and scaled up; nothing is written. *pError (if not NULL) receives a bound
+// of 2 standard errors (about 95% confidence) in bytes.
+// The cost is about 1/iInterval of a full encode; for an exact size, encode
+// the image with no output buffer or callback (see G4ENC_init).
+// Must be called before any lines are added (after G4ENC_setStrips if used);
+// the encoder is left ready to encode the image.
+// Returns the estimated size in bytes or 0 if the parameters are invalid
+//
+int G4ENC_estimateSize(G4ENCIMAGE *pImage, uint8_t *pPixels, int iPitch, int iInterval, int *pError)
+{
+int i, y, iBits, iSamples, iHeight, iBlock, iRows, iOthers;
+int64_t llExact, llSum, llSumSq, llVar, llEstimate, llError;
+uint32_t u32Seed;
+
+    if (pImage == NULL || pPixels == NULL || iInterval < 1)
+        return 0;
+    if (pImage->ucFillOrder != G4ENC_MSB_FIRST && pImage->ucFillOrder != G4ENC_LSB_FIRST)
+        return 0;
+    if (pImage->y != 0) // the staging buffer and run-ends are still free to use
+        return 0;
+    iHeight = pImage->iHeight;
+    iRows = (pImage->iRowsPerStrip) ? pImage->iRowsPerStrip : iHeight;
+    llExact = 0;
+    for (y=0; y<iHeight; y+=iRows) // first line of each strip
+        llExact += G4ENCLineBits(pImage, pPixels, iPitch, y, 1);
+    iOthers = iHeight - pImage->iStripCount;
+    llSum = llSumSq = 0;
+    iSamples = 0;
+    u32Seed = 0x2545f491; // fixed seed so the estimate is repeatable
+    for (iBlock = 0; iBlock < iHeight; iBlock += iInterval) {
+        // pick a random line out of each group of iInterval lines so that
+        // patterns which repeat every few lines can't line up with the samples
+        i = iHeight - iBlock;
+        if (i > iInterval)
+            i = iInterval;
+        u32Seed = u32Seed * 1664525 + 1013904223;
+        y = iBlock + (int)((u32Seed >> 8) % (uint32_t)i);
+        if ((y % iRows) == 0) { // already counted; use the next line
+            if (y + 1 >= iBlock + i || ((y + 1) % iRows) == 0)
+                continue;
+            y++;
+        }
+        iBits = G4ENCLineBits(pImage, pPixels, iPitch, y, 0);
+        llSum += iBits;
+        llSumSq += (int64_t)iBits * iBits;
+        iSamples++;
+    }
+    for (i=0; i<4; i++) { // leave the run-ends as G4ENC_init() does
+        pImage->pCur[i] = pImage->pRef[i] = pImage->iWidth;
+    }
+    llEstimate = llExact;
+    if (iSamples)
+        llEstimate += llSum * iOthers / iSamples; // total bits
+    // each strip ends with an EOFB (24 bits) or a T.4 RTC (6 EOLs) and a partial byte
+    i = (pImage->iT4K == 0) ? 24 : (pImage->iT4K == 1) ? 72 : 78;
+    llEstimate = ((llEstimate + i * pImage->iStripCount) >> 3) + pImage->iStripCount;
+    if (pError) {
+        llError = 0;
+        if (iSamples > 1 && iSamples < iOthers) {
+            llVar = (llSumSq - (llSum * llSum) / iSamples) / (iSamples - 1);
+            // standard error of the total = sqrt(var * N * (N - samples) / samples)
+            llError = (int64_t)(G4ENCSqrt((uint64_t)(llVar * (iOthers - iSamples) / iSamples)) * G4ENCSqrt((uint64_t)iOthers << 8)) >> 4;
+            llError = (2 * llError + 7) >> 3; // 2 standard errors in bytes
+        }
+        *pError = (int)llError + pImage->iStripCount; // + rounding of each strip
+    }
+    return (llEstimate > 0x7fffffff) ? 0x7fffffff : (int)llEstimate;
+} /* G4ENC_estimateSize() */
+//
+// Snapshot fields are stored as variable length (7 bits per byte) numbers
+//
+static uint8_t * G4ENCPutNumber(uint8_t *d, uint32_t u)
+{
+    while (u >= 0x80) {
+        *d++ = (uint8_t)(u | 0x80);
+        u >>= 7;
+    }
+    *d++ = (uint8_t)u;
+    return d;
+} /* G4ENCPutNumber() */
+
+static const uint8_t * G4ENCGetNumber(const uint8_t *s, const uint8_t *pEnd, int *pValue)
+{
+uint32_t u = 0;
+int iShift = 0;
+
+    *pValue = 0;
+    while (s != NULL && s < pEnd && iShift < 32) {
+        u |= (uint32_t)(*s & 0x7f) << iShift;
+        iShift += 7;
+        if ((*s++ & 0x80) == 0) {
+            *pValue = (int)(u & 0x7fffffff);
+            return s;
+        }
+    }
+    return NULL; // ran off the end of the snapshot
+} /* G4ENCGetNumber() */
+//
+// Save the state needed to continue encoding the current image in a compact
+// form (e.g. to RTC memory or flash before a deep sleep): the line count,
+// the output size, the bits not yet written out and the reference line as
+// run lengths. The complete bytes waiting in the staging buffer are passed
+// to the output first, so everything before the pending bits has been
+// written when this returns. pState needs up to G4ENC_MAX_STATE_SIZE(iWidth)
+// bytes; a typical snapshot is a few dozen bytes.
+// Streamed TIFF files and frame sequences can't be saved.
+// Returns the size of the snapshot in bytes or 0 if it couldn't be saved
+//
+int G4ENC_saveState(G4ENCIMAGE *pImage, uint8_t *pState, int iStateSize)
+{
+uint8_t *d;
+BIGUINT ulBits;
+int i, iLen;
+
+    if (pImage == NULL || pState == NULL || iStateSize < G4ENC_MAX_STATE_SIZE(pImage->iWidth))
+        return 0;
+    if (pImage->ucFillOrder != G4ENC_MSB_FIRST && pImage->ucFillOrder != G4ENC_LSB_FIRST)
+        return 0;
+    if (pImage->pfnSeek != NULL || pImage->pFrameBuf != NULL || pImage->pBlockBuf != NULL || pImage->iError != G4ENC_SUCCESS)
+        return 0;
+    iLen = (int)(pImage->bb.pBuf - pImage->pFileBuf);
+    if (iLen > 0) { // the staging buffer doesn't survive
+        if (G4ENCWriteData(pImage, iLen) != G4ENC_SUCCESS)
+            return 0;
+        pImage->bb.pBuf = pImage->pFileBuf;
+    }
+    d = pState;
+    *d++ = 1; // snapshot version
+    d = G4ENCPutNumber(d, (uint32_t)pImage->iWidth);
+    d = G4ENCPutNumber(d, (uint32_t)pImage->iHeight);
+    d = G4ENCPutNumber(d, (uint32_t)pImage->iT4K);
+    d = G4ENCPutNumber(d, (uint32_t)pImage->y);
+    d = G4ENCPutNumber(d, (uint32_t)pImage->iDataSize);
+    d = G4ENCPutNumber(d, (uint32_t)pImage->iStrip);
+    d = G4ENCPutNumber(d, (uint32_t)pImage->iStripStart);
+    d = G4ENCPutNumber(d, pImage->bb.ulBitOff);
+    ulBits = pImage->bb.ulBits; // the pending bits start at the top of the accumulator
+    for (i=0; i<(int)pImage->bb.ulBitOff; i+=8) {
+        *d++ = (uint8_t)(ulBits >> (REGISTER_WIDTH - 8));
+        ulBits <<= 8;
+    }
+    i = 0;
+    while (pImage->pRef[i] < pImage->iWidth)
+        i++;
+    d = G4ENCPutNumber(d, (uint32_t)i);
+    for (i=0; pImage->pRef[i] < pImage->iWidth; i++) // run lengths are smaller than run-ends
+        d = G4ENCPutNumber(d, (uint32_t)(pImage->pRef[i] - ((i) ? pImage->pRef[i-1] : 0)));
+    return (int)(d - pState);
+} /* G4ENC_saveState() */
+//
+// Continue encoding an image from a snapshot made by G4ENC_saveState()
+// Initialize the encoder for the same image first (same size, output and
+// settings such as strips and T.4); with an output buffer, the data already
+// written to it must still be there. The next line added is the one which
+// followed the snapshot and the output is the same as if there had been no break.
+// The strip sizes of the strips finished before the snapshot aren't restored.
+//
+int G4ENC_restoreState(G4ENCIMAGE *pImage, const uint8_t *pState, int iStateSize)
+{
+const uint8_t *s, *pEnd, *pBits;
+G4ENC_FLIP *pFlips;
+int i, iValue, iBits, iCount, iStrip, x;
+int iVals[7];
+
+    if (pImage == NULL || pState == NULL || iStateSize < 1)
+        return G4ENC_INVALID_PARAMETER;
+    if (pImage->ucFillOrder != G4ENC_MSB_FIRST && pImage->ucFillOrder != G4ENC_LSB_FIRST)
+        return G4ENC_NOT_INITIALIZED;
+    if (pImage->y != 0 || pImage->pfnSeek != NULL || pState[0] != 1)
+        return G4ENC_INVALID_PARAMETER;
+    s = &pState[1];
+    pEnd = &pState[iStateSize];
+    for (i=0; i<7; i++) // width, height, K, y, data size, strip, strip start
+        s = G4ENCGetNumber(s, pEnd, &iVals[i]);
+    s = G4ENCGetNumber(s, pEnd, &iBits);
+    if (s == NULL || iVals[0] != pImage->iWidth || iVals[1] != pImage->iHeight || iVals[2] != pImage->iT4K)
+        return G4ENC_INVALID_PARAMETER;
+    if (iVals[3] == pImage->iHeight) // the image was finished
+        iStrip = pImage->iStripCount;
+    else
+        iStrip = (pImage->iRowsPerStrip) ? iVals[3] / pImage->iRowsPerStrip : 0;
+    if (iVals[3] > pImage->iHeight || iVals[4] < iVals[6] || iVals[5] != iStrip || iBits > 64 || pEnd - s < (iBits + 7) >> 3)
+        return G4ENC_INVALID_PARAMETER;
+    if (!G4ENC_HAS_WRITER(pImage) && pImage->pOutBuf != NULL && iVals[4] >= pImage->iOutSize)
+        return G4ENC_DATA_OVERFLOW;
+    pBits = s;
+    s = G4ENCGetNumber(s + ((iBits + 7) >> 3), pEnd, &iCount);
+    if (s == NULL || iCount > pImage->iWidth)
+        return G4ENC_INVALID_PARAMETER;
+    pFlips = pImage->pRef; // still an all white line
+    for (i=0, x=0; i<iCount && s != NULL; i++) {
+        s = G4ENCGetNumber(s, pEnd, &iValue);
+        x += iValue;
+        if ((i > 0 && iValue == 0) || x >= pImage->iWidth) // must go left to right
+            s = NULL;
+        pFlips[i] = (G4ENC_FLIP)x;
+    }
+    if (s == NULL) // damaged snapshot; put the white line back
+        i = 0;
+    for (iValue=0; iValue<4; iValue++) // the coder stops at the first entry of xsize
+        pFlips[i + iValue] = pImage->iWidth;
+    if (s == NULL)
+        return G4ENC_INVALID_PARAMETER;
+    pImage->y = iVals[3];
+    pImage->iDataSize = iVals[4];
+    pImage->iStrip = iVals[5];
+    pImage->iStripStart = iVals[6];
+    G4ENCSetOutput(pImage);
+    pImage->bb.pBuf = pImage->pFileBuf;
+    pImage->bb.ulBits = 0;
+    pImage->bb.ulBitOff = 0;
+    for (; iBits > 0; iBits -= 8) { // put the pending bits back
+        i = (iBits < 8) ? iBits : 8;
+        G4ENCInsertCode(&pImage->bb, (BIGUINT)(*pBits++ >> (8 - i)), i);
+    }
+    pImage->bPrevLine = 0; // the pixels of the reference line aren't kept
+    return G4ENC_SUCCESS;
+} /* G4ENC_restoreState() */
+//
+// Start encoding a sequence of frames (e.g. updates of an e-paper display)
+// pFrameBuf holds a copy of the previous frame: ((iWidth + 7) / 8) * iHeight
+// bytes which stay valid for the whole sequence. Call after G4ENC_init();
+// the output settings are reused for every frame. The frame header holds
+// 16-bit sizes, so frames can't be larger than 65535 x 65535.
+//
+int G4ENC_startFrames(G4ENCIMAGE *pImage, uint8_t *pFrameBuf)
+{
+    if (pImage == NULL || pFrameBuf == NULL)
+        return G4ENC_INVALID_PARAMETER;
+    if (pImage->ucFillOrder != G4ENC_MSB_FIRST && pImage->ucFillOrder != G4ENC_LSB_FIRST)
+        return G4ENC_NOT_INITIALIZED;
+    if (pImage->y != 0 || pImage->pfnSeek != NULL)
+        return G4ENC_INVALID_PARAMETER;
+    if (pImage->iWidth > 0xffff || pImage->iHeight > 0xffff) // doesn't fit the frame header
+        return G4ENC_INVALID_PARAMETER;
+    pImage->pFrameBuf = pFrameBuf;
+    pImage->iFrame = 0;
+    return G4ENC_SUCCESS;
+} /* G4ENC_startFrames() */
+//
+// Encode the next frame of a sequence as a frame header + a single G4 strip
+// (written from the start of the output buffer or through the write callback)
+// iFlags = G4ENC_FRAME_DELTA codes only the difference from the previous frame:
+// the unchanged pixels become white, so a small update codes to little more than
+// a V0 per line. The first frame and G4ENC_FRAME_KEY code the whole frame
+// (e.g. to let a receiver which missed a frame catch up). pPixels/iPitch
+// are the frame (1-bpp, MSB first). The copy of the previous frame is only
+// updated when the frame is complete, so a failed frame can be sent again.
+// Returns G4ENC_IMAGE_COMPLETE if successful
+//
+int G4ENC_encodeFrame(G4ENCIMAGE *pImage, uint8_t *pPixels, int iPitch, int iFlags)
+{
+uint8_t *pFrameBuf, *s, *d;
+int x, y, rc, iFrame, iFramePitch, bDelta;
+
+    if (pImage == NULL || pPixels == NULL || (iFlags & ~G4ENC_FRAME_DELTA) != 0)
+        return G4ENC_INVALID_PARAMETER;
+    if (pImage->ucFillOrder != G4ENC_MSB_FIRST && pImage->ucFillOrder != G4ENC_LSB_FIRST)
+        return G4ENC_NOT_INITIALIZED;
+    if (pImage->pFrameBuf == NULL) // G4ENC_startFrames() wasn't called
+        return G4ENC_NOT_INITIALIZED;
+    pFrameBuf = pImage->pFrameBuf;
+    iFrame = pImage->iFrame;
+    rc = G4ENCInitState(pImage, pImage->iWidth, pImage->iHeight, pImage->ucFillOrder, pImage->pfnWrite, pImage->pOutBuf, pImage->iOutSize, pImage->pCur, pImage->pRef, pImage->pStageBuf, pImage->iStageBufSize, pImage->pPrevLine);
+    if (rc != G4ENC_SUCCESS)
+        return rc;
+    pImage->pFrameBuf = pFrameBuf;
+    pImage->iFrame = iFrame;
+    if (pImage->pPingPong[0] != NULL && G4ENC_GET_BUSY(pImage, pImage->iActive))
+        return G4ENC_BUSY; // nowhere to put the header
+    bDelta = (iFrame > 0 && iFlags != G4ENC_FRAME_KEY);
+    d = pImage->bb.pBuf; // the header goes in front of the G4 data
+    d[0] = (uint8_t)((bDelta) ? G4ENC_FRAME_DELTA : G4ENC_FRAME_KEY);
+    d[1] = (uint8_t)iFrame;
+    d[2] = (uint8_t)pImage->iWidth;
+    d[3] = (uint8_t)(pImage->iWidth >> 8);
+    d[4] = (uint8_t)pImage->iHeight;
+    d[5] = (uint8_t)(pImage->iHeight >> 8);
+    pImage->bb.pBuf += G4ENC_FRAME_HEADER_SIZE;
+    iFramePitch = (pImage->iWidth + 7) >> 3;
+    if (bDelta) { // the previous frame becomes the difference (white = unchanged)
+        for (y=0; y<pImage->iHeight; y++) {
+            s = &pPixels[y * iPitch];
+            d = &pFrameBuf[y * iFramePitch];
+            for (x=0; x<iFramePitch; x++)
+                d[x] = ~(d[x] ^ s[x]);
+        }
+        rc = G4ENCAddLines(pImage, pFrameBuf, iFramePitch, pImage->iHeight, G4ENC_PIXEL_1BPP, 0, 0);
+    } else {
+        rc = G4ENCAddLines(pImage, pPixels, iPitch, pImage->iHeight, G4ENC_PIXEL_1BPP, 0, 0);
+    }
+    for (y=0; y<pImage->iHeight && (bDelta || rc == G4ENC_IMAGE_COMPLETE); y++) {
+        s = &pPixels[y * iPitch];
+        d = &pFrameBuf[y * iFramePitch];
+        if (rc == G4ENC_IMAGE_COMPLETE) { // keep this frame for the next delta
+            memcpy(d, s, iFramePitch);
+        } else { // failed; put the previous frame back
+            for (x=0; x<iFramePitch; x++)
+                d[x] = ~d[x] ^ s[x];
+        }
+    }
+    if (rc == G4ENC_IMAGE_COMPLETE)
+        pImage->iFrame++;
+    return rc;
+} /* G4ENC_encodeFrame() */
+#if defined( __MACH__ ) || defined( __LINUX__ )
+//
+// Shared state of the strip encoding worker threads
+//
+typedef struct g4enc_strip_job_tag
+{
+    G4ENCIMAGE *pImage; // image being encoded (only its settings are read)
+    uint8_t *pPixels;
+    int iPitch;
+    int iNextStrip; // next strip to be claimed by a worker
+    uint8_t **pStripData; // compressed data of each strip
+    int *pStripSize;
+    int *pStripErr;
+} G4ENCSTRIPJOB;
+//
+// Output of a strip worker; it's reused for each strip it encodes and
+// only grows, so a worker needs about as much memory as its largest strip
+//
+typedef struct g4enc_strip_buf_tag
+{
+    uint8_t *pBuf;
+    int iLen, iSize;
+    int bNoMemory; // the buffer couldn't grow
+} G4ENCSTRIPBUF;
+//
+// Write callback which collects a strip's output
+//
+static int G4ENCStripWrite(void *pUser, uint8_t *pData, int iLen)
+{
+G4ENCSTRIPBUF *pOut = (G4ENCSTRIPBUF *)pUser;
+int64_t llSize;
+uint8_t *pNew;
+
+    if ((int64_t)pOut->iLen + iLen > pOut->iSize) {
+        llSize = (int64_t)pOut->iSize * 2; // grow by doubling
+        if (llSize < (int64_t)pOut->iLen + iLen + OUTPUT_BUF_SIZE)
+            llSize = (int64_t)pOut->iLen + iLen + OUTPUT_BUF_SIZE;
+        if (llSize > 0x7fffffff) // the output size is an int
+            llSize = 0x7fffffff;
+        if ((int64_t)pOut->iLen + iLen > llSize || (pNew = (uint8_t *)realloc(pOut->pBuf, (size_t)llSize)) == NULL) {
+            pOut->bNoMemory = 1;
+            return 0;
+        }
+        pOut->pBuf = pNew;
+        pOut->iSize = (int)llSize;
+    }
+    memcpy(&pOut->pBuf[pOut->iLen], pData, iLen);
+    pOut->iLen += iLen;
+    return iLen;
+} /* G4ENCStripWrite() */
+//
+// Worker thread which claims strips one at a time and encodes
+// each of them as an independent G4 image
+// Each strip is encoded into the worker's scratch buffer and then
+// copied to a buffer of its exact size
+//
+static void * G4ENCStripWorker(void *pArg)
+{
+G4ENCSTRIPJOB *pJob = (G4ENCSTRIPJOB *)pArg;
+G4ENCIMAGE *pImage = pJob->pImage;
+G4ENCIMAGE *pStrip;
+G4ENCSTRIPBUF out;
+void *pWorkspace;
+int iStrip, iRows, iFirst, rc;
+int iWorkspaceSize = G4ENC_getWorkspaceSize(pImage->iWidth);
+
+    memset(&out, 0, sizeof(out));
+    pStrip = (G4ENCIMAGE *)malloc(sizeof(G4ENCIMAGE));
+    pWorkspace = malloc(iWorkspaceSize);
+    while ((iStrip = __atomic_fetch_add(&pJob->iNextStrip, 1, __ATOMIC_RELAXED)) < pImage->iStripCount) {
+        iFirst = iStrip * pImage->iRowsPerStrip;
+        iRows = pImage->iHeight - iFirst;
+        if (iRows > pImage->iRowsPerStrip)
+            iRows = pImage->iRowsPerStrip;
+        if (pStrip == NULL || pWorkspace == NULL) {
+            pJob->pStripErr[iStrip] = G4ENC_NO_MEMORY;
+            continue;
+        }
+        out.iLen = 0;
+        rc = G4ENC_initWorkspace(pStrip, pImage->iWidth, iRows, pImage->ucFillOrder, NULL, NULL, 0, pWorkspace, iWorkspaceSize);
+        if (rc == G4ENC_SUCCESS)
+            rc = G4ENC_setWriteCallback(pStrip, G4ENCStripWrite, &out);
+        if (rc == G4ENC_SUCCESS)
+            rc = G4ENC_setT4(pStrip, pImage->iT4K, pImage->iT4Options);
+        if (rc == G4ENC_SUCCESS)
+            rc = G4ENC_encodeImage(pStrip, &pJob->pPixels[(int64_t)iFirst * pJob->iPitch], pJob->iPitch);
+        if (rc == G4ENC_IMAGE_COMPLETE) {
+            pJob->pStripData[iStrip] = (uint8_t *)malloc(out.iLen);
+            if (pJob->pStripData[iStrip] != NULL)
+                memcpy(pJob->pStripData[iStrip], out.pBuf, out.iLen);
+            else
+                rc = G4ENC_NO_MEMORY;
+        } else if (rc == G4ENC_WRITE_ERROR && out.bNoMemory) {
+            rc = G4ENC_NO_MEMORY;
+        }
+        pJob->pStripErr[iStrip] = (rc == G4ENC_IMAGE_COMPLETE) ? G4ENC_SUCCESS : rc;
+        pJob->pStripSize[iStrip] = out.iLen;
+    }
+    free(out.pBuf);
+    free(pWorkspace);
+    free(pStrip);
+    return NULL;
+} /* G4ENCStripWorker() */
+//
+// Set up a pool of iCount encoders (numbered 0 to iCount-1) which can be
+// shared by many threads; the caller owns the encoders themselves (e.g. an
+// array of G4ENCIMAGE) and uses the number returned by G4ENC_poolAcquire()
+// to pick one. Nothing is allocated, so a server can keep a pool for its
+// lifetime and G4ENC_reset() each encoder for the next image.
+//
+int G4ENC_poolInit(G4ENCPOOL *pPool, int iCount)
+{
+    if (pPool == NULL || iCount <= 0 || iCount > G4ENC_POOL_MAX)
+        return G4ENC_INVALID_PARAMETER;
+    if (pthread_mutex_init(&pPool->mutex, NULL) != 0)
+        return G4ENC_NO_MEMORY;
+    if (pthread_cond_init(&pPool->cond, NULL) != 0) {
+        pthread_mutex_destroy(&pPool->mutex);
+        return G4ENC_NO_MEMORY;
+    }
+    pPool->iCount = iCount;
+    for (pPool->iFree=0; pPool->iFree<iCount; pPool->iFree++)
+        pPool->iFreeList[pPool->iFree] = iCount - 1 - pPool->iFree; // encoder 0 is handed out first
+    return G4ENC_SUCCESS;
+} /* G4ENC_poolInit() */
+//
+// Take an encoder from the pool; waits for one to be released if they're
+// all in use (or returns -1 right away if bWait is 0)
+// The most recently released encoder is reused first since its memory
+// is the most likely to still be in the cache
+//
+int G4ENC_poolAcquire(G4ENCPOOL *pPool, int bWait)
+{
+int iEncoder = -1;
+
+    if (pPool == NULL)
+        return -1;
+    pthread_mutex_lock(&pPool->mutex);
+    while (pPool->iFree == 0 && bWait)
+        pthread_cond_wait(&pPool->cond, &pPool->mutex);
+    if (pPool->iFree > 0)
+        iEncoder = pPool->iFreeList[--pPool->iFree];
+    pthread_mutex_unlock(&pPool->mutex);
+    return iEncoder;
+} /* G4ENC_poolAcquire() */
+//
+// Return an encoder to the pool
+//
+int G4ENC_poolRelease(G4ENCPOOL *pPool, int iEncoder)
+{
+int i, iErr = G4ENC_SUCCESS;
+
+    if (pPool == NULL || iEncoder < 0 || iEncoder >= pPool->iCount)
+        return G4ENC_INVALID_PARAMETER;
+    pthread_mutex_lock(&pPool->mutex);
+    for (i=0; i<pPool->iFree; i++) {
+        if (pPool->iFreeList[i] == iEncoder) // released twice
+            iErr = G4ENC_INVALID_PARAMETER;
+    }
+    if (iErr == G4ENC_SUCCESS) {
+        pPool->iFreeList[pPool->iFree++] = iEncoder;
+        pthread_cond_signal(&pPool->cond);
+    }
+    pthread_mutex_unlock(&pPool->mutex);
+    return iErr;
+} /* G4ENC_poolRelease() */
+//
+// Free the pool's resources; none of the encoders may still be in use
+//
+void G4ENC_poolClose(G4ENCPOOL *pPool)
+{
+    if (pPool == NULL)
+        return;
+    pthread_cond_destroy(&pPool->cond);
+    pthread_mutex_destroy(&pPool->mutex);
+    pPool->iCount = pPool->iFree = 0;
+} /* G4ENC_poolClose() */
+//
+// Encode an entire image with each strip running on its own thread
+// pPixels points to the first (top) line of the 1-bpp image and iPitch is the
+// number of bytes from one line to the next. If iThreads is <= 0, one thread per
+// CPU core is used. The strips are written to the output in order, so the result
+// is identical to adding the lines one at a time with the same strip layout.
+// Returns G4ENC_IMAGE_COMPLETE if successful
+//
+int G4ENC_encodeStrips(G4ENCIMAGE *pImage, uint8_t *pPixels, int iPitch, int iThreads)
+{
+G4ENCSTRIPJOB job;
+pthread_t *pThreads;
+int i, iStrips, iErr;
+
+    if (pImage == NULL || pPixels == NULL)
+        return G4ENC_INVALID_PARAMETER;
+    if (pImage->ucFillOrder != G4ENC_MSB_FIRST && pImage->ucFillOrder != G4ENC_LSB_FIRST)
+        return G4ENC_NOT_INITIALIZED;
+    if (pImage->y != 0 || pImage->pPingPong[0] != NULL || pImage->pBlockBuf != NULL) // must encode the whole image
+        return G4ENC_INVALID_PARAMETER;
+    if (pImage->iRowsPerStrip == 0)
+        G4ENC_setStrips(pImage, pImage->iHeight, pImage->pStripSizes);
+    iStrips = pImage->iStripCount;
+    if (iThreads <= 0)
+        iThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (iThreads > iStrips)
+        iThreads = iStrips;
+    if (iThreads < 1)
+        iThreads = 1;
+    memset(&job, 0, sizeof(job));
+    job.pImage = pImage;
+    job.pPixels = pPixels;
+    job.iPitch = iPitch;
+    job.pStripData = (uint8_t **)calloc(iStrips, sizeof(uint8_t *));
+    job.pStripSize = (int *)calloc(iStrips, sizeof(int));
+    job.pStripErr = (int *)calloc(iStrips, sizeof(int));
+    pThreads = (pthread_t *)calloc(iThreads, sizeof(pthread_t));
+    iErr = G4ENC_SUCCESS;
+    if (job.pStripData == NULL || job.pStripSize == NULL || job.pStripErr == NULL || pThreads == NULL) {
+        iErr = G4ENC_NO_MEMORY;
+    } else {
+        for (i=1; i<iThreads; i++) { // the calling thread is worker 0
+            if (pthread_create(&pThreads[i], NULL, G4ENCStripWorker, &job) != 0)
+                break;
+        }
+        iThreads = i;
+        G4ENCStripWorker(&job);
+        for (i=1; i<iThreads; i++) {
+            pthread_join(pThreads[i], NULL);
+        }
+        // Write the strips in order
+        for (i=0; i<iStrips && iErr == G4ENC_SUCCESS; i++) {
+            iErr = job.pStripErr[i];
+            if (iErr != G4ENC_SUCCESS)
+                break;
+            if (G4ENC_HAS_WRITER(pImage)) {
+                if (G4ENCWrite(pImage, job.pStripData[i], job.pStripSize[i]) != job.pStripSize[i]) {
+                    iErr = G4ENC_WRITE_ERROR;
+                    break;
+                }
+            } else if (pImage->pOutBuf) {
+                if (pImage->iDataSize + job.pStripSize[i] >= pImage->iOutSize) { // not enough space
+                    iErr = G4ENC_DATA_OVERFLOW;
+                    break;
+                }
+                memcpy(&pImage->pOutBuf[pImage->iDataSize], job.pStripData[i], job.pStripSize[i]);
+            }
+            pImage->iDataSize += job.pStripSize[i];
+            if (pImage->pStripSizes)
+                pImage->pStripSizes[i] = (uint32_t)job.pStripSize[i];
+        }
+    }
+    if (job.pStripData) {
+        for (i=0; i<iStrips; i++) {
+            free(job.pStripData[i]);
+        }
+    }
+    free(job.pStripData);
+    free(job.pStripSize);
+    free(job.pStripErr);
+    free(pThreads);
+    if (iErr != G4ENC_SUCCESS) {
+        pImage->iError = iErr;
+        return iErr;
+    }
+    pImage->iStrip = iStrips;
+    pImage->iStripStart = pImage->iDataSize;
+    pImage->y = pImage->iHeight;
+    if (pImage->pfnSeek) // streaming a TIFF file
+        return G4ENCFinishTIFF(pImage);
+    return G4ENC_IMAGE_COMPLETE;
+} /* G4ENC_encodeStrips() */
+#endif // __MACH__ || __LINUX__
+//
 // Copy a line of pixels from a OneBitDisplay library image buffer
 // This function is here as a convenience to use image data from my
 // OneBitDisplay library since the memory is oriented differently.
+// The line's bit of 8 columns is gathered into a byte with one multiply.
 //
 void G4ENC_getOBDLine(int iWidth, uint8_t *pImage, int iLine, uint8_t *pPixels)
 {
-uint8_t *s, *d, uc, ucSrcMask, ucDstMask;
-int x;
+uint8_t *s, uc;
+int x, iRow;
     
-    ucDstMask = 0x80;
-    ucSrcMask = 1 << (iLine & 7);
-    uc = 0;
-    d = pPixels;
+    iRow = iLine & 7;
     s = &pImage[(iLine >> 3) * iWidth];
-    for (x=0; x<iWidth; x++) {
-        if (s[x] & ucSrcMask)
-            uc |= ucDstMask;
-        ucDstMask >>= 1;
-        if (ucDstMask == 0) { // time to write it
-            *d++ = ~uc;
-            uc = 0;
-            ucDstMask = 0x80;
-        }
-    } // for x
+    for (x=0; x+8<=iWidth; x+=8) {
+        *pPixels++ = ~(uint8_t)((((G4ENCLoad64(&s[x], 0) >> iRow) & 0x0101010101010101ULL) * 0x8040201008040201ULL) >> 56);
+    }
+    if (x < iWidth) { // partial byte at the end
+        uc = 0;
+        for (; x<iWidth; x++) {
+            if (s[x] & (1 << iRow))
+                uc |= (0x80 >> (x & 7));
+        }
+        *pPixels = ~uc;
+    }
 } /* G4ENC_getOBDLine() */
 //
+// Convert a whole page (8 lines) of a OneBitDisplay image buffer at once
+// Each group of 8 columns is an 8x8 bit transpose. pPixels receives 8 lines
+// of MSB first pixels iPitch bytes apart (0 = (iWidth+7)/8)
+//
+void G4ENC_getOBDPage(int iWidth, uint8_t *pImage, int iPage, uint8_t *pPixels, int iPitch)
+{
+uint8_t *s, *d, ucTemp[8];
+uint64_t u64;
+int x;
+
+    if (iPitch == 0)
+        iPitch = (iWidth + 7) >> 3;
+    s = &pImage[iPage * iWidth];
+    d = pPixels;
+    for (x=0; x<iWidth; x+=8) {
+        if (x + 8 <= iWidth) {
+            u64 = G4ENCLoad64(&s[x], 1); // column 0 in the top byte becomes the MSB
+        } else { // partial group at the end
+            memset(ucTemp, 0, sizeof(ucTemp));
+            memcpy(ucTemp, &s[x], iWidth - x);
+            u64 = G4ENCLoad64(ucTemp, 1);
+        }
+        u64 = ~G4ENCTranspose8x8(u64); // set bits are black
+        d[0] = (uint8_t)u64; // unrolled; a loop of stores takes twice as long
+        d[iPitch] = (uint8_t)(u64 >> 8);
+        d[iPitch*2] = (uint8_t)(u64 >> 16);
+        d[iPitch*3] = (uint8_t)(u64 >> 24);
+        d[iPitch*4] = (uint8_t)(u64 >> 32);
+        d[iPitch*5] = (uint8_t)(u64 >> 40);
+        d[iPitch*6] = (uint8_t)(u64 >> 48);
+        d[iPitch*7] = (uint8_t)(u64 >> 56);
+        d++;
+    }
+} /* G4ENC_getOBDPage() */
+//
 // Returns the number of bytes of G4 created by the encoder
 //
 int G4ENC_getOutSize(G4ENCIMAGE *pImage)
@@ -523,6 +2594,22 @@ int G4ENC_getTIFFHeaderSize(void)
 {
     return ((G4ENC_TAG_COUNT * 12) + 14 + (int)strlen(SOFTWARE)+1);
 } /* getTIFFHeaderSize() */
+//
+// Returns the TIFF header size for this image
+// When the image is divided into multiple strips, the header grows to hold
+// the strip offset and strip byte count arrays
+//
+int G4ENC_getTIFFHeaderSizeEx(G4ENCIMAGE *pImage)
+{
+    int iSize = G4ENC_getTIFFHeaderSize();
+    if (pImage != NULL && pImage->iT4K != 0)
+        iSize += 12; // T4Options tag
+    if (pImage != NULL && pImage->iStripCount > 1) {
+        iSize = (iSize + 1) & ~1; // arrays start on a word boundary
+        iSize += pImage->iStripCount * 8;
+    }
+    return iSize;
+} /* G4ENC_getTIFFHeaderSizeEx() */
 
 //
 // Add a TIFF tag to the header output
@@ -544,42 +2631,257 @@ static int G4ENCAddTIFFTag(uint8_t *pOut, int iOff, int iTag, int iCount, uint8_
     return iOff+12;
 } /* G4ENCAddTIFFTag() */
 
-int G4ENC_getTIFFHeader(G4ENCIMAGE *pImage, uint8_t *pOut)
+//
+// Write a uint32_t in little-endian order
+//
+static void G4ENCWriteLong(uint8_t *pOut, uint32_t ulValue)
+{
+    pOut[0] = (uint8_t)ulValue;
+    pOut[1] = (uint8_t)(ulValue >> 8);
+    pOut[2] = (uint8_t)(ulValue >> 16);
+    pOut[3] = (uint8_t)(ulValue >> 24);
+} /* G4ENCWriteLong() */
+
+//
+// Create the TIFF file header and IFD (+ the software name)
+// iBase is the file offset of pOut; the 8 byte file header is only written at
+// the start of the file, later pages of a multi-page file begin with their IFD.
+// iDataOff is the file offset of the G4 data (single strip) and iOffsets/iCounts
+// are the file offsets of the strip offset and byte count arrays (multiple strips)
+// Returns the number of bytes written
+//
+static int G4ENCMakeTIFFIFD(G4ENCIMAGE *pImage, uint8_t *pOut, int iBase, int iDataOff, int iOffsets, int iCounts)
 {
     int iOff = 0; // output offset
-    
-    if (pImage == NULL || pOut == NULL)
-        return G4ENC_INVALID_PARAMETER;
-    
-    if (pImage->ucFillOrder != G4ENC_MSB_FIRST && pImage->ucFillOrder != G4ENC_LSB_FIRST)
-        return G4ENC_NOT_INITIALIZED;
-    
-    // Create a TIFF file header byte by byte, then tag by tags
-    pOut[iOff++] = 'I'; // Intel (little-endian) byte order
-    pOut[iOff++] = 'I';
-    pOut[iOff++] = 0x2a; // TIFF Version 4.2
-    pOut[iOff++] = 0x00;
-    pOut[iOff++] = 0x08; // uint32_t offset to IFD
-    pOut[iOff++] = 0x00;
-    pOut[iOff++] = 0x00;
-    pOut[iOff++] = 0x00;
-    pOut[iOff++] = G4ENC_TAG_COUNT; // uint16_t tag count
+    int iStrips = pImage->iStripCount;
+
+    if (iBase == 0) { // Create a TIFF file header byte by byte, then tag by tags
+        pOut[iOff++] = 'I'; // Intel (little-endian) byte order
+        pOut[iOff++] = 'I';
+        pOut[iOff++] = 0x2a; // TIFF Version 4.2
+        pOut[iOff++] = 0x00;
+        pOut[iOff++] = 0x08; // uint32_t offset to IFD
+        pOut[iOff++] = 0x00;
+        pOut[iOff++] = 0x00;
+        pOut[iOff++] = 0x00;
+    }
+    pOut[iOff++] = G4ENC_TAG_COUNT + (pImage->iT4K != 0); // uint16_t tag count (+ T4Options)
     pOut[iOff++] = 0x00;
-    iOff = G4ENCAddTIFFTag(pOut, iOff, 256, 1, G4ENC_TAG_SHORT, pImage->iWidth);
-    iOff = G4ENCAddTIFFTag(pOut, iOff, 257, 1, G4ENC_TAG_SHORT, pImage->iHeight);
+    iOff = G4ENCAddTIFFTag(pOut, iOff, 256, 1, G4ENC_TAG_TYPE(pImage->iWidth), pImage->iWidth);
+    iOff = G4ENCAddTIFFTag(pOut, iOff, 257, 1, G4ENC_TAG_TYPE(pImage->iHeight), pImage->iHeight);
     iOff = G4ENCAddTIFFTag(pOut, iOff, 258, 1, G4ENC_TAG_SHORT, 1); // bits per sample
-    iOff = G4ENCAddTIFFTag(pOut, iOff, 259, 1, G4ENC_TAG_SHORT, 4); // compression
+    iOff = G4ENCAddTIFFTag(pOut, iOff, 259, 1, G4ENC_TAG_SHORT, (pImage->iT4K) ? 3 : 4); // compression (T.4 or T.6)
     iOff = G4ENCAddTIFFTag(pOut, iOff, 262, 1, G4ENC_TAG_SHORT, 0); // photometric interpretation - white is zero
     iOff = G4ENCAddTIFFTag(pOut, iOff, 266, 1, G4ENC_TAG_SHORT, pImage->ucFillOrder); // bit fill order (direction)
-    iOff = G4ENCAddTIFFTag(pOut, iOff, 273, 1, G4ENC_TAG_LONG, 14+(G4ENC_TAG_COUNT*12)+(int)strlen(SOFTWARE)+1); // strip offsets
-    iOff = G4ENCAddTIFFTag(pOut, iOff, 277, 1, G4ENC_TAG_SHORT, 1); // samples per pixel
-    iOff = G4ENCAddTIFFTag(pOut, iOff, 278, 1, G4ENC_TAG_SHORT, pImage->iHeight); // rows per strip
-    iOff = G4ENCAddTIFFTag(pOut, iOff, 279, 1, G4ENC_TAG_SHORT, pImage->iDataSize); // strip byte counts
-    iOff = G4ENCAddTIFFTag(pOut, iOff, 305, (int)strlen(SOFTWARE)+1, G4ENC_TAG_ASCII, iOff+16); // Software
-    pOut[iOff++] = 0; // terminating IFD = 0x00000000
+    if (iStrips > 1) {
+        iOff = G4ENCAddTIFFTag(pOut, iOff, 273, iStrips, G4ENC_TAG_LONG, iOffsets); // strip offsets
+        iOff = G4ENCAddTIFFTag(pOut, iOff, 277, 1, G4ENC_TAG_SHORT, 1); // samples per pixel
+        iOff = G4ENCAddTIFFTag(pOut, iOff, 278, 1, G4ENC_TAG_TYPE(pImage->iRowsPerStrip), pImage->iRowsPerStrip); // rows per strip
+        iOff = G4ENCAddTIFFTag(pOut, iOff, 279, iStrips, G4ENC_TAG_LONG, iCounts); // strip byte counts
+    } else {
+        iOff = G4ENCAddTIFFTag(pOut, iOff, 273, 1, G4ENC_TAG_LONG, iDataOff); // strip offsets
+        iOff = G4ENCAddTIFFTag(pOut, iOff, 277, 1, G4ENC_TAG_SHORT, 1); // samples per pixel
+        iOff = G4ENCAddTIFFTag(pOut, iOff, 278, 1, G4ENC_TAG_TYPE(pImage->iHeight), pImage->iHeight); // rows per strip
+        iOff = G4ENCAddTIFFTag(pOut, iOff, 279, 1, G4ENC_TAG_LONG, pImage->iDataSize); // strip byte counts
+    }
+    if (pImage->iT4K) // T4Options: bit 0 = 2D coding, bit 2 = fill bits before EOLs
+        iOff = G4ENCAddTIFFTag(pOut, iOff, 292, 1, G4ENC_TAG_LONG, (pImage->iT4K > 1) | pImage->iT4Options);
+    iOff = G4ENCAddTIFFTag(pOut, iOff, 305, (int)strlen(SOFTWARE)+1, G4ENC_TAG_ASCII, iBase+iOff+16); // Software
+    pOut[iOff++] = 0; // next IFD = 0x00000000 (linked later by G4ENC_addTIFFPage)
     pOut[iOff++] = 0;
     pOut[iOff++] = 0;
     pOut[iOff++] = 0;
     memcpy(&pOut[iOff], SOFTWARE, strlen(SOFTWARE)+1);
+    return iOff + (int)strlen(SOFTWARE)+1;
+} /* G4ENCMakeTIFFIFD() */
+
+int G4ENC_getTIFFHeader(G4ENCIMAGE *pImage, uint8_t *pOut)
+{
+    int iOff; // output offset
+    int iStrips, iOffsets, iCounts, iDataOff;
+    uint32_t ulOffset;
+    
+    if (pImage == NULL || pOut == NULL)
+        return G4ENC_INVALID_PARAMETER;
+    
+    if (pImage->ucFillOrder != G4ENC_MSB_FIRST && pImage->ucFillOrder != G4ENC_LSB_FIRST)
+        return G4ENC_NOT_INITIALIZED;
+    iStrips = pImage->iStripCount;
+    if (iStrips > 1 && pImage->pStripSizes == NULL) // can't describe the strips
+        return G4ENC_INVALID_PARAMETER;
+    iDataOff = G4ENC_getTIFFHeaderSizeEx(pImage);
+    iOffsets = iDataOff - (iStrips * 8); // multi-strip arrays (unused for 1 strip)
+    iCounts = iOffsets + (iStrips * 4);
+    iOff = G4ENCMakeTIFFIFD(pImage, pOut, 0, iDataOff, iOffsets, iCounts);
+    if (iStrips > 1) { // fill in the strip offset and size arrays
+        if (iOffsets > iOff)
+            pOut[iOffsets-1] = 0; // word alignment padding
+        ulOffset = (uint32_t)iDataOff;
+        for (int i=0; i<iStrips; i++) {
+            G4ENCWriteLong(&pOut[iOffsets + i*4], ulOffset);
+            G4ENCWriteLong(&pOut[iCounts + i*4], pImage->pStripSizes[i]);
+            ulOffset += pImage->pStripSizes[i];
+        }
+    }
     return G4ENC_SUCCESS;
 } /* G4ENC_getTIFFHeader() */
+//
+// Write part of a streamed TIFF file; a short write (e.g. a full disk)
+// stops the encoder with G4ENC_WRITE_ERROR
+//
+static int G4ENCTIFFWrite(G4ENCIMAGE *pImage, uint8_t *pBuf, int iLen)
+{
+    if (G4ENCWrite(pImage, pBuf, iLen) != iLen) {
+        pImage->iError = G4ENC_WRITE_ERROR;
+        return G4ENC_WRITE_ERROR;
+    }
+    return G4ENC_SUCCESS;
+} /* G4ENCTIFFWrite() */
+//
+// Move the write position of a streamed TIFF file
+//
+static int G4ENCTIFFSeek(G4ENCIMAGE *pImage, G4ENC_SEEK_CALLBACK *pfnSeek, int iPosition)
+{
+    if ((*pfnSeek)(iPosition) < 0) {
+        pImage->iError = G4ENC_WRITE_ERROR;
+        return G4ENC_WRITE_ERROR;
+    }
+    return G4ENC_SUCCESS;
+} /* G4ENCTIFFSeek() */
+//
+// Stream the image as a TIFF file through the write callback
+// A placeholder header is written right away, the G4 data follows as it's
+// generated and when the image is complete, the strip arrays (for more than 1 strip)
+// are written after the data and the sink seeks back to the start to rewrite the
+// header with the final values. The memory needed doesn't depend on the output size.
+// The sink is left at the end of the file. Call after G4ENC_init() (and
+// G4ENC_setStrips() with a strip size array if using more than 1 strip) and
+// before adding any lines. If the sink fails to write or seek, the encoder
+// stops with G4ENC_WRITE_ERROR.
+//
+int G4ENC_startTIFF(G4ENCIMAGE *pImage, G4ENC_SEEK_CALLBACK *pfnSeek)
+{
+    int iLen;
+
+    if (pImage == NULL || pfnSeek == NULL)
+        return G4ENC_INVALID_PARAMETER;
+    if (pImage->ucFillOrder != G4ENC_MSB_FIRST && pImage->ucFillOrder != G4ENC_LSB_FIRST)
+        return G4ENC_NOT_INITIALIZED;
+    if (!G4ENC_HAS_WRITER(pImage) || pImage->y != 0 || pImage->iDataSize != 0 || pImage->pPingPong[0] != NULL || pImage->pBlockBuf != NULL)
+        return G4ENC_INVALID_PARAMETER;
+    if (pImage->iStripCount > 1 && pImage->pStripSizes == NULL) // needed to write the strip arrays
+        return G4ENC_INVALID_PARAMETER;
+    iLen = G4ENC_getTIFFHeaderSize() + ((pImage->iT4K) ? 12 : 0);
+    if (iLen > pImage->iStageBufSize)
+        return G4ENC_INVALID_PARAMETER;
+    pImage->pfnSeek = pfnSeek;
+    pImage->iTIFFPageOff = 0;
+    pImage->iTIFFDataOff = iLen;
+    // no lines yet, so the staging buffer is free to build the header
+    G4ENCMakeTIFFIFD(pImage, pImage->pStageBuf, 0, iLen, 0, 0);
+    return G4ENCTIFFWrite(pImage, pImage->pStageBuf, iLen);
+} /* G4ENC_startTIFF() */
+//
+// Returns the file offset just past the current page of a streamed TIFF
+//
+static int G4ENCTIFFEnd(G4ENCIMAGE *pImage)
+{
+    int iEnd = pImage->iTIFFDataOff + pImage->iDataSize;
+    if (pImage->iStripCount > 1) // strip arrays (word aligned) follow the data
+        iEnd = ((iEnd + 1) & ~1) + pImage->iStripCount * 8;
+    return iEnd;
+} /* G4ENCTIFFEnd() */
+//
+// Append another page to a streamed TIFF file
+// Call once the previous page is complete (G4ENC_IMAGE_COMPLETE); the new
+// page's IFD is linked to the previous one and the encoder is reset for an
+// image of the new size. The fill order, callbacks and buffers are kept, so
+// the page can't be wider than the encoder was initialized for (G4ENC_MAX_WIDTH
+// with G4ENC_init()). G4ENC_setStrips() and G4ENC_setVerify() can be called
+// again for the new page before adding lines.
+//
+int G4ENC_addTIFFPage(G4ENCIMAGE *pImage, int iWidth, int iHeight)
+{
+    G4ENC_SEEK_CALLBACK *pfnSeek;
+    uint8_t ucTemp[4];
+    int iEnd, iLen, iNext, rc, iK, iOptions;
+
+    if (pImage == NULL)
+        return G4ENC_INVALID_PARAMETER;
+    if (pImage->pfnSeek == NULL) // G4ENC_startTIFF() wasn't called
+        return G4ENC_NOT_INITIALIZED;
+    if (pImage->y < pImage->iHeight || iWidth > pImage->iMaxWidth)
+        return G4ENC_INVALID_PARAMETER;
+    pfnSeek = pImage->pfnSeek;
+    iEnd = G4ENCTIFFEnd(pImage);
+    // the previous IFD's next pointer follows its tags
+    iNext = ((pImage->iTIFFPageOff == 0) ? 8 : pImage->iTIFFPageOff) + 2 + ((G4ENC_TAG_COUNT + (pImage->iT4K != 0)) * 12);
+    iK = pImage->iT4K; // the pages share the coding
+    iOptions = pImage->iT4Options;
+    rc = G4ENCInitState(pImage, iWidth, iHeight, pImage->ucFillOrder, pImage->pfnWrite, NULL, 0, pImage->pCur, pImage->pRef, pImage->pStageBuf, pImage->iStageBufSize, pImage->pPrevLine);
+    if (rc != G4ENC_SUCCESS)
+        return rc;
+    pImage->iT4K = iK;
+    pImage->iT4Options = iOptions;
+    if (iEnd & 1) { // IFDs start on a word boundary
+        ucTemp[0] = 0;
+        if (G4ENCTIFFWrite(pImage, ucTemp, 1) != G4ENC_SUCCESS)
+            return G4ENC_WRITE_ERROR;
+        iEnd++;
+    }
+    // link the new IFD to the previous one; a broken chain would hide the page
+    G4ENCWriteLong(ucTemp, (uint32_t)iEnd);
+    if (G4ENCTIFFSeek(pImage, pfnSeek, iNext) != G4ENC_SUCCESS ||
+        G4ENCTIFFWrite(pImage, ucTemp, 4) != G4ENC_SUCCESS ||
+        G4ENCTIFFSeek(pImage, pfnSeek, iEnd) != G4ENC_SUCCESS)
+        return G4ENC_WRITE_ERROR;
+    pImage->pfnSeek = pfnSeek;
+    pImage->iTIFFPageOff = iEnd;
+    iLen = G4ENCMakeTIFFIFD(pImage, pImage->pStageBuf, iEnd, 0, 0, 0); // placeholder
+    pImage->iTIFFDataOff = iEnd + iLen;
+    return G4ENCTIFFWrite(pImage, pImage->pStageBuf, iLen);
+} /* G4ENC_addTIFFPage() */
+//
+// Finish a streamed TIFF file once all of the G4 data has been written
+// The strip arrays are written in pieces through the staging buffer
+// Returns G4ENC_IMAGE_COMPLETE or G4ENC_WRITE_ERROR
+//
+static int G4ENCFinishTIFF(G4ENCIMAGE *pImage)
+{
+    uint8_t *pBuf = pImage->pStageBuf; // free once the image is complete
+    int i, iLen, iOffsets = 0, iCounts = 0;
+    int iEnd = pImage->iTIFFDataOff + pImage->iDataSize;
+    uint32_t ulValue;
+
+    if (pImage->iStripCount > 1) {
+        iLen = 0;
+        if (iEnd & 1)
+            pBuf[iLen++] = 0; // the arrays start on a word boundary
+        iOffsets = iEnd + iLen;
+        iCounts = iOffsets + pImage->iStripCount * 4;
+        ulValue = (uint32_t)pImage->iTIFFDataOff;
+        for (i=0; i<pImage->iStripCount * 2; i++) {
+            if (iLen + 4 > pImage->iStageBufSize) {
+                if (G4ENCTIFFWrite(pImage, pBuf, iLen) != G4ENC_SUCCESS)
+                    return G4ENC_WRITE_ERROR;
+                iLen = 0;
+            }
+            if (i < pImage->iStripCount) { // strip offsets
+                G4ENCWriteLong(&pBuf[iLen], ulValue);
+                ulValue += pImage->pStripSizes[i];
+            } else { // strip byte counts
+                G4ENCWriteLong(&pBuf[iLen], pImage->pStripSizes[i - pImage->iStripCount]);
+            }
+            iLen += 4;
+        }
+        if (G4ENCTIFFWrite(pImage, pBuf, iLen) != G4ENC_SUCCESS)
+            return G4ENC_WRITE_ERROR;
+    }
+    if (G4ENCTIFFSeek(pImage, pImage->pfnSeek, pImage->iTIFFPageOff) != G4ENC_SUCCESS)
+        return G4ENC_WRITE_ERROR;
+    iLen = G4ENCMakeTIFFIFD(pImage, pBuf, pImage->iTIFFPageOff, pImage->iTIFFDataOff, iOffsets, iCounts);
+    if (G4ENCTIFFWrite(pImage, pBuf, iLen) != G4ENC_SUCCESS ||
+        G4ENCTIFFSeek(pImage, pImage->pfnSeek, G4ENCTIFFEnd(pImage)) != G4ENC_SUCCESS)
+        return G4ENC_WRITE_ERROR;
+    return G4ENC_IMAGE_COMPLETE;
+} /* G4ENCFinishTIFF() */